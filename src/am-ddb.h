@@ -55,6 +55,24 @@ extern "C"
     #define DB$FRN 34 // number of first record
     #define SIZ$DB 40 // size of DDB
 
+    //      vdkdrv calling convention: R0 points to the DDB, DB$FLG bit
+    //      DF$WRT asks for a write (else a read), and DB$ERR is set to
+    //      one of the DE$ codes when the call returns.  with DF$ASY the
+    //      driver may return with DF$BSY set and the transfer still in
+    //      progress; DB$ERR is then set, DF$BSY cleared and the disk
+    //      interrupt raised when it completes.  if the driver is
+    //      following DB$QCL, DDBs linked from the one in R0 that have
+    //      DF$ASY set may be queued by the same call
+
+    #define DF$WRT 0x80 // DB$FLG: write the record
+    #define DF$ASY 0x40 // DB$FLG: caller can take a completion interrupt
+    #define DF$BSY 0x20 // DB$FLG: transfer in progress
+    #define DE$OK  0    // transfer done
+    #define DE$DRV 1    // no such drive
+    #define DE$REC 2    // record number out of range
+    #define DE$WPT 3    // drive is write protected
+    #define DE$IO  4    // host I/O error
+
 #ifdef __cplusplus
 }
 #endif
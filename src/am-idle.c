@@ -0,0 +1,142 @@
+/* am-idle.c     (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include <time.h>
+#include "am-idle.h"
+
+//
+// Many AMOS systems never WFI; with no job to run the scheduler just
+// loops in the monitor waiting for the clock or a device interrupt to
+// make a job runnable.  Detected here, that loop parks the CPU thread
+// until the next interrupt the same as WFI does.
+//
+// If the host knows where the idle loop is (from the monitor listing)
+// it passes the PC range and any backward branch into it parks.  If
+// not, a loop is taken as idle when a backward branch keeps landing on
+// the same PC, below MEMBAS (i.e. monitor code, not a user job), every
+// pass takes the same number of instructions, R0-R5, SP and JOBCUR are
+// the same at the top of each pass, and nothing at all is stored to
+// memory meanwhile - a loop that changes neither registers nor memory
+// is only waiting for something outside it to happen.  one that counts
+// in memory (INC @#X / CMP @#X,#N / BNE) is getting somewhere and runs.
+// an interrupt taken during the loop stores too, so the loop is
+// learned again after each one.
+//
+
+#define AM_IDLE_HITS 8                  /* identical passes to learn */
+
+#define JOBCUR 0x4E
+#define MEMBAS 0x46
+
+static uint64_t idle_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+void am_idle_enable(wd16_cpu_state_t* wd16_cpu_state, int on, uint16_t lo, uint16_t hi) {
+  AMIDLE *idle = &wd16_cpu_state->amidle;
+
+  idle->lo = lo;
+  idle->hi = hi;
+  idle->head = 0;
+  idle->hits = 0;
+  idle->on = on;
+}
+
+static void idle_candidate(wd16_cpu_state_t* wd16_cpu_state, uint16_t jobcur) {
+  AMIDLE *idle = &wd16_cpu_state->amidle;
+
+  idle->head = wd16_cpu_state->regs.PC;
+  idle->jobcur = jobcur;
+  memcpy(idle->r, wd16_cpu_state->regs.gpr, sizeof(idle->r));
+  idle->stored = idle->stores;
+  idle->inst = wd16_cpu_state->regs.instcount;
+  idle->period = 0;
+  idle->hits = 0;
+}
+
+//
+// a backward branch has been taken, see if it closes the idle loop
+//
+void am_idle_branch(wd16_cpu_state_t* wd16_cpu_state) {
+  AMIDLE *idle = &wd16_cpu_state->amidle;
+  uint16_t pc = wd16_cpu_state->regs.PC;
+  uint16_t word;
+  uint64_t period, n, start;
+
+  if ((wd16_cpu_state->regs.PS.I2 == 0) || wd16_cpu_state->regs.intpending)
+    return;
+  if (wd16_cpu_state->regs.tracing || wd16_cpu_state->regs.stepping)
+    return;
+
+  if (idle->hi) {
+    if ((pc < idle->lo) || (pc > idle->hi))
+      return;
+  } else {
+    wd16_cpu_state->getAMword((unsigned char *)&word, JOBCUR);
+    if ((pc != idle->head) || (word != idle->jobcur) || (idle->stores != idle->stored) ||
+        memcmp(idle->r, wd16_cpu_state->regs.gpr, sizeof(idle->r))) {
+      idle_candidate(wd16_cpu_state, word);
+      return;
+    }
+    period = wd16_cpu_state->regs.instcount - idle->inst;
+    idle->inst = wd16_cpu_state->regs.instcount;
+    if (period != idle->period) {
+      idle->period = period;
+      idle->hits = 0;
+      return;
+    }
+    if (idle->hits < AM_IDLE_HITS) {
+      if (++idle->hits == AM_IDLE_HITS) {
+        wd16_cpu_state->getAMword((unsigned char *)&word, MEMBAS);
+        if (pc >= word)                     // user job, not the monitor
+          idle_candidate(wd16_cpu_state, idle->jobcur);
+      }
+      return;
+    }
+  }
+
+  //
+  // idle.  if events are scheduled skip whole passes up to the next
+  // one, so we are back at this PC with the same state and the loop
+  // can't tell (a loop given by PC range isn't known to repeat, so it
+  // just runs); otherwise wait for an interrupt in host time.
+  //
+  if (wd16_cpu_state->events.next != UINT64_MAX) {
+    if (idle->period && (wd16_cpu_state->events.next > wd16_cpu_state->regs.instcount)) {
+      n = (wd16_cpu_state->events.next - wd16_cpu_state->regs.instcount) / idle->period;
+      wd16_cpu_state->regs.instcount += n * idle->period;
+      idle->inst = wd16_cpu_state->regs.instcount;
+    }
+    return;
+  }
+  idle->parked++;
+  start = idle_now();
+  cpu_wait(AM_IDLE_PARK_NS);
+  idle->parked_ns += idle_now() - start;
+}
@@ -0,0 +1,362 @@
+/* am-vdk-aio.c  (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "am-vdk.h"
+#include "am-ddb.h"
+#include "cpu-mem.h"
+#include "cpu-dirty.h"
+
+//
+// Asynchronous virtual disk transfers.  A DDB with DF$ASY set is queued
+// to io_uring and SVCC 0 returns with DF$BSY set, so the monitor can
+// run other jobs while the transfer is in progress.  A completion
+// thread then sets DB$ERR, clears DF$BSY and raises the disk interrupt,
+// the way a DMA controller would.
+//
+// that thread writes guest memory directly, so only buffers and DDBs
+// inside a region registered with cpu_mem_region() go this way; the
+// get/put callbacks belong to the CPU thread.  anything else, or no
+// io_uring in the kernel, or a full ring, is done synchronously as
+// before.  liburing isn't assumed, the ring is set up by hand, and
+// READV/WRITEV are used as they go back to the first io_uring kernels.
+//
+
+#define VDK_AIO_DEPTH 64                /* transfers in flight       */
+#define VDK_AIO_STOP  (~0ULL)           /* user_data of the wake NOP */
+
+typedef struct _VDKIO {                 /* One queued transfer       */
+  int busy;                             /* slot in use               */
+  int drive;                            /* DB$DRI                    */
+  uint8_t *ddb;                         /* host address of the DDB   */
+  uint32_t len;                         /* DB$RSZ                    */
+  int write;                            /* DF$WRT                    */
+  uint64_t start;                       /* when AMOS asked for it    */
+  struct iovec iov;                     /* guest buffer in the host  */
+
+} VDKIO;
+
+typedef struct _VDKAIO {                /* io_uring state            */
+  int fd;                               /* ring                      */
+  int level;                            /* interrupt on completion   */
+  pthread_t thread;                     /* completion thread         */
+  wd16_cpu_state_t *cpu;                /* for the completion thread */
+  void *sq_ring, *cq_ring;              /* ring mappings             */
+  size_t sq_size, cq_size, sqe_size;    /* ... and their sizes       */
+  unsigned *sq_tail, *sq_mask, *sq_array;
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  uint64_t submitted;                   /* transfers queued          */
+  uint64_t completed;                   /* ... and finished          */
+  VDKIO io[VDK_AIO_DEPTH];              /* transfers by slot         */
+
+} VDKAIO;
+
+static int aio_setup(struct io_uring_params *p) {
+  return (syscall(__NR_io_uring_setup, VDK_AIO_DEPTH, p));
+}
+
+static int aio_enter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+  return (syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0));
+}
+
+//
+// queue and submit one SQE; only one thread submits (the CPU, or the
+// scheduler's dispatcher when that is on), so no lock.
+// without SQPOLL the kernel only looks at the ring inside enter, so if
+// that fails the SQE can just be taken back off the tail.
+//
+static int aio_queue(VDKAIO *aio, int op, int fd, void *buf, uint32_t len, uint64_t off, uint64_t data) {
+  struct io_uring_sqe *sqe;
+  unsigned tail = *aio->sq_tail, idx = tail & *aio->sq_mask;
+  int n;
+
+  sqe = &aio->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = op;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t)buf;
+  sqe->len = len;
+  sqe->off = off;
+  sqe->user_data = data;
+  aio->sq_array[idx] = idx;
+  __atomic_store_n(aio->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  while (((n = aio_enter(aio->fd, 1, 0, 0)) < 0) &&
+         ((errno == EINTR) || (errno == EAGAIN) || (errno == EBUSY)))
+    usleep(10);                           // completions are draining
+  if (n != 1)
+    __atomic_store_n(aio->sq_tail, tail, __ATOMIC_RELEASE);
+  return (n == 1);
+}
+
+//
+// finish a transfer off the CPU thread, as a DMA controller would
+//
+void am_vdk_aio_done(wd16_cpu_state_t* wd16_cpu_state, int drive, uint8_t *ddb, int err, int write, uint16_t len, uint64_t start) {
+  VDKDRIVE *d = &wd16_cpu_state->vdk->drive[drive];
+
+  ddb[DB$ERR] = err;
+  am_vdk_account(wd16_cpu_state, drive, write, len, err, start, true);
+  __atomic_fetch_and(&ddb[DB$FLG], (uint8_t)~DF$BSY, __ATOMIC_RELEASE);
+  cpu_dirty_host(wd16_cpu_state, ddb, SIZ$DB);
+  __atomic_fetch_sub(&d->inflight, 1, __ATOMIC_RELEASE);
+  cpu_interrupt(wd16_cpu_state->vdk->aio->level);
+}
+
+static void aio_complete(VDKAIO *aio, struct io_uring_cqe *cqe) {
+  VDKIO *io = &aio->io[cqe->user_data];
+  int drive = io->drive, write = io->write;
+  uint16_t len = io->len;
+  uint64_t start = io->start;
+  uint8_t *ddb = io->ddb;
+
+  if (!write)                             // DMA into guest memory
+    cpu_dirty_host(aio->cpu, io->iov.iov_base, len);
+  __atomic_store_n(&io->busy, 0, __ATOMIC_RELEASE);
+  aio->completed++;
+  am_vdk_sched_done(aio->cpu, ddb);
+  am_vdk_aio_done(aio->cpu, drive, ddb, (cqe->res == (int)len) ? DE$OK : DE$IO, write, len, start);
+}
+
+static void *aio_thread(void *arg) {
+  VDKAIO *aio = arg;
+  struct io_uring_cqe *cqe;
+  unsigned head, tail;
+
+  for (;;) {
+    head = *aio->cq_head;
+    tail = __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+      if ((aio_enter(aio->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0) && (errno != EINTR))
+        return (NULL);
+      continue;
+    }
+    for (; head != tail; head++) {
+      cqe = &aio->cqes[head & *aio->cq_mask];
+      if (cqe->user_data == VDK_AIO_STOP) {
+        __atomic_store_n(aio->cq_head, head + 1, __ATOMIC_RELEASE);
+        return (NULL);
+      }
+      aio_complete(aio, cqe);
+    }
+    __atomic_store_n(aio->cq_head, head, __ATOMIC_RELEASE);
+  }
+}
+
+static void aio_close(VDKAIO *aio) {
+  if (aio->sqes)
+    munmap(aio->sqes, aio->sqe_size);
+  if (aio->cq_ring && (aio->cq_ring != aio->sq_ring))
+    munmap(aio->cq_ring, aio->cq_size);
+  if (aio->sq_ring)
+    munmap(aio->sq_ring, aio->sq_size);
+  close(aio->fd);
+  free(aio);
+}
+
+static VDKAIO *aio_open(void) {
+  struct io_uring_params p;
+  VDKAIO *aio;
+  void *ring;
+
+  if ((aio = calloc(1, sizeof(VDKAIO))) == NULL)
+    return (NULL);
+  memset(&p, 0, sizeof(p));
+  if ((aio->fd = aio_setup(&p)) < 0) {
+    free(aio);
+    return (NULL);
+  }
+
+  aio->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  aio->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    aio->sq_size = aio->cq_size = (aio->sq_size > aio->cq_size) ? aio->sq_size : aio->cq_size;
+  ring = mmap(NULL, aio->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->fd, IORING_OFF_SQ_RING);
+  if (ring == MAP_FAILED) {
+    close(aio->fd);
+    free(aio);
+    return (NULL);
+  }
+  aio->sq_ring = aio->cq_ring = ring;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    ring = mmap(NULL, aio->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->fd, IORING_OFF_CQ_RING);
+    if (ring == MAP_FAILED) {
+      aio->cq_ring = NULL;
+      aio_close(aio);
+      return (NULL);
+    }
+    aio->cq_ring = ring;
+  }
+  aio->sqe_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  ring = mmap(NULL, aio->sqe_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, aio->fd, IORING_OFF_SQES);
+  if (ring == MAP_FAILED) {
+    aio_close(aio);
+    return (NULL);
+  }
+  aio->sqes = ring;
+
+  aio->sq_tail = (unsigned *)((char *)aio->sq_ring + p.sq_off.tail);
+  aio->sq_mask = (unsigned *)((char *)aio->sq_ring + p.sq_off.ring_mask);
+  aio->sq_array = (unsigned *)((char *)aio->sq_ring + p.sq_off.array);
+  aio->cq_head = (unsigned *)((char *)aio->cq_ring + p.cq_off.head);
+  aio->cq_tail = (unsigned *)((char *)aio->cq_ring + p.cq_off.tail);
+  aio->cq_mask = (unsigned *)((char *)aio->cq_ring + p.cq_off.ring_mask);
+  aio->cqes = (struct io_uring_cqe *)((char *)aio->cq_ring + p.cq_off.cqes);
+  return (aio);
+}
+
+//
+// turn asynchronous transfers on, completing with interrupt 'level'
+// (0-8), or off with -1.  returns false if io_uring isn't available,
+// in which case DF$ASY requests just complete synchronously.
+//
+int am_vdk_async(wd16_cpu_state_t* wd16_cpu_state, int level) {
+  VDKAIO *aio;
+  int i;
+
+  if ((level > 8) || ((wd16_cpu_state->vdk == NULL) && (level < 0)))
+    return (level < 0);
+  if (wd16_cpu_state->vdk == NULL)
+    if ((wd16_cpu_state->vdk = calloc(1, sizeof(AMVDK))) == NULL)
+      return (false);
+
+  if ((aio = wd16_cpu_state->vdk->aio) != NULL) {
+    if (level >= 0) {
+      aio->level = level;
+      return (true);
+    }
+    am_vdk_sched(wd16_cpu_state, 0, 0, false);
+    for (i = 0; i < VDK_DRIVES; i++)
+      am_vdk_aio_drain(wd16_cpu_state, i);
+    wd16_cpu_state->vdk->aio = NULL;
+    aio_queue(aio, IORING_OP_NOP, -1, NULL, 0, 0, VDK_AIO_STOP);
+    pthread_join(aio->thread, NULL);
+    aio_close(aio);
+    return (true);
+  }
+  if (level < 0)
+    return (true);
+
+  if ((aio = aio_open()) == NULL)
+    return (false);
+  aio->level = level;
+  aio->cpu = wd16_cpu_state;
+  if (pthread_create(&aio->thread, NULL, aio_thread, aio) != 0) {
+    aio_close(aio);
+    return (false);
+  }
+  wd16_cpu_state->vdk->aio = aio;
+  return (true);
+}
+
+//
+// true if a transfer could complete off the CPU thread
+//
+int am_vdk_aio_able(wd16_cpu_state_t* wd16_cpu_state, int drive, uint16_t ddb, uint16_t bad, uint16_t rsz) {
+  VDKDRIVE *d = &wd16_cpu_state->vdk->drive[drive];
+
+  if ((wd16_cpu_state->vdk->aio == NULL) || (rsz == 0) || (d->fd < 0) || wd16_cpu_state->vdk->wb)
+    return (false);                       // no async for overlays, and
+                                          // write-back is quicker
+  return (cpu_mem_host(wd16_cpu_state, ddb, SIZ$DB) && cpu_mem_host(wd16_cpu_state, bad, rsz));
+}
+
+//
+// queue a transfer the caller has already checked against the drive,
+// which AMOS asked for at 'start' (am_vdk_now()).  returns true if it
+// is in flight (DF$BSY is set), false if it has to be done
+// synchronously instead.  DF$BSY the scheduler set stays set either
+// way, for am_vdk_aio_done() to clear.
+//
+int am_vdk_aio_submit(wd16_cpu_state_t* wd16_cpu_state, int drive, uint16_t ddb, uint16_t bad, uint16_t rsz, uint64_t off, int write, uint64_t start) {
+  VDKAIO *aio = wd16_cpu_state->vdk->aio;
+  VDKDRIVE *d = &wd16_cpu_state->vdk->drive[drive];
+  uint8_t *ddbp, *buf;
+  int i, owned;
+
+  if (!am_vdk_aio_able(wd16_cpu_state, drive, ddb, bad, rsz))
+    return (false);
+  ddbp = cpu_mem_host(wd16_cpu_state, ddb, SIZ$DB);
+  buf = cpu_mem_host(wd16_cpu_state, bad, rsz);
+  for (i = 0; i < VDK_AIO_DEPTH; i++)
+    if (__atomic_load_n(&aio->io[i].busy, __ATOMIC_ACQUIRE) == 0)
+      break;
+  if (i == VDK_AIO_DEPTH)
+    return (false);
+
+  aio->io[i].busy = 1;
+  aio->io[i].drive = drive;
+  aio->io[i].ddb = ddbp;
+  aio->io[i].len = rsz;
+  aio->io[i].write = write;
+  aio->io[i].start = start;
+  aio->io[i].iov.iov_base = buf;
+  aio->io[i].iov.iov_len = rsz;
+  owned = !(__atomic_fetch_or(&ddbp[DB$FLG], (uint8_t)DF$BSY, __ATOMIC_RELAXED) & DF$BSY);
+  cpu_dirty_mark(wd16_cpu_state, ddb, SIZ$DB);
+  __atomic_fetch_add(&d->inflight, 1, __ATOMIC_RELAXED);
+  if (!aio_queue(aio, write ? IORING_OP_WRITEV : IORING_OP_READV, d->fd, &aio->io[i].iov, 1, off, i)) {
+    // the ring is broken; do this one synchronously
+    if (owned)
+      __atomic_fetch_and(&ddbp[DB$FLG], (uint8_t)~DF$BSY, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&d->inflight, 1, __ATOMIC_RELAXED);
+    aio->io[i].busy = 0;
+    return (false);
+  }
+  aio->submitted++;
+  return (true);
+}
+
+//
+// wait for a drive's transfers to finish, e.g. before unmounting it
+//
+void am_vdk_aio_drain(wd16_cpu_state_t* wd16_cpu_state, int drive) {
+  VDKDRIVE *d = &wd16_cpu_state->vdk->drive[drive];
+
+  while (__atomic_load_n(&d->inflight, __ATOMIC_ACQUIRE))
+    usleep(100);
+}
+
+//
+// see am_vdk_atfork().  the child shares the parent's ring, which only
+// the parent may use, so it sets up its own.
+//
+void am_vdk_aio_atfork(wd16_cpu_state_t* wd16_cpu_state, int phase) {
+  VDKAIO *aio = wd16_cpu_state->vdk->aio;
+  int level;
+
+  if ((aio == NULL) || (phase != VDK_FORK_CHILD))
+    return;
+  level = aio->level;
+  wd16_cpu_state->vdk->aio = NULL;
+  aio_close(aio);
+  am_vdk_async(wd16_cpu_state, level);    // else DF$ASY goes synchronous
+}
@@ -0,0 +1,455 @@
+/* am-vdk-cache.c (c) Copyright Mike Sharkey, 2021                   */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include <sys/mman.h>
+#include "am-vdk.h"
+
+//
+// Block cache and read-ahead for the virtual disk driver.
+//
+// a drive that is memory mapped already has the host page cache in
+// front of it, so it only gets read-ahead: once AMOS is seen reading
+// records in order (a sequential file, a compile) the next records are
+// madvise()d so the kernel fetches them before they are faulted in.
+//
+// a drive that has to use pread (VDK_NOMAP, an image that can't be
+// mapped, or an overlay) would otherwise make a system call per record,
+// so its records are kept in a cache shared by all the drives, with
+// CLOCK replacement and a fixed number of blocks.  read-ahead for these
+// drives is done by a thread that reads records into the cache before
+// they are asked for.
+//
+
+#define VDK_SEQ_RUN  2                  /* in-order reads to trigger */
+#define VDK_RA_QUEUE 256                /* read-ahead requests held  */
+
+typedef struct _VDKBLOCK {              /* One cached record         */
+  int drive;                            /* DB$DRI, -1 when free      */
+  uint32_t rnm;                         /* record number             */
+  uint16_t len;                         /* record size               */
+  uint8_t ref;                          /* used since hand passed    */
+  uint8_t pf;                           /* read ahead, not yet used  */
+  int next;                             /* hash chain, -1 at end     */
+  uint8_t *data;                        /* record                    */
+
+} VDKBLOCK;
+
+typedef struct _VDKRA {                 /* Record to read ahead      */
+  int drive;                            /* -1 once cancelled         */
+  uint32_t rnm;
+  uint16_t len;
+
+} VDKRA;
+
+typedef struct _VDKCACHE {              /* Block cache               */
+  pthread_mutex_t lock;                 /* CPU and read-ahead thread */
+  pthread_cond_t cond;                  /* queue and busy changes    */
+  uint32_t blocks;                      /* blocks in the cache       */
+  uint16_t block;                       /* largest record cached     */
+  uint32_t hand;                        /* CLOCK hand                */
+  uint32_t nhash;                       /* hash buckets              */
+  int *hash;                            /* first block per bucket    */
+  VDKBLOCK *blk;                        /* blocks                    */
+  uint8_t *data;                        /* storage for all blocks    */
+  uint64_t wgen;                        /* bumped by every write     */
+  pthread_t thread;                     /* read-ahead thread         */
+  int stop;                             /* thread to exit            */
+  int busy;                             /* drive being read, or -1   */
+  unsigned qhead, qtail;                /* read-ahead queue          */
+  VDKRA q[VDK_RA_QUEUE];
+  uint8_t *buf;                         /* read-ahead thread buffer  */
+
+} VDKCACHE;
+
+static unsigned cache_bucket(VDKCACHE *c, int drive, uint32_t rnm) {
+  return ((rnm * 2654435761U + drive * 40503U) % c->nhash);
+}
+
+static int cache_lookup(VDKCACHE *c, int drive, uint32_t rnm) {
+  int i;
+
+  for (i = c->hash[cache_bucket(c, drive, rnm)]; i >= 0; i = c->blk[i].next)
+    if ((c->blk[i].drive == drive) && (c->blk[i].rnm == rnm))
+      return (i);
+  return (-1);
+}
+
+static void cache_unlink(VDKCACHE *c, int i) {
+  int *link = &c->hash[cache_bucket(c, c->blk[i].drive, c->blk[i].rnm)];
+
+  while (*link != i)
+    link = &c->blk[*link].next;
+  *link = c->blk[i].next;
+  c->blk[i].drive = -1;
+}
+
+//
+// a block to reuse: the first one the hand finds free or not used
+// since it last came round
+//
+static int cache_victim(wd16_cpu_state_t* wd16_cpu_state, VDKCACHE *c) {
+  VDKBLOCK *b;
+  int i;
+
+  for (;;) {
+    i = c->hand;
+    c->hand = (c->hand + 1) % c->blocks;
+    b = &c->blk[i];
+    if (b->drive < 0)
+      return (i);
+    if (b->ref) {
+      b->ref = 0;
+      continue;
+    }
+    cache_unlink(c, i);
+    wd16_cpu_state->vdk->cstat.evicted++;
+    return (i);
+  }
+}
+
+static void cache_insert(wd16_cpu_state_t* wd16_cpu_state, VDKCACHE *c, int drive, uint32_t rnm, uint16_t len, const uint8_t *src, int pf) {
+  VDKBLOCK *b;
+  unsigned h;
+  int i;
+
+  i = cache_victim(wd16_cpu_state, c);
+  b = &c->blk[i];
+  b->drive = drive;
+  b->rnm = rnm;
+  b->len = len;
+  b->ref = !pf;
+  b->pf = pf;
+  memcpy(b->data, src, len);
+  h = cache_bucket(c, drive, rnm);
+  b->next = c->hash[h];
+  c->hash[h] = i;
+}
+
+static void *cache_thread(void *arg) {
+  wd16_cpu_state_t* wd16_cpu_state = arg;
+  VDKCACHE *c = wd16_cpu_state->vdk->cache;
+  VDKDRIVE *d;
+  VDKRA ra;
+  uint64_t wgen;
+  int n;
+
+  pthread_mutex_lock(&c->lock);
+  while (!c->stop) {
+    if (c->qhead == c->qtail) {
+      pthread_cond_wait(&c->cond, &c->lock);
+      continue;
+    }
+    ra = c->q[c->qhead++ % VDK_RA_QUEUE];
+    if ((ra.drive < 0) || (cache_lookup(c, ra.drive, ra.rnm) >= 0))
+      continue;
+    if (am_vdk_wb_dirty(wd16_cpu_state, ra.drive, ra.rnm))
+      continue;                             // the backend is behind
+    d = &wd16_cpu_state->vdk->drive[ra.drive];
+    c->busy = ra.drive;
+    wgen = c->wgen;
+    pthread_mutex_unlock(&c->lock);
+    n = d->ops->read(d, c->buf, ra.len, (uint64_t)ra.rnm * ra.len);
+    pthread_mutex_lock(&c->lock);
+    c->busy = -1;
+    pthread_cond_broadcast(&c->cond);
+    // a write while we were reading may have made what we read stale
+    if (n && (wgen == c->wgen) && (cache_lookup(c, ra.drive, ra.rnm) < 0)) {
+      cache_insert(wd16_cpu_state, c, ra.drive, ra.rnm, ra.len, c->buf, 1);
+      wd16_cpu_state->vdk->cstat.prefetched++;
+    }
+  }
+  pthread_mutex_unlock(&c->lock);
+  return (NULL);
+}
+
+static void cache_release(VDKCACHE *c) {
+  free(c->hash);
+  free(c->blk);
+  free(c->data);
+  free(c->buf);
+  free(c);
+}
+
+static void cache_free(wd16_cpu_state_t* wd16_cpu_state) {
+  VDKCACHE *c = wd16_cpu_state->vdk->cache;
+
+  if (c == NULL)
+    return;
+  pthread_mutex_lock(&c->lock);
+  c->stop = 1;
+  pthread_cond_broadcast(&c->cond);
+  pthread_mutex_unlock(&c->lock);
+  pthread_join(c->thread, NULL);
+  wd16_cpu_state->vdk->cache = NULL;
+  pthread_mutex_destroy(&c->lock);
+  pthread_cond_destroy(&c->cond);
+  cache_release(c);
+}
+
+//
+// set up a cache of 'blocks' records of up to 'block' bytes (0 blocks
+// for none), reading 'readahead' records ahead of a sequential reader
+// (0 for no read-ahead).  call it with the CPU stopped or idle.
+//
+int am_vdk_cache(wd16_cpu_state_t* wd16_cpu_state, uint32_t blocks, uint16_t block, uint32_t readahead) {
+  VDKCACHE *c;
+  uint32_t i;
+
+  if (wd16_cpu_state->vdk == NULL)
+    if ((wd16_cpu_state->vdk = calloc(1, sizeof(AMVDK))) == NULL)
+      return (false);
+  cache_free(wd16_cpu_state);
+  wd16_cpu_state->vdk->readahead = readahead;
+  if ((blocks == 0) || (block == 0))
+    return (true);
+
+  if ((c = calloc(1, sizeof(VDKCACHE))) == NULL)
+    return (false);
+  c->blocks = blocks;
+  c->block = block;
+  c->nhash = blocks * 2 + 1;
+  c->busy = -1;
+  c->hash = malloc(c->nhash * sizeof(int));
+  c->blk = calloc(blocks, sizeof(VDKBLOCK));
+  c->data = malloc((size_t)blocks * block);
+  c->buf = malloc(block);
+  if (!c->hash || !c->blk || !c->data || !c->buf) {
+    cache_release(c);
+    return (false);
+  }
+  for (i = 0; i < c->nhash; i++)
+    c->hash[i] = -1;
+  for (i = 0; i < blocks; i++) {
+    c->blk[i].drive = -1;
+    c->blk[i].data = c->data + (size_t)i * block;
+  }
+  pthread_mutex_init(&c->lock, NULL);
+  pthread_cond_init(&c->cond, NULL);
+  wd16_cpu_state->vdk->cache = c;
+  if (pthread_create(&c->thread, NULL, cache_thread, wd16_cpu_state) != 0) {
+    wd16_cpu_state->vdk->cache = NULL;
+    cache_release(c);
+    return (false);
+  }
+  return (true);
+}
+
+void am_vdk_cache_stats(wd16_cpu_state_t* wd16_cpu_state, VDKCSTAT *stat) {
+  VDKCACHE *c;
+
+  memset(stat, 0, sizeof(*stat));
+  if (wd16_cpu_state->vdk == NULL)
+    return;
+  if ((c = wd16_cpu_state->vdk->cache) != NULL)
+    pthread_mutex_lock(&c->lock);
+  *stat = wd16_cpu_state->vdk->cstat;
+  if (c)
+    pthread_mutex_unlock(&c->lock);
+}
+
+//
+// copy a cached record to 'dst', true if it was there
+//
+int am_vdk_cache_get(wd16_cpu_state_t* wd16_cpu_state, int drive, uint32_t rnm, uint16_t len, uint8_t *dst) {
+  VDKCACHE *c = wd16_cpu_state->vdk->cache;
+  VDKBLOCK *b;
+  int i;
+
+  if ((c == NULL) || (len > c->block))
+    return (false);
+  pthread_mutex_lock(&c->lock);
+  i = cache_lookup(c, drive, rnm);
+  if ((i < 0) || (c->blk[i].len != len)) {
+    wd16_cpu_state->vdk->cstat.misses++;
+    pthread_mutex_unlock(&c->lock);
+    return (false);
+  }
+  b = &c->blk[i];
+  memcpy(dst, b->data, len);
+  b->ref = 1;
+  if (b->pf) {
+    b->pf = 0;
+    wd16_cpu_state->vdk->cstat.prefetch_hits++;
+  }
+  wd16_cpu_state->vdk->cstat.hits++;
+  pthread_mutex_unlock(&c->lock);
+  return (true);
+}
+
+//
+// a record has been read ('add' true) or written: cache it, or for a
+// write just bring any cached copy up to date
+//
+void am_vdk_cache_put(wd16_cpu_state_t* wd16_cpu_state, int drive, uint32_t rnm, uint16_t len, const uint8_t *src, int add) {
+  VDKCACHE *c = wd16_cpu_state->vdk->cache;
+  int i;
+
+  if ((c == NULL) || (len > c->block))
+    return;
+  pthread_mutex_lock(&c->lock);
+  if (!add)
+    c->wgen++;
+  i = cache_lookup(c, drive, rnm);
+  if ((i >= 0) && (c->blk[i].len == len)) {
+    memcpy(c->blk[i].data, src, len);
+    c->blk[i].ref = 1;
+  } else {
+    if (i >= 0)
+      cache_unlink(c, i);
+    if (add)
+      cache_insert(wd16_cpu_state, c, drive, rnm, len, src, 0);
+  }
+  pthread_mutex_unlock(&c->lock);
+}
+
+//
+// a record is being written behind the cache's back (io_uring)
+//
+void am_vdk_cache_forget(wd16_cpu_state_t* wd16_cpu_state, int drive, uint32_t rnm) {
+  VDKCACHE *c = wd16_cpu_state->vdk->cache;
+  int i;
+
+  if (c == NULL)
+    return;
+  pthread_mutex_lock(&c->lock);
+  c->wgen++;
+  if ((i = cache_lookup(c, drive, rnm)) >= 0)
+    cache_unlink(c, i);
+  pthread_mutex_unlock(&c->lock);
+}
+
+//
+// the backend has changed under the cache (a write-back flush), so a
+// read-ahead in progress may have read data that is now out of date
+//
+void am_vdk_cache_stale(wd16_cpu_state_t* wd16_cpu_state) {
+  VDKCACHE *c = wd16_cpu_state->vdk->cache;
+
+  if (c == NULL)
+    return;
+  pthread_mutex_lock(&c->lock);
+  c->wgen++;
+  pthread_mutex_unlock(&c->lock);
+}
+
+//
+// a drive is being unmounted: cancel its read-ahead, wait for any read
+// of it in progress, and drop its blocks
+//
+void am_vdk_cache_drop(wd16_cpu_state_t* wd16_cpu_state, int drive) {
+  VDKCACHE *c = wd16_cpu_state->vdk->cache;
+  unsigned q;
+  uint32_t i;
+
+  if (c == NULL)
+    return;
+  pthread_mutex_lock(&c->lock);
+  for (q = c->qhead; q != c->qtail; q++)
+    if (c->q[q % VDK_RA_QUEUE].drive == drive)
+      c->q[q % VDK_RA_QUEUE].drive = -1;
+  while (c->busy == drive)
+    pthread_cond_wait(&c->cond, &c->lock);
+  for (i = 0; i < c->blocks; i++)
+    if (c->blk[i].drive == drive)
+      cache_unlink(c, i);
+  pthread_mutex_unlock(&c->lock);
+}
+
+//
+// record 'rnm' has just been read.  if it follows on from the last few
+// reads, make sure the next 'readahead' records are on their way, in
+// batches of at least half that so it isn't a request per record.
+//
+void am_vdk_cache_seq(wd16_cpu_state_t* wd16_cpu_state, int drive, uint32_t rnm, uint16_t len) {
+  AMVDK *vdk = wd16_cpu_state->vdk;
+  VDKDRIVE *d = &vdk->drive[drive];
+  VDKCACHE *c = vdk->cache;
+  uint32_t end, last, r;
+  uint64_t lo, hi, page;
+
+  if ((vdk->readahead == 0) || (len == 0))
+    return;
+  if (rnm == d->seq_next)
+    d->seq_run++;
+  else {
+    d->seq_run = 0;
+    d->ra_next = rnm + 1;
+  }
+  d->seq_next = rnm + 1;
+  if ((d->seq_run < VDK_SEQ_RUN) || (d->ra_next > rnm + vdk->readahead / 2))
+    return;
+
+  if (d->ra_next <= rnm)
+    d->ra_next = rnm + 1;
+  last = d->size / len;                     // records on the drive
+  end = rnm + 1 + vdk->readahead;
+  if (end > last)
+    end = last;
+  if (d->ra_next >= end)
+    return;
+
+  if (d->map) {
+    page = sysconf(_SC_PAGESIZE);
+    lo = (uint64_t)d->ra_next * len & ~(page - 1);
+    hi = (uint64_t)end * len;
+    madvise(d->map + lo, hi - lo, MADV_WILLNEED);
+    __atomic_fetch_add(&vdk->cstat.prefetched, end - d->ra_next, __ATOMIC_RELAXED);
+  } else if (c && (len <= c->block)) {
+    pthread_mutex_lock(&c->lock);
+    for (r = d->ra_next; (r < end) && (c->qtail - c->qhead < VDK_RA_QUEUE); r++) {
+      c->q[c->qtail % VDK_RA_QUEUE].drive = drive;
+      c->q[c->qtail % VDK_RA_QUEUE].rnm = r;
+      c->q[c->qtail % VDK_RA_QUEUE].len = len;
+      c->qtail++;
+    }
+    end = r;
+    pthread_cond_signal(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+  }
+  d->ra_next = end;
+}
+
+//
+// see am_vdk_atfork().  a read ahead the parent was in the middle of
+// never finishes in the child, which gets a read-ahead thread of its own.
+//
+void am_vdk_cache_atfork(wd16_cpu_state_t* wd16_cpu_state, int phase) {
+  VDKCACHE *c = wd16_cpu_state->vdk->cache;
+
+  if (c == NULL)
+    return;
+  if (phase == VDK_FORK_PREPARE) {
+    pthread_mutex_lock(&c->lock);
+    return;
+  }
+  if (phase == VDK_FORK_CHILD)
+    c->busy = -1;
+  pthread_mutex_unlock(&c->lock);
+  if ((phase == VDK_FORK_CHILD) && (pthread_create(&c->thread, NULL, cache_thread, wd16_cpu_state) != 0)) {
+    wd16_cpu_state->vdk->cache = NULL;
+    cache_release(c);
+  }
+}
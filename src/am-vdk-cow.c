@@ -0,0 +1,284 @@
+/* am-vdk-cow.c  (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "am-vdk.h"
+
+//
+// Copy-on-write disk images.  Many guests can boot from one read-only
+// base image, each with its own overlay file holding only the blocks
+// it has written.  The base may be a compressed image (am-vdk-lz.c).
+// The overlay is:
+//
+//    header       COWHDR, below, little-endian
+//    bitmap       a bit per block of the base, set once it's written
+//    data         at data_off + the block's offset in the base
+//
+// the data area is a sparse file, so only written blocks take space,
+// and blocks never written are read from the base, which stays in the
+// host page cache once for every guest sharing it.
+//
+// a block's data is synced to disk before its bit is written, so
+// after a crash a block is either the new data or still the base's.
+// that costs a sync the first time each block is written, not after.
+//
+
+#define COW_MAGIC   "AMVDKCOW"
+#define COW_VERSION 1
+#define COW_BLOCK   512                 /* an AMOS disk record       */
+#define COW_ALIGN   4096                /* data area alignment       */
+#define COW_HDRLEN  40                  /* header bytes in the file  */
+
+typedef struct _COWHDR {                /* Overlay file header       */
+  char magic[8];                        /* COW_MAGIC                 */
+  uint32_t version;                     /* COW_VERSION               */
+  uint32_t block;                       /* bytes per bitmap bit      */
+  uint64_t size;                        /* size of the base image    */
+  uint64_t map_off;                     /* bitmap offset             */
+  uint64_t data_off;                    /* data area offset          */
+
+} COWHDR;
+
+typedef struct _VDKCOW {                /* Overlay drive             */
+  int base;                             /* base image, read only     */
+  struct _VDKLZ *lz;                    /* ... or compressed one     */
+  int fd;                               /* overlay file              */
+  COWHDR hdr;                           /* overlay header            */
+  uint64_t blocks;                      /* blocks in the base        */
+  uint8_t *map;                         /* in-memory bitmap          */
+
+} VDKCOW;
+
+static int cow_written(VDKCOW *cow, uint64_t blk) {
+  return (__atomic_load_n(&cow->map[blk >> 3], __ATOMIC_ACQUIRE) & (1 << (blk & 7)));
+}
+
+//
+// read the base; a block running past its end reads as zeros there
+//
+static int cow_base(VDKCOW *cow, uint8_t *buf, uint32_t len, uint64_t off) {
+  uint32_t n = (off >= cow->hdr.size) ? 0 : (off + len > cow->hdr.size) ? cow->hdr.size - off : len;
+
+  memset(buf + n, 0, len - n);
+  if (n == 0)
+    return (true);
+  if (cow->lz)
+    return (am_vdk_lz_read(cow->lz, buf, n, off));
+  return (pread(cow->base, buf, n, off) == (ssize_t)n);
+}
+
+static int cow_read(VDKDRIVE *d, uint8_t *buf, uint32_t len, uint64_t off) {
+  VDKCOW *cow = d->priv;
+  uint64_t blk, end;
+  uint32_t n;
+
+  while (len) {
+    blk = off / cow->hdr.block;
+    end = (blk + 1) * cow->hdr.block;
+    n = (end - off < len) ? end - off : len;
+    if (cow_written(cow, blk)) {
+      if (pread(cow->fd, buf, n, cow->hdr.data_off + off) != n)
+        return (false);
+    } else if (!cow_base(cow, buf, n, off))
+      return (false);
+    buf += n;
+    off += n;
+    len -= n;
+  }
+  return (true);
+}
+
+static int cow_write(VDKDRIVE *d, const uint8_t *buf, uint32_t len, uint64_t off) {
+  VDKCOW *cow = d->priv;
+  uint64_t blk, start, end, first = off / cow->hdr.block, last = (off + len - 1) / cow->hdr.block;
+  uint32_t n, block = cow->hdr.block;
+  uint8_t tmp[COW_BLOCK];
+  int fresh = false;
+
+  if (len == 0)
+    return (true);
+  while (len) {
+    blk = off / block;
+    start = blk * block;
+    end = start + block;
+    n = (end - off < len) ? end - off : len;
+    if (cow_written(cow, blk) || (n == block)) {
+      if (pwrite(cow->fd, buf, n, cow->hdr.data_off + off) != n)
+        return (false);
+    } else {
+      // first write of part of a block: copy the rest up from the base
+      if (!cow_base(cow, tmp, block, start))
+        return (false);
+      memcpy(tmp + (off - start), buf, n);
+      if (pwrite(cow->fd, tmp, block, cow->hdr.data_off + start) != block)
+        return (false);
+    }
+    fresh |= !cow_written(cow, blk);
+    buf += n;
+    off += n;
+    len -= n;
+  }
+  if (!fresh)
+    return (true);
+
+  // the data is on disk before any bit saying it's there
+  if (fdatasync(cow->fd) < 0)
+    return (false);
+  for (blk = first; blk <= last; blk++)
+    if (!cow_written(cow, blk)) {
+      __atomic_fetch_or(&cow->map[blk >> 3], 1 << (blk & 7), __ATOMIC_RELEASE);
+      if (pwrite(cow->fd, &cow->map[blk >> 3], 1, cow->hdr.map_off + (blk >> 3)) != 1)
+        return (false);
+    }
+  return (true);
+}
+
+static int cow_sync(VDKDRIVE *d) {
+  VDKCOW *cow = d->priv;
+
+  return (fdatasync(cow->fd) == 0);
+}
+
+static void cow_release(VDKCOW *cow) {
+  if (cow->fd >= 0)
+    close(cow->fd);
+  if (cow->base >= 0)
+    close(cow->base);
+  if (cow->lz)
+    am_vdk_lz_close(cow->lz);
+  free(cow->map);
+  free(cow);
+}
+
+static void cow_close(VDKDRIVE *d) {
+  cow_release(d->priv);
+}
+
+static const VDKOPS cow_ops = {cow_read, cow_write, cow_sync, cow_close};
+
+//
+// the header is written a field at a time, little-endian
+//
+static int cow_hdr_write(int fd, const COWHDR *hdr) {
+  uint8_t b[COW_HDRLEN];
+
+  memcpy(b, hdr->magic, 8);
+  vdk_put_le(b + 8, hdr->version, 4);
+  vdk_put_le(b + 12, hdr->block, 4);
+  vdk_put_le(b + 16, hdr->size, 8);
+  vdk_put_le(b + 24, hdr->map_off, 8);
+  vdk_put_le(b + 32, hdr->data_off, 8);
+  return (pwrite(fd, b, COW_HDRLEN, 0) == COW_HDRLEN);
+}
+
+static int cow_hdr_read(int fd, COWHDR *hdr) {
+  uint8_t b[COW_HDRLEN];
+
+  if (pread(fd, b, COW_HDRLEN, 0) != COW_HDRLEN)
+    return (false);
+  memcpy(hdr->magic, b, 8);
+  hdr->version = vdk_get_le(b + 8, 4);
+  hdr->block = vdk_get_le(b + 12, 4);
+  hdr->size = vdk_get_le(b + 16, 8);
+  hdr->map_off = vdk_get_le(b + 24, 8);
+  hdr->data_off = vdk_get_le(b + 32, 8);
+  return (true);
+}
+
+//
+// a new, empty overlay for a base of 'size' bytes
+//
+static int cow_create(VDKCOW *cow, uint64_t size) {
+  uint64_t mapsize;
+
+  memset(&cow->hdr, 0, sizeof(cow->hdr));
+  memcpy(cow->hdr.magic, COW_MAGIC, sizeof(cow->hdr.magic));
+  cow->hdr.version = COW_VERSION;
+  cow->hdr.block = COW_BLOCK;
+  cow->hdr.size = size;
+  cow->hdr.map_off = COW_HDRLEN;
+  mapsize = (size / COW_BLOCK + 8) / 8;
+  cow->hdr.data_off = (cow->hdr.map_off + mapsize + COW_ALIGN - 1) & ~(uint64_t)(COW_ALIGN - 1);
+  if (ftruncate(cow->fd, cow->hdr.data_off + size) < 0)
+    return (false);
+  return (cow_hdr_write(cow->fd, &cow->hdr));
+}
+
+static int cow_open(VDKCOW *cow, const char *base, const char *overlay, int flags) {
+  struct stat st;
+  uint64_t mapsize, size;
+
+  if ((cow->lz = am_vdk_lz_open(base)) != NULL)
+    size = am_vdk_lz_size(cow->lz);
+  else {
+    if ((cow->base = open(base, O_RDONLY)) < 0)
+      return (false);
+    if ((fstat(cow->base, &st) < 0) || (st.st_size == 0))
+      return (false);
+    size = st.st_size;
+  }
+
+  if (flags & VDK_RDONLY)
+    cow->fd = open(overlay, O_RDONLY);
+  else if ((cow->fd = open(overlay, O_RDWR | O_CREAT | O_EXCL, 0644)) >= 0) {
+    if (!cow_create(cow, size)) {
+      unlink(overlay);                    // or every later mount fails
+      return (false);
+    }
+  } else if (errno == EEXIST)
+    cow->fd = open(overlay, O_RDWR);
+  if (cow->fd < 0)
+    return (false);
+
+  if (!cow_hdr_read(cow->fd, &cow->hdr))
+    return (false);
+  if (memcmp(cow->hdr.magic, COW_MAGIC, sizeof(cow->hdr.magic)) || (cow->hdr.version != COW_VERSION) ||
+      (cow->hdr.block != COW_BLOCK) || (cow->hdr.size != size))
+    return (false);                        // not an overlay of this base
+  cow->blocks = (cow->hdr.size + COW_BLOCK - 1) / COW_BLOCK;
+  mapsize = (cow->blocks + 7) / 8;
+  if ((cow->map = calloc(1, mapsize)) == NULL)
+    return (false);
+  return (pread(cow->fd, cow->map, mapsize, cow->hdr.map_off) == (ssize_t)mapsize);
+}
+
+//
+// mount 'base' read-only with writes going to 'overlay', which is
+// created if it doesn't exist
+//
+int am_vdk_mount_cow(wd16_cpu_state_t* wd16_cpu_state, int drive, const char *base, const char *overlay, int flags) {
+  VDKCOW *cow;
+
+  if ((cow = calloc(1, sizeof(VDKCOW))) == NULL)
+    return (false);
+  cow->base = cow->fd = -1;
+  if (cow_open(cow, base, overlay, flags) &&
+      am_vdk_attach(wd16_cpu_state, drive, &cow_ops, cow, cow->hdr.size, flags))
+    return (true);
+  cow_release(cow);
+  return (false);
+}
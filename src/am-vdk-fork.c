@@ -0,0 +1,216 @@
+/* am-vdk-fork.c (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include <sys/mman.h>
+#include "am-vdk.h"
+
+//
+// Disks across fork().  A fork server (wd16-fork.c) clones a booted
+// machine into many children, which all start with the parent's drives
+// and must not write to them: each child's writes go to a private
+// overlay in its own memory, so they vanish with it, and reads of
+// records it hasn't written still come from the image, shared with
+// every other child through the host page cache.
+//
+// the disk threads (io_uring completions, the scheduler, the flusher
+// and read-ahead) don't survive fork().  around the fork the parent
+// empties their queues and holds their locks so the child inherits
+// nothing half done, and the child starts threads of its own.
+//
+
+#define PRIV_BLOCK 512                  /* an AMOS disk record       */
+
+typedef struct _VDKPRIV {               /* A child's private drive   */
+  VDKDRIVE lower;                       /* the drive as inherited    */
+  uint32_t n;                           /* blocks written            */
+  uint32_t slots;                       /* hash slots, a power of 2  */
+  uint64_t *key;                        /* block + 1, 0 if empty     */
+  uint8_t **data;                       /* PRIV_BLOCK bytes each     */
+
+} VDKPRIV;
+
+static int priv_lower(VDKPRIV *p, uint8_t *buf, uint32_t len, uint64_t off) {
+  if (p->lower.map == NULL)
+    return (p->lower.ops->read(&p->lower, buf, len, off));
+  memcpy(buf, p->lower.map + off, len);
+  return (true);
+}
+
+static uint32_t priv_slot(VDKPRIV *p, uint64_t blk) {
+  uint32_t i = (blk * 0x9E3779B97F4A7C15ULL) >> 32;
+
+  for (i &= p->slots - 1; p->key[i] && (p->key[i] != blk + 1); i = (i + 1) & (p->slots - 1))
+    ;
+  return (i);
+}
+
+static int priv_grow(VDKPRIV *p) {
+  VDKPRIV old = *p;
+  uint32_t i, j;
+
+  p->slots = old.slots ? old.slots * 2 : 256;
+  p->key = calloc(p->slots, sizeof(uint64_t));
+  p->data = calloc(p->slots, sizeof(uint8_t *));
+  if (!p->key || !p->data) {
+    free(p->key);
+    free(p->data);
+    *p = old;
+    return (false);
+  }
+  for (i = 0; i < old.slots; i++)
+    if (old.key[i]) {
+      j = priv_slot(p, old.key[i] - 1);
+      p->key[j] = old.key[i];
+      p->data[j] = old.data[i];
+    }
+  free(old.key);
+  free(old.data);
+  return (true);
+}
+
+static int priv_read(VDKDRIVE *d, uint8_t *buf, uint32_t len, uint64_t off) {
+  VDKPRIV *p = d->priv;
+  uint64_t blk, start;
+  uint32_t i, n;
+
+  while (len) {
+    blk = off / PRIV_BLOCK;
+    start = blk * PRIV_BLOCK;
+    n = (start + PRIV_BLOCK - off < len) ? start + PRIV_BLOCK - off : len;
+    i = p->slots ? priv_slot(p, blk) : 0;
+    if (p->slots && p->key[i])
+      memcpy(buf, p->data[i] + (off - start), n);
+    else if (!priv_lower(p, buf, n, off))
+      return (false);
+    buf += n;
+    off += n;
+    len -= n;
+  }
+  return (true);
+}
+
+static int priv_write(VDKDRIVE *d, const uint8_t *buf, uint32_t len, uint64_t off) {
+  VDKPRIV *p = d->priv;
+  uint64_t blk, start;
+  uint32_t i, n;
+
+  while (len) {
+    blk = off / PRIV_BLOCK;
+    start = blk * PRIV_BLOCK;
+    n = (start + PRIV_BLOCK - off < len) ? start + PRIV_BLOCK - off : len;
+    if ((p->n + 1 > p->slots / 2) && !priv_grow(p))
+      return (false);
+    i = priv_slot(p, blk);
+    if (p->key[i] == 0) {
+      if ((p->data[i] = malloc(PRIV_BLOCK)) == NULL)
+        return (false);
+      // first write of part of a block: the rest comes from below
+      if ((n < PRIV_BLOCK) && !priv_lower(p, p->data[i], PRIV_BLOCK, start)) {
+        free(p->data[i]);
+        return (false);
+      }
+      p->key[i] = blk + 1;
+      p->n++;
+    }
+    memcpy(p->data[i] + (off - start), buf, n);
+    buf += n;
+    off += n;
+    len -= n;
+  }
+  return (true);
+}
+
+static int priv_sync(VDKDRIVE *d) {
+  return (true);                          // nothing outlives the child
+}
+
+static void priv_close(VDKDRIVE *d) {
+  VDKPRIV *p = d->priv;
+  uint32_t i;
+
+  for (i = 0; i < p->slots; i++)
+    free(p->data[i]);
+  free(p->key);
+  free(p->data);
+  if (p->lower.map)
+    munmap(p->lower.map, p->lower.size);
+  p->lower.ops->close(&p->lower);
+  free(p);
+}
+
+static const VDKOPS priv_ops = {priv_read, priv_write, priv_sync, priv_close};
+
+//
+// put a private overlay over a writable drive.  it loses its mapping
+// and file, so requests go through the overlay (and the block cache),
+// and DF$ASY ones are done synchronously.
+//
+static void vdk_private(VDKDRIVE *d) {
+  VDKPRIV *p;
+
+  if ((p = calloc(1, sizeof(VDKPRIV))) == NULL) {
+    d->readonly = true;                   // better than writing through
+    return;
+  }
+  p->lower = *d;
+  d->ops = &priv_ops;
+  d->priv = p;
+  d->map = NULL;
+  d->fd = -1;
+}
+
+//
+// the host calls this around fork() with 'phase' VDK_FORK_PREPARE just
+// before, then VDK_FORK_PARENT in the parent or VDK_FORK_CHILD in the
+// child just after, all on the thread that forks and with the CPU
+// stopped.
+//
+void am_vdk_atfork(wd16_cpu_state_t* wd16_cpu_state, int phase) {
+  AMVDK *vdk = wd16_cpu_state->vdk;
+  int i;
+
+  if (vdk == NULL)
+    return;
+  if (phase == VDK_FORK_PREPARE) {
+    am_vdk_flush(wd16_cpu_state);
+    for (i = 0; i < VDK_DRIVES; i++)
+      am_vdk_aio_drain(wd16_cpu_state, i);
+    am_vdk_sched_atfork(wd16_cpu_state, phase);
+    am_vdk_cache_atfork(wd16_cpu_state, phase);
+    am_vdk_wb_atfork(wd16_cpu_state, phase);
+    return;
+  }
+  // no other thread runs in the child yet, so the drives can be swapped
+  // before the disk threads start again
+  if (phase == VDK_FORK_CHILD)
+    for (i = 0; i < VDK_DRIVES; i++)
+      if (vdk->drive[i].mounted && !vdk->drive[i].readonly)
+        vdk_private(&vdk->drive[i]);
+  am_vdk_wb_atfork(wd16_cpu_state, phase);
+  am_vdk_cache_atfork(wd16_cpu_state, phase);
+  am_vdk_aio_atfork(wd16_cpu_state, phase);
+  am_vdk_sched_atfork(wd16_cpu_state, phase);
+}
@@ -0,0 +1,452 @@
+/* am-vdk-lz.c   (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "am-vdk.h"
+
+//
+// Compressed disk images.  An archived or template AMOS disk is mostly
+// empty directory blocks and runs of the same bytes, so it is stored
+// as fixed size blocks, each compressed on its own so any record can
+// be read without the ones before it:
+//
+//    header       LZHDR, below, little-endian
+//    data         the blocks, one after the other
+//    index        blocks + 1 file offsets, 8 bytes little-endian each;
+//                 block n is the bytes from index[n] up to index[n + 1]
+//
+// a block of zeros takes no data at all, and a block the compressor
+// can't shrink is stored as it is (its length is then the block size).
+// the compressor is a small LZ77 in the LZ4 mould, quick enough to
+// decompress that a cold boot from a slow disk or a network share is
+// faster than reading the raw image.
+//
+// am_vdk_mount() mounts these read-only; mount one under a
+// copy-on-write overlay (see am-vdk-cow.c) to write to it.  nothing
+// here needs the CPU, so am-vdk-pack links just this file.  the last
+// few blocks decompressed are kept, as a record is much smaller than a
+// block and AMOS reads the records of a block one after the other.
+//
+
+#define LZ_MAGIC   "AMVDK-LZ"
+#define LZ_VERSION 1
+#define LZ_HDRLEN  32                   /* LZHDR on disk             */
+#define LZ_SLOTS   32                   /* blocks kept decompressed  */
+#define LZ_MIN     4                    /* shortest match            */
+#define LZ_HBITS   12                   /* compressor hash table     */
+
+typedef struct _LZHDR {                 /* Image file header         */
+  char magic[8];                        /* LZ_MAGIC                  */
+  uint32_t version;                     /* LZ_VERSION                */
+  uint32_t block;                       /* bytes per block           */
+  uint64_t size;                        /* bytes in the raw image    */
+  uint64_t index_off;                   /* block index offset        */
+
+} LZHDR;
+
+typedef struct _LZSLOT {                /* One decompressed block    */
+  uint64_t blk;                         /* block number, ~0=free     */
+  int ref;                              /* used since hand passed    */
+  uint8_t *data;
+
+} LZSLOT;
+
+typedef struct _VDKLZ {                 /* Compressed image          */
+  int fd;                               /* image file                */
+  LZHDR hdr;
+  uint64_t blocks;                      /* blocks in the image       */
+  uint64_t *index;                      /* blocks + 1 offsets        */
+  pthread_mutex_t lock;                 /* CPU and read-ahead thread */
+  uint32_t hand;                        /* CLOCK hand                */
+  LZSLOT slot[LZ_SLOTS];
+  uint8_t *data;                        /* storage for the slots     */
+  uint8_t *cbuf;                        /* a block as stored         */
+
+} VDKLZ;
+
+//
+// the codec.  a compressed block is a run of sequences, each a token
+// byte (literal count in the top four bits, match length - LZ_MIN in
+// the bottom four, 15 meaning more length bytes follow, each adding
+// up to 255), the literals, then a two byte offset back to the match.
+// the last sequence is literals only.
+//
+
+static uint32_t lz_hash(const uint8_t *p) {
+  uint32_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return ((v * 2654435761U) >> (32 - LZ_HBITS));
+}
+
+static int lz_putlen(uint8_t *dst, int cap, int *op, int n) {
+  for (; n >= 255; n -= 255) {
+    if (*op >= cap)
+      return (false);
+    dst[(*op)++] = 255;
+  }
+  if (*op >= cap)
+    return (false);
+  dst[(*op)++] = n;
+  return (true);
+}
+
+static int lz_getlen(const uint8_t *src, int len, int *ip) {
+  int n = 0, b;
+
+  do {
+    if (*ip >= len)
+      return (-1);
+    n += (b = src[(*ip)++]);
+  } while (b == 255);
+  return (n);
+}
+
+static int lz_emit(uint8_t *dst, int cap, int *op, const uint8_t *lit, int llen, int off, int mlen) {
+  int m = mlen ? mlen - LZ_MIN : 0;
+
+  if (*op >= cap)
+    return (false);
+  dst[(*op)++] = ((llen < 15 ? llen : 15) << 4) | (m < 15 ? m : 15);
+  if ((llen >= 15) && !lz_putlen(dst, cap, op, llen - 15))
+    return (false);
+  if (*op + llen > cap)
+    return (false);
+  memcpy(dst + *op, lit, llen);
+  *op += llen;
+  if (mlen == 0)
+    return (true);
+  if (*op + 2 > cap)
+    return (false);
+  dst[(*op)++] = off & 0xff;
+  dst[(*op)++] = off >> 8;
+  return ((m < 15) || lz_putlen(dst, cap, op, m - 15));
+}
+
+//
+// compress 'len' bytes into 'dst', returning the compressed length, or
+// 0 if it wouldn't be smaller than 'cap'
+//
+int am_vdk_lz_pack(const uint8_t *src, int len, uint8_t *dst, int cap) {
+  int table[1 << LZ_HBITS];
+  int ip = 0, anchor = 0, op = 0, ref, mlen, i;
+  uint32_t h;
+
+  for (i = 0; i < (1 << LZ_HBITS); i++)
+    table[i] = -1;
+  while (ip + LZ_MIN <= len) {
+    h = lz_hash(src + ip);
+    ref = table[h];
+    table[h] = ip;
+    if ((ref < 0) || (ip - ref > 65535) || memcmp(src + ref, src + ip, LZ_MIN)) {
+      ip++;
+      continue;
+    }
+    for (mlen = LZ_MIN; (ip + mlen < len) && (src[ref + mlen] == src[ip + mlen]); mlen++)
+      ;
+    if (!lz_emit(dst, cap, &op, src + anchor, ip - anchor, ip - ref, mlen))
+      return (0);
+    ip += mlen;
+    anchor = ip;
+  }
+  if (!lz_emit(dst, cap, &op, src + anchor, len - anchor, 0, 0))
+    return (0);
+  return ((op < cap) ? op : 0);
+}
+
+//
+// decompress into 'dst', returning the length, or -1 if 'src' is bad
+//
+int am_vdk_lz_unpack(const uint8_t *src, int len, uint8_t *dst, int cap) {
+  int ip = 0, op = 0, t, n, off;
+
+  while (ip < len) {
+    t = src[ip++];
+    if ((n = t >> 4) == 15) {
+      if ((off = lz_getlen(src, len, &ip)) < 0)
+        return (-1);
+      n += off;
+    }
+    if ((ip + n > len) || (op + n > cap))
+      return (-1);
+    memcpy(dst + op, src + ip, n);
+    ip += n;
+    op += n;
+    if (ip == len)
+      break;                              // the last sequence
+    if (ip + 2 > len)
+      return (-1);
+    off = src[ip] | (src[ip + 1] << 8);
+    ip += 2;
+    if ((n = t & 15) == 15) {
+      if ((t = lz_getlen(src, len, &ip)) < 0)
+        return (-1);
+      n += t;
+    }
+    n += LZ_MIN;
+    if ((off == 0) || (off > op) || (op + n > cap))
+      return (-1);
+    for (; n; n--, op++)                   // may overlap itself
+      dst[op] = dst[op - off];
+  }
+  return (op);
+}
+
+//
+// the image
+//
+
+static int lz_zero(const uint8_t *p, uint32_t len) {
+  uint32_t i;
+
+  for (i = 0; i < len; i++)
+    if (p[i])
+      return (false);
+  return (true);
+}
+
+//
+// block 'blk' decompressed, NULL on an I/O error or a bad block.  call
+// it with the lock held.
+//
+static uint8_t *lz_block(VDKLZ *lz, uint64_t blk) {
+  uint32_t block = lz->hdr.block, clen;
+  LZSLOT *s;
+  int i;
+
+  for (i = 0; i < LZ_SLOTS; i++)
+    if (lz->slot[i].blk == blk) {
+      lz->slot[i].ref = 1;
+      return (lz->slot[i].data);
+    }
+  for (;;) {
+    s = &lz->slot[lz->hand];
+    lz->hand = (lz->hand + 1) % LZ_SLOTS;
+    if (!s->ref)
+      break;
+    s->ref = 0;
+  }
+  s->blk = ~0ULL;
+  clen = lz->index[blk + 1] - lz->index[blk];
+  if (clen == block) {
+    if (pread(lz->fd, s->data, block, lz->index[blk]) != block)
+      return (NULL);
+  } else if ((pread(lz->fd, lz->cbuf, clen, lz->index[blk]) != clen) ||
+             (am_vdk_lz_unpack(lz->cbuf, clen, s->data, block) != (int)block))
+    return (NULL);
+  s->blk = blk;
+  s->ref = 1;
+  return (s->data);
+}
+
+int am_vdk_lz_read(VDKLZ *lz, uint8_t *buf, uint32_t len, uint64_t off) {
+  uint32_t block = lz->hdr.block, n;
+  uint64_t blk;
+  uint8_t *p;
+
+  if (off + len > lz->hdr.size)
+    return (false);
+  while (len) {
+    blk = off / block;
+    n = block - off % block;
+    if (n > len)
+      n = len;
+    if (lz->index[blk + 1] == lz->index[blk])
+      memset(buf, 0, n);                  // not stored
+    else {
+      pthread_mutex_lock(&lz->lock);
+      if ((p = lz_block(lz, blk)) != NULL)
+        memcpy(buf, p + off % block, n);
+      pthread_mutex_unlock(&lz->lock);
+      if (p == NULL)
+        return (false);
+    }
+    buf += n;
+    off += n;
+    len -= n;
+  }
+  return (true);
+}
+
+uint64_t am_vdk_lz_size(VDKLZ *lz) {
+  return (lz->hdr.size);
+}
+
+void am_vdk_lz_close(VDKLZ *lz) {
+  if (lz->fd >= 0)
+    close(lz->fd);
+  pthread_mutex_destroy(&lz->lock);
+  free(lz->index);
+  free(lz->data);
+  free(lz->cbuf);
+  free(lz);
+}
+
+//
+// the header is written a field at a time, little-endian
+//
+static int lz_hdr_write(int fd, const LZHDR *hdr) {
+  uint8_t b[LZ_HDRLEN];
+
+  memcpy(b, hdr->magic, 8);
+  vdk_put_le(b + 8, hdr->version, 4);
+  vdk_put_le(b + 12, hdr->block, 4);
+  vdk_put_le(b + 16, hdr->size, 8);
+  vdk_put_le(b + 24, hdr->index_off, 8);
+  return (pwrite(fd, b, LZ_HDRLEN, 0) == LZ_HDRLEN);
+}
+
+static int lz_hdr_read(int fd, LZHDR *hdr) {
+  uint8_t b[LZ_HDRLEN];
+
+  if (pread(fd, b, LZ_HDRLEN, 0) != LZ_HDRLEN)
+    return (false);
+  memcpy(hdr->magic, b, 8);
+  hdr->version = vdk_get_le(b + 8, 4);
+  hdr->block = vdk_get_le(b + 12, 4);
+  hdr->size = vdk_get_le(b + 16, 8);
+  hdr->index_off = vdk_get_le(b + 24, 8);
+  return (true);
+}
+
+static int lz_load(VDKLZ *lz, const char *path) {
+  struct stat st;
+  uint64_t i, isize;
+
+  if ((lz->fd = open(path, O_RDONLY)) < 0)
+    return (false);
+  if ((fstat(lz->fd, &st) < 0) || !lz_hdr_read(lz->fd, &lz->hdr))
+    return (false);
+  if (memcmp(lz->hdr.magic, LZ_MAGIC, sizeof(lz->hdr.magic)) || (lz->hdr.version != LZ_VERSION) ||
+      (lz->hdr.block < 512) || (lz->hdr.block > 65536) || (lz->hdr.block % 512) || (lz->hdr.size == 0))
+    return (false);
+  lz->blocks = (lz->hdr.size + lz->hdr.block - 1) / lz->hdr.block;
+  isize = (lz->blocks + 1) * sizeof(uint64_t);
+  if (lz->hdr.index_off + isize > (uint64_t)st.st_size)
+    return (false);
+  lz->index = malloc(isize);
+  lz->data = malloc((size_t)LZ_SLOTS * lz->hdr.block);
+  lz->cbuf = malloc(lz->hdr.block);
+  if (!lz->index || !lz->data || !lz->cbuf)
+    return (false);
+  if (pread(lz->fd, lz->index, isize, lz->hdr.index_off) != (ssize_t)isize)
+    return (false);
+  for (i = 0; i <= lz->blocks; i++)
+    lz->index[i] = vdk_get_le((uint8_t *)&lz->index[i], 8);
+  // a block is never longer than stored as it is
+  if (lz->index[0] < LZ_HDRLEN)
+    return (false);
+  for (i = 0; i < lz->blocks; i++)
+    if ((lz->index[i + 1] < lz->index[i]) || (lz->index[i + 1] - lz->index[i] > lz->hdr.block) ||
+        (lz->index[i + 1] > lz->hdr.index_off))
+      return (false);
+  for (i = 0; i < LZ_SLOTS; i++) {
+    lz->slot[i].blk = ~0ULL;
+    lz->slot[i].data = lz->data + i * lz->hdr.block;
+  }
+  return (true);
+}
+
+//
+// open a compressed image, NULL if 'path' isn't one
+//
+VDKLZ *am_vdk_lz_open(const char *path) {
+  VDKLZ *lz;
+
+  if ((lz = calloc(1, sizeof(VDKLZ))) == NULL)
+    return (NULL);
+  pthread_mutex_init(&lz->lock, NULL);
+  if (lz_load(lz, path))
+    return (lz);
+  am_vdk_lz_close(lz);
+  return (NULL);
+}
+
+//
+// compress the raw image 'raw' into 'path' in blocks of 'block' bytes
+//
+int am_vdk_lz_create(const char *raw, const char *path, uint32_t block) {
+  LZHDR hdr;
+  uint8_t *in, *out;
+  uint64_t *index, blocks, i, off;
+  struct stat st;
+  int fd, rfd, clen, ok = false;
+  ssize_t n;
+
+  if ((block < 512) || (block > 65536) || (block % 512))
+    return (false);
+  if ((rfd = open(raw, O_RDONLY)) < 0)
+    return (false);
+  if ((fstat(rfd, &st) < 0) || (st.st_size == 0) ||
+      ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)) {
+    close(rfd);
+    return (false);
+  }
+  blocks = (st.st_size + block - 1) / block;
+  in = malloc(block);
+  out = malloc(block);
+  index = malloc((blocks + 1) * sizeof(uint64_t));
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, LZ_MAGIC, sizeof(hdr.magic));
+  hdr.version = LZ_VERSION;
+  hdr.block = block;
+  hdr.size = st.st_size;
+  off = LZ_HDRLEN;
+  for (i = 0; in && out && index && (i < blocks); i++) {
+    memset(in, 0, block);                 // the last block is padded
+    if ((n = pread(rfd, in, block, i * block)) <= 0)
+      break;
+    index[i] = off;
+    if (lz_zero(in, block))
+      continue;
+    if ((clen = am_vdk_lz_pack(in, block, out, block)) == 0) {
+      if (pwrite(fd, in, block, off) != block)
+        break;
+      off += block;
+    } else {
+      if (pwrite(fd, out, clen, off) != clen)
+        break;
+      off += clen;
+    }
+  }
+  if (index && (i == blocks)) {
+    index[blocks] = off;
+    hdr.index_off = off;
+    for (i = 0; i <= blocks; i++)
+      vdk_put_le((uint8_t *)&index[i], index[i], 8);
+    n = (blocks + 1) * sizeof(uint64_t);
+    ok = (pwrite(fd, index, n, off) == n) && lz_hdr_write(fd, &hdr);
+  }
+  free(in);
+  free(out);
+  free(index);
+  close(rfd);
+  if (close(fd) < 0)
+    ok = false;
+  return (ok);
+}
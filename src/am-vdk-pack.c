@@ -0,0 +1,103 @@
+/* am-vdk-pack.c (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+//
+// am-vdk-pack: convert a raw AMOS disk image to the compressed format
+// of am-vdk-lz.c and back.
+//
+//    am-vdk-pack [-b block] raw.img packed.img
+//    am-vdk-pack -x packed.img raw.img
+//
+// built with 'make am-vdk-pack'; it isn't part of the library.
+//
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "am-vdk.h"
+
+static int usage(void) {
+  fprintf(stderr, "usage: am-vdk-pack [-b block] raw.img packed.img\n"
+                  "       am-vdk-pack -x packed.img raw.img\n");
+  return (2);
+}
+
+static int unpack(const char *path, const char *raw) {
+  struct _VDKLZ *lz;
+  uint64_t off, size;
+  uint8_t buf[65536];
+  uint32_t n;
+  int fd, ok = true;
+
+  if ((lz = am_vdk_lz_open(path)) == NULL) {
+    fprintf(stderr, "am-vdk-pack: %s isn't a compressed image\n", path);
+    return (1);
+  }
+  if ((fd = open(raw, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    perror(raw);
+    am_vdk_lz_close(lz);
+    return (1);
+  }
+  size = am_vdk_lz_size(lz);
+  for (off = 0; ok && (off < size); off += n) {
+    n = (size - off < sizeof(buf)) ? size - off : sizeof(buf);
+    ok = am_vdk_lz_read(lz, buf, n, off) && (pwrite(fd, buf, n, off) == n);
+  }
+  am_vdk_lz_close(lz);
+  if ((close(fd) < 0) || !ok) {
+    fprintf(stderr, "am-vdk-pack: can't expand %s\n", path);
+    return (1);
+  }
+  return (0);
+}
+
+int main(int argc, char *argv[]) {
+  struct stat in, out;
+  uint32_t block = 4096;
+  int c;
+
+  while ((c = getopt(argc, argv, "b:x")) != -1)
+    switch (c) {
+    case 'b':
+      block = atoi(optarg);
+      break;
+    case 'x':
+      if (argc - optind != 2)
+        return (usage());
+      return (unpack(argv[optind], argv[optind + 1]));
+    default:
+      return (usage());
+    }
+  if (argc - optind != 2)
+    return (usage());
+
+  if (!am_vdk_lz_create(argv[optind], argv[optind + 1], block)) {
+    fprintf(stderr, "am-vdk-pack: can't compress %s (block must be a multiple of 512 up to 65536)\n", argv[optind]);
+    return (1);
+  }
+  if ((stat(argv[optind], &in) == 0) && (stat(argv[optind + 1], &out) == 0))
+    printf("%s: %lld -> %lld bytes\n", argv[optind + 1], (long long)in.st_size, (long long)out.st_size);
+  return (0);
+}
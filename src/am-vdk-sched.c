@@ -0,0 +1,406 @@
+/* am-vdk-sched.c (c) Copyright Mike Sharkey, 2021                   */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include "am-vdk.h"
+#include "am-ddb.h"
+#include "cpu-mem.h"
+#include "cpu-dirty.h"
+
+//
+// Request scheduler for asynchronous virtual disk transfers.  without
+// it a DF$ASY request goes to io_uring as soon as AMOS makes it, so
+// several jobs reading different files send the image's disk back and
+// forth across the platter (or a network image back and forth across
+// its server's cache) in whatever order the jobs happen to run.
+//
+// with am_vdk_sched() on, requests are queued instead and a dispatcher
+// thread keeps only 'depth' of them in flight.  each time a transfer
+// finishes it picks the next one:
+//
+//  - the oldest request that has waited 'expire_ms' or more, so no
+//    request starves (0 turns the deadline off)
+//  - otherwise the request of the highest DB$PRI whose record comes
+//    next after the last one started on its drive, wrapping round to
+//    the lowest record (C-SCAN), so a drive is swept in one direction
+//
+// a request never overtakes an earlier one for the same record if
+// either of them is a write.  with 'chain' set, the DDBs linked from
+// the one passed to SVCC 0 by DB$QCL are queued in the same call, so
+// the whole of AMOS's device queue is there to be sorted.  AMOS still
+// passes each of those to SVCC 0 when it gets to it, so their addresses
+// are kept until then and that SVCC 0 does nothing.
+//
+
+#define VDK_SCHED_QUEUE 128             /* DDBs queued or in flight  */
+
+#define SREQ_FREE    0
+#define SREQ_PENDING 1
+#define SREQ_ACTIVE  2
+
+typedef struct _VDKSREQ {               /* One queued DDB            */
+  int state;                            /* SREQ_ above               */
+  int drive;                            /* DB$DRI                    */
+  uint16_t ddb;                         /* guest address of the DDB  */
+  uint8_t *ddbp;                        /* ... and host address      */
+  uint16_t bad;                         /* DB$BAD                    */
+  uint16_t rsz;                         /* DB$RSZ                    */
+  uint16_t rnm;                         /* DB$RNM                    */
+  uint16_t pri;                         /* DB$PRI                    */
+  int write;                            /* DF$WRT                    */
+  uint64_t seq;                         /* arrival order             */
+  uint64_t when;                        /* arrival time              */
+
+} VDKSREQ;
+
+typedef struct _VDKSCHED {              /* Scheduler state           */
+  pthread_mutex_t lock;                 /* CPU, dispatcher and aio   */
+  pthread_cond_t cond;                  /* a request or a slot       */
+  pthread_t thread;                     /* dispatcher thread         */
+  wd16_cpu_state_t *cpu;                /* for the dispatcher        */
+  uint32_t depth;                       /* transfers in flight       */
+  uint64_t expire_ns;                   /* deadline, 0=none          */
+  int chain;                            /* follow DB$QCL             */
+  int stop;                             /* dispatcher to exit        */
+  uint32_t pending;                     /* requests waiting          */
+  uint32_t active;                      /* ... and started           */
+  uint64_t seq;                         /* next arrival number       */
+  uint32_t head[VDK_DRIVES];            /* last record started       */
+  uint16_t ahead[VDK_SCHED_QUEUE];      /* chained, SVCC 0 to come   */
+  VDKSSTAT stat;
+  VDKSREQ req[VDK_SCHED_QUEUE];
+
+} VDKSCHED;
+
+//
+// true if an earlier request for the same record has to go first
+//
+static int sched_blocked(VDKSCHED *s, VDKSREQ *r) {
+  VDKSREQ *e;
+  int i;
+
+  for (i = 0; i < VDK_SCHED_QUEUE; i++) {
+    e = &s->req[i];
+    if ((e->state != SREQ_FREE) && (e->seq < r->seq) && (e->drive == r->drive) &&
+        (e->rnm == r->rnm) && (e->write || r->write))
+      return (true);
+  }
+  return (false);
+}
+
+//
+// the request to start next, -1 if none can be
+//
+static int sched_pick(VDKSCHED *s) {
+  uint64_t now = s->expire_ns ? am_vdk_now() : 0;
+  uint32_t dist, best_dist = 0;
+  int i, best = -1, late = -1;
+  VDKSREQ *r;
+
+  for (i = 0; i < VDK_SCHED_QUEUE; i++) {
+    r = &s->req[i];
+    if ((r->state != SREQ_PENDING) || sched_blocked(s, r))
+      continue;
+    if (s->expire_ns && (now - r->when >= s->expire_ns)) {
+      if ((late < 0) || (r->seq < s->req[late].seq))
+        late = i;
+      continue;
+    }
+    // records to sweep past to get to it, going up and wrapping round
+    dist = (r->rnm >= s->head[r->drive]) ? r->rnm - s->head[r->drive] : r->rnm + 0x10000 - s->head[r->drive];
+    if ((best < 0) || (r->pri > s->req[best].pri) ||
+        ((r->pri == s->req[best].pri) && (dist < best_dist))) {
+      best = i;
+      best_dist = dist;
+    }
+  }
+  if (late >= 0)
+    s->stat.expired++;
+  return ((late >= 0) ? late : best);
+}
+
+//
+// do a transfer the ring wouldn't take on this thread instead
+//
+static void sched_sync(wd16_cpu_state_t* wd16_cpu_state, VDKSREQ *r) {
+  VDKDRIVE *d = &wd16_cpu_state->vdk->drive[r->drive];
+  uint8_t *buf = cpu_mem_host(wd16_cpu_state, r->bad, r->rsz);
+  uint64_t off = (uint64_t)r->rnm * r->rsz;
+  int ok;
+
+  if (r->write) {
+    ok = d->ops->write(d, buf, r->rsz, off);
+    am_vdk_cache_forget(wd16_cpu_state, r->drive, r->rnm);
+  } else {
+    ok = d->ops->read(d, buf, r->rsz, off);
+    cpu_dirty_mark(wd16_cpu_state, r->bad, r->rsz);
+  }
+  am_vdk_aio_done(wd16_cpu_state, r->drive, r->ddbp, ok ? DE$OK : DE$IO, r->write, r->rsz, r->when);
+}
+
+static void *sched_thread(void *arg) {
+  VDKSCHED *s = arg;
+  wd16_cpu_state_t* wd16_cpu_state = s->cpu;
+  VDKSREQ *r, req;
+  uint32_t dist;
+  int i;
+
+  pthread_mutex_lock(&s->lock);
+  while (!s->stop) {
+    if ((s->active >= s->depth) || ((i = sched_pick(s)) < 0)) {
+      pthread_cond_wait(&s->cond, &s->lock);
+      continue;
+    }
+    r = &s->req[i];
+    r->state = SREQ_ACTIVE;
+    s->pending--;
+    s->active++;
+    dist = (r->rnm > s->head[r->drive]) ? r->rnm - s->head[r->drive] : s->head[r->drive] - r->rnm;
+    s->stat.distance += dist;
+    s->stat.dispatched++;
+    s->head[r->drive] = r->rnm;
+    req = *r;                             // the slot is freed on completion
+    pthread_mutex_unlock(&s->lock);
+
+    // the queue's count of the transfer passes to the ring's
+    if (am_vdk_aio_submit(wd16_cpu_state, req.drive, req.ddb, req.bad, req.rsz, (uint64_t)req.rnm * req.rsz, req.write, req.when))
+      __atomic_fetch_sub(&wd16_cpu_state->vdk->drive[req.drive].inflight, 1, __ATOMIC_RELEASE);
+    else {
+      am_vdk_sched_done(wd16_cpu_state, req.ddbp);
+      sched_sync(wd16_cpu_state, &req);
+    }
+    pthread_mutex_lock(&s->lock);
+  }
+  pthread_mutex_unlock(&s->lock);
+  return (NULL);
+}
+
+//
+// queue DF$ASY requests, keeping at most 'depth' transfers in flight
+// (0 to go back to sending them straight to io_uring); see above for
+// 'expire_ms' and 'chain'.  needs am_vdk_async() on.  call it with the
+// CPU stopped or idle.
+//
+int am_vdk_sched(wd16_cpu_state_t* wd16_cpu_state, uint32_t depth, uint32_t expire_ms, int chain) {
+  VDKSCHED *s;
+  int i;
+
+  if ((wd16_cpu_state->vdk == NULL) || (wd16_cpu_state->vdk->aio == NULL))
+    return (depth == 0);
+  if (depth > 64)
+    depth = 64;                           // VDK_AIO_DEPTH
+
+  if ((s = wd16_cpu_state->vdk->sched) != NULL) {
+    pthread_mutex_lock(&s->lock);
+    if (depth) {
+      s->depth = depth;
+      s->expire_ns = expire_ms * 1000000ULL;
+      s->chain = chain;
+      pthread_cond_broadcast(&s->cond);
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (depth)
+      return (true);
+    for (i = 0; i < VDK_DRIVES; i++)      // let the queue empty
+      am_vdk_aio_drain(wd16_cpu_state, i);
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+    wd16_cpu_state->vdk->sched = NULL;
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    free(s);
+    return (true);
+  }
+  if (depth == 0)
+    return (true);
+
+  if ((s = calloc(1, sizeof(VDKSCHED))) == NULL)
+    return (false);
+  for (i = 0; i < VDK_DRIVES; i++)        // nothing in flight unqueued
+    am_vdk_aio_drain(wd16_cpu_state, i);
+  s->cpu = wd16_cpu_state;
+  s->depth = depth;
+  s->expire_ns = expire_ms * 1000000ULL;
+  s->chain = chain;
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->cond, NULL);
+  if (pthread_create(&s->thread, NULL, sched_thread, s) != 0) {
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    free(s);
+    return (false);
+  }
+  wd16_cpu_state->vdk->sched = s;
+  return (true);
+}
+
+//
+// true if the DDBs linked by DB$QCL should be queued too
+//
+int am_vdk_sched_chain(wd16_cpu_state_t* wd16_cpu_state) {
+  return (wd16_cpu_state->vdk->sched && wd16_cpu_state->vdk->sched->chain);
+}
+
+//
+// the slot in s->ahead holding 'ddb' (0 for a free one), -1 if none
+//
+static int sched_ahead(VDKSCHED *s, uint16_t ddb) {
+  int i;
+
+  for (i = 0; i < VDK_SCHED_QUEUE; i++)
+    if (s->ahead[i] == ddb)
+      return (i);
+  return (-1);
+}
+
+//
+// true if the DDB at 'ddb' was queued from a chain before AMOS passed
+// it to SVCC 0 itself, as it now has; it is in flight or done already
+//
+int am_vdk_sched_ahead(wd16_cpu_state_t* wd16_cpu_state, uint16_t ddb) {
+  VDKSCHED *s = wd16_cpu_state->vdk->sched;
+  int i;
+
+  if ((s == NULL) || (ddb == 0))
+    return (false);
+  pthread_mutex_lock(&s->lock);
+  if ((i = sched_ahead(s, ddb)) >= 0)
+    s->ahead[i] = 0;
+  pthread_mutex_unlock(&s->lock);
+  return (i >= 0);
+}
+
+void am_vdk_sched_stats(wd16_cpu_state_t* wd16_cpu_state, VDKSSTAT *stat) {
+  VDKSCHED *s;
+
+  memset(stat, 0, sizeof(*stat));
+  if ((wd16_cpu_state->vdk == NULL) || ((s = wd16_cpu_state->vdk->sched) == NULL))
+    return;
+  pthread_mutex_lock(&s->lock);
+  *stat = s->stat;
+  pthread_mutex_unlock(&s->lock);
+}
+
+//
+// queue a transfer the caller has already checked against the drive.
+// returns true if it is queued (DF$BSY is set), false if it has to be
+// done synchronously instead: no scheduler, a full queue, or a DDB
+// that can't complete off the CPU thread.
+//
+int am_vdk_sched_queue(wd16_cpu_state_t* wd16_cpu_state, int drive, uint16_t ddb, uint16_t bad, uint16_t rsz, uint16_t rnm, int write, int chained) {
+  VDKSCHED *s = wd16_cpu_state->vdk->sched;
+  VDKSREQ *r;
+  uint16_t pri;
+  int i, a = -1;
+
+  if ((s == NULL) || !am_vdk_aio_able(wd16_cpu_state, drive, ddb, bad, rsz))
+    return (false);
+  wd16_cpu_state->getAMword((unsigned char *)&pri, ddb + DB$PRI);
+
+  pthread_mutex_lock(&s->lock);
+  for (i = 0; i < VDK_SCHED_QUEUE; i++)
+    if (s->req[i].state == SREQ_FREE)
+      break;
+  // a chained DDB is queued once, and only while there's room to
+  // remember it
+  if ((i == VDK_SCHED_QUEUE) || (chained && ((sched_ahead(s, ddb) >= 0) || ((a = sched_ahead(s, 0)) < 0)))) {
+    pthread_mutex_unlock(&s->lock);
+    return (false);
+  }
+  if (chained)
+    s->ahead[a] = ddb;
+  r = &s->req[i];
+  r->drive = drive;
+  r->ddb = ddb;
+  r->ddbp = cpu_mem_host(wd16_cpu_state, ddb, SIZ$DB);
+  r->bad = bad;
+  r->rsz = rsz;
+  r->rnm = rnm;
+  r->pri = pri;
+  r->write = write;
+  r->seq = s->seq++;
+  r->when = am_vdk_now();
+  r->state = SREQ_PENDING;
+  __atomic_fetch_or(&r->ddbp[DB$FLG], (uint8_t)DF$BSY, __ATOMIC_RELAXED);
+  cpu_dirty_mark(wd16_cpu_state, ddb, SIZ$DB);
+  __atomic_fetch_add(&wd16_cpu_state->vdk->drive[drive].inflight, 1, __ATOMIC_RELAXED);
+  s->pending++;
+  s->stat.queued++;
+  if (chained)
+    s->stat.chained++;
+  if (s->pending > s->stat.maxq)
+    s->stat.maxq = s->pending;
+  pthread_cond_signal(&s->cond);
+  pthread_mutex_unlock(&s->lock);
+  return (true);
+}
+
+//
+// the transfer for a DDB has finished (io_uring's completion thread):
+// free its slot for the dispatcher
+//
+void am_vdk_sched_done(wd16_cpu_state_t* wd16_cpu_state, uint8_t *ddb) {
+  VDKSCHED *s = wd16_cpu_state->vdk->sched;
+  int i;
+
+  if (s == NULL)
+    return;
+  pthread_mutex_lock(&s->lock);
+  for (i = 0; i < VDK_SCHED_QUEUE; i++)
+    if ((s->req[i].state == SREQ_ACTIVE) && (s->req[i].ddbp == ddb)) {
+      s->req[i].state = SREQ_FREE;
+      s->active--;
+      pthread_cond_signal(&s->cond);
+      break;
+    }
+  pthread_mutex_unlock(&s->lock);
+}
+
+//
+// see am_vdk_atfork(), which has let the queue empty first.  a child
+// that couldn't get a ring of its own (am_vdk_aio_atfork()) has nothing
+// to dispatch to, so goes without.
+//
+void am_vdk_sched_atfork(wd16_cpu_state_t* wd16_cpu_state, int phase) {
+  VDKSCHED *s = wd16_cpu_state->vdk->sched;
+
+  if (s == NULL)
+    return;
+  if (phase == VDK_FORK_PREPARE) {
+    pthread_mutex_lock(&s->lock);
+    return;
+  }
+  if (phase == VDK_FORK_CHILD)
+    s->active = 0;
+  pthread_mutex_unlock(&s->lock);
+  if ((phase == VDK_FORK_CHILD) &&
+      ((wd16_cpu_state->vdk->aio == NULL) || (pthread_create(&s->thread, NULL, sched_thread, s) != 0))) {
+    wd16_cpu_state->vdk->sched = NULL;
+    free(s);
+  }
+}
@@ -0,0 +1,172 @@
+/* am-vdk-stat.c (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include "am-vdk.h"
+#include "am-ddb.h"
+
+//
+// Statistics for each virtual drive: requests, bytes, the spread of
+// DB$RSZ, and service time from when AMOS made the request (SVCC 0) to
+// when DB$ERR was set, which for an async request includes any time
+// queued.  they say whether a bigger cache, read-ahead or io_uring is
+// paying for itself.
+//
+// the CPU thread, the io_uring completion thread and the scheduler's
+// dispatcher all finish requests, so a drive's stats are updated under
+// its own spin lock, held for a few adds.
+//
+
+uint64_t am_vdk_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static void stat_lock(VDKDRIVE *d) {
+  while (__atomic_test_and_set(&d->slock, __ATOMIC_ACQUIRE))
+    ;
+}
+
+static void stat_unlock(VDKDRIVE *d) {
+  __atomic_clear(&d->slock, __ATOMIC_RELEASE);
+}
+
+//
+// a request for 'len' bytes made at 'start' has finished with 'err'
+//
+void am_vdk_account(wd16_cpu_state_t* wd16_cpu_state, int drive, int write, uint16_t len, int err, uint64_t start, int async) {
+  VDKDRIVE *d = &wd16_cpu_state->vdk->drive[drive];
+  uint64_t ns = am_vdk_now() - start;
+
+  stat_lock(d);
+  cpu_hist_add(&d->stat.rsz, len);
+  if (err != DE$OK)
+    d->stat.errors++;
+  else if (write) {
+    d->stat.writes++;
+    d->stat.write_bytes += len;
+    cpu_hist_add(&d->stat.write_ns, ns);
+  } else {
+    d->stat.reads++;
+    d->stat.read_bytes += len;
+    cpu_hist_add(&d->stat.read_ns, ns);
+  }
+  if (async)
+    d->stat.async++;
+  stat_unlock(d);
+}
+
+void am_vdk_stats(wd16_cpu_state_t* wd16_cpu_state, int drive, VDKDSTAT *stat) {
+  VDKDRIVE *d;
+
+  memset(stat, 0, sizeof(*stat));
+  if ((wd16_cpu_state->vdk == NULL) || (drive < 0) || (drive >= VDK_DRIVES))
+    return;
+  d = &wd16_cpu_state->vdk->drive[drive];
+  stat_lock(d);
+  *stat = d->stat;
+  stat_unlock(d);
+}
+
+//
+// start counting again for one drive, or all of them if 'drive' is -1
+//
+void am_vdk_stats_reset(wd16_cpu_state_t* wd16_cpu_state, int drive) {
+  VDKDRIVE *d;
+  int i;
+
+  if (wd16_cpu_state->vdk == NULL)
+    return;
+  for (i = 0; i < VDK_DRIVES; i++) {
+    if ((drive >= 0) && (i != drive))
+      continue;
+    d = &wd16_cpu_state->vdk->drive[i];
+    stat_lock(d);
+    memset(&d->stat, 0, sizeof(d->stat));
+    d->stat.since = am_vdk_now();
+    stat_unlock(d);
+  }
+}
+
+//
+// every mounted drive's stats, then the cache, write-back and
+// scheduler if they are on
+//
+void am_vdk_dump(wd16_cpu_state_t* wd16_cpu_state, FILE *f) {
+  VDKDSTAT st;
+  VDKCSTAT cs;
+  VDKWBSTAT ws;
+  VDKSSTAT ss;
+  double secs;
+  int i;
+
+  if (wd16_cpu_state->vdk == NULL)
+    return;
+  for (i = 0; i < VDK_DRIVES; i++) {
+    if (!wd16_cpu_state->vdk->drive[i].mounted)
+      continue;
+    am_vdk_stats(wd16_cpu_state, i, &st);
+    secs = (am_vdk_now() - st.since) / 1e9;
+    fprintf(f, "drive %d: %llu reads (%llu bytes), %llu writes (%llu bytes), %llu errors, %llu async, %.1f IOPS over %.1f s\n",
+            i, (unsigned long long)st.reads, (unsigned long long)st.read_bytes,
+            (unsigned long long)st.writes, (unsigned long long)st.write_bytes,
+            (unsigned long long)st.errors, (unsigned long long)st.async,
+            secs > 0 ? (st.reads + st.writes) / secs : 0.0, secs);
+    if (st.rsz.count == 0)
+      continue;
+    fprintf(f, " record size\n");
+    cpu_hist_dump(f, &st.rsz, "bytes");
+    if (st.read_ns.count) {
+      fprintf(f, " read service time\n");
+      cpu_hist_dump(f, &st.read_ns, "ns");
+    }
+    if (st.write_ns.count) {
+      fprintf(f, " write service time\n");
+      cpu_hist_dump(f, &st.write_ns, "ns");
+    }
+  }
+  if (wd16_cpu_state->vdk->cache) {
+    am_vdk_cache_stats(wd16_cpu_state, &cs);
+    fprintf(f, "cache: %llu hits, %llu misses, %llu prefetched, %llu prefetch hits, %llu evicted\n",
+            (unsigned long long)cs.hits, (unsigned long long)cs.misses, (unsigned long long)cs.prefetched,
+            (unsigned long long)cs.prefetch_hits, (unsigned long long)cs.evicted);
+  }
+  if (wd16_cpu_state->vdk->wb) {
+    am_vdk_wb_stats(wd16_cpu_state, &ws);
+    fprintf(f, "write-back: %llu dirty, %llu flushes of %llu records, %llu syncs, %llu errors\n",
+            (unsigned long long)ws.dirty, (unsigned long long)ws.flushes, (unsigned long long)ws.flushed,
+            (unsigned long long)ws.syncs, (unsigned long long)ws.errors);
+    if (ws.flush_ns.count)
+      cpu_hist_dump(f, &ws.flush_ns, "ns");
+  }
+  if (wd16_cpu_state->vdk->sched) {
+    am_vdk_sched_stats(wd16_cpu_state, &ss);
+    fprintf(f, "scheduler: %llu queued (%llu chained), %llu dispatched, %llu past deadline, %llu records moved, %u most waiting\n",
+            (unsigned long long)ss.queued, (unsigned long long)ss.chained, (unsigned long long)ss.dispatched,
+            (unsigned long long)ss.expired, (unsigned long long)ss.distance, ss.maxq);
+  }
+}
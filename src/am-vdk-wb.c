@@ -0,0 +1,456 @@
+/* am-vdk-wb.c   (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include <errno.h>
+#include "am-vdk.h"
+
+//
+// Write-back for the virtual disk driver.  written through, every
+// record AMOS writes to an image that has to be synced costs a trip to
+// the disk, and an ISAM update is a handful of those.  with write-back
+// on, a write just copies the record into a dirty set and completes;
+// a flusher thread writes the set out and syncs each drive it touched
+// once, when the oldest record has waited 'interval_ms', the set holds
+// 'max_dirty' records, or am_vdk_flush() asks.
+//
+// ordering: records are flushed in batches.  a batch is the dirty set
+// at the moment the flusher takes it; writes made after that go to a
+// new set, which isn't touched until every drive the earlier batch
+// wrote to has been synced.  so a write AMOS saw complete is durable
+// before anything it wrote later is, although the records within one
+// batch (rewrites of a record in it are coalesced) reach the disk in
+// no particular order before that batch's sync.
+//
+// reads look in the dirty sets first, so AMOS always sees its writes.
+//
+
+#define WB_HASH 1024                    /* buckets per dirty set     */
+
+typedef struct _WBREC {                 /* One dirty record          */
+  int drive;                            /* DB$DRI                    */
+  uint32_t rnm;                         /* record number             */
+  uint16_t len;                         /* record size               */
+  int next;                             /* hash chain, -1 at end     */
+  uint8_t *data;                        /* record                    */
+
+} WBREC;
+
+typedef struct _WBSET {                 /* A batch of dirty records  */
+  uint32_t n;                           /* records in use            */
+  uint32_t max;                         /* records allocated         */
+  uint64_t first;                       /* when the first was added  */
+  WBREC *rec;
+  int hash[WB_HASH];
+
+} WBSET;
+
+typedef struct _VDKWB {                 /* Write-back state          */
+  pthread_mutex_t lock;                 /* CPU and flusher thread    */
+  pthread_cond_t cond;                  /* work for the flusher      */
+  pthread_cond_t done;                  /* a batch has been flushed  */
+  pthread_t thread;                     /* flusher thread            */
+  uint32_t interval_ms;                 /* oldest record may wait    */
+  uint32_t max_dirty;                   /* records before a flush    */
+  int stop;                             /* flush all, then exit      */
+  int urgent;                           /* am_vdk_flush() waiting    */
+  uint64_t epoch;                       /* batches taken             */
+  uint64_t flushed;                     /* batches made durable      */
+  WBSET *cur;                           /* taking writes             */
+  WBSET *fl;                            /* being flushed             */
+  WBSET set[2];
+  VDKWBSTAT stat;
+
+} VDKWB;
+
+static unsigned wb_bucket(int drive, uint32_t rnm) {
+  return ((rnm * 2654435761U + drive * 40503U) % WB_HASH);
+}
+
+static WBREC *wb_lookup(WBSET *s, int drive, uint32_t rnm) {
+  int i;
+
+  for (i = s->hash[wb_bucket(drive, rnm)]; i >= 0; i = s->rec[i].next)
+    if ((s->rec[i].drive == drive) && (s->rec[i].rnm == rnm))
+      return (&s->rec[i]);
+  return (NULL);
+}
+
+static void wb_clear(WBSET *s) {
+  uint32_t i;
+
+  for (i = 0; i < s->n; i++)
+    free(s->rec[i].data);
+  for (i = 0; i < WB_HASH; i++)
+    s->hash[i] = -1;
+  s->n = 0;
+}
+
+static int wb_order(const void *a, const void *b) {
+  const WBREC *x = *(WBREC * const *)a, *y = *(WBREC * const *)b;
+
+  if (x->drive != y->drive)
+    return (x->drive - y->drive);
+  return ((x->rnm > y->rnm) - (x->rnm < y->rnm));
+}
+
+//
+// write one batch out and sync the drives it touched, in drive and
+// record order so an image is written front to back.  returns the
+// number of records that couldn't be written.
+//
+static uint64_t wb_write(wd16_cpu_state_t* wd16_cpu_state, WBSET *s, uint64_t *syncs) {
+  WBREC **order, *r;
+  VDKDRIVE *d;
+  uint64_t off, errors = 0;
+  uint32_t i;
+  int touched[VDK_DRIVES] = {0};
+
+  if ((order = malloc(s->n * sizeof(WBREC *))) != NULL) {
+    for (i = 0; i < s->n; i++)
+      order[i] = &s->rec[i];
+    qsort(order, s->n, sizeof(WBREC *), wb_order);
+  }
+  for (i = 0; i < s->n; i++) {
+    r = order ? order[i] : &s->rec[i];
+    d = &wd16_cpu_state->vdk->drive[r->drive];
+    off = (uint64_t)r->rnm * r->len;
+    if (d->map)
+      memcpy(d->map + off, r->data, r->len);
+    else if (!d->ops->write(d, r->data, r->len, off)) {
+      errors++;
+      continue;
+    }
+    touched[r->drive] = true;
+  }
+  free(order);
+
+  for (i = 0; i < VDK_DRIVES; i++) {
+    d = &wd16_cpu_state->vdk->drive[i];
+    if (!touched[i] || !d->ops->sync)
+      continue;
+    (*syncs)++;
+    if (!d->ops->sync(d))
+      errors++;
+  }
+  return (errors);
+}
+
+static void *wb_thread(void *arg) {
+  wd16_cpu_state_t* wd16_cpu_state = arg;
+  VDKWB *wb = wd16_cpu_state->vdk->wb;
+  struct timespec ts;
+  uint64_t start, errors, syncs, due;
+  WBSET *s;
+
+  pthread_mutex_lock(&wb->lock);
+  for (;;) {
+    if (wb->cur->n == 0) {
+      if (wb->stop)
+        break;
+      pthread_cond_wait(&wb->cond, &wb->lock);
+      continue;
+    }
+    if (!wb->stop && !wb->urgent && !(wb->max_dirty && (wb->cur->n >= wb->max_dirty))) {
+      if (wb->interval_ms == 0) {
+        pthread_cond_wait(&wb->cond, &wb->lock);
+        continue;
+      }
+      due = wb->cur->first + wb->interval_ms * 1000000ULL;
+      if (am_vdk_now() < due) {
+        ts.tv_sec = due / 1000000000ULL;
+        ts.tv_nsec = due % 1000000000ULL;
+        pthread_cond_timedwait(&wb->cond, &wb->lock, &ts);
+        continue;
+      }
+    }
+
+    // take the batch; writes from here on start the next one
+    s = wb->cur;
+    wb->cur = wb->fl;
+    wb->fl = s;
+    wb->epoch++;
+    wb->urgent = 0;
+    pthread_cond_broadcast(&wb->done);    // a writer may be waiting for room
+    pthread_mutex_unlock(&wb->lock);
+
+    start = am_vdk_now();
+    syncs = 0;
+    errors = wb_write(wd16_cpu_state, s, &syncs);
+    am_vdk_cache_stale(wd16_cpu_state);
+
+    pthread_mutex_lock(&wb->lock);
+    wb->stat.flushes++;
+    wb->stat.flushed += s->n;
+    wb->stat.syncs += syncs;
+    wb->stat.errors += errors;
+    cpu_hist_add(&wb->stat.flush_ns, am_vdk_now() - start);
+    wb_clear(s);
+    wb->flushed++;
+    pthread_cond_broadcast(&wb->done);
+  }
+  pthread_mutex_unlock(&wb->lock);
+  return (NULL);
+}
+
+static void wb_release(VDKWB *wb) {
+  wb_clear(&wb->set[0]);
+  wb_clear(&wb->set[1]);
+  free(wb->set[0].rec);
+  free(wb->set[1].rec);
+  free(wb);
+}
+
+//
+// flush everything and stop the flusher
+//
+static void wb_free(wd16_cpu_state_t* wd16_cpu_state) {
+  VDKWB *wb = wd16_cpu_state->vdk->wb;
+
+  if (wb == NULL)
+    return;
+  pthread_mutex_lock(&wb->lock);
+  wb->stop = 1;
+  pthread_cond_broadcast(&wb->cond);
+  pthread_mutex_unlock(&wb->lock);
+  pthread_join(wb->thread, NULL);
+  wd16_cpu_state->vdk->wb = NULL;
+  pthread_mutex_destroy(&wb->lock);
+  pthread_cond_destroy(&wb->cond);
+  pthread_cond_destroy(&wb->done);
+  wb_release(wb);
+}
+
+//
+// turn write-back on, flushing once a record has waited 'interval_ms'
+// (0 for no timer) or 'max_dirty' records are waiting (0 for no
+// limit); a writer is held up if twice that many are.  (0, 0) flushes
+// everything and goes back to writing through.  call it with the CPU
+// stopped or idle.
+//
+int am_vdk_writeback(wd16_cpu_state_t* wd16_cpu_state, uint32_t interval_ms, uint32_t max_dirty) {
+  pthread_condattr_t attr;
+  VDKWB *wb;
+
+  if (wd16_cpu_state->vdk == NULL)
+    if ((wd16_cpu_state->vdk = calloc(1, sizeof(AMVDK))) == NULL)
+      return (false);
+  if ((wb = wd16_cpu_state->vdk->wb) != NULL && (interval_ms || max_dirty)) {
+    pthread_mutex_lock(&wb->lock);
+    wb->interval_ms = interval_ms;
+    wb->max_dirty = max_dirty;
+    pthread_cond_broadcast(&wb->cond);
+    pthread_mutex_unlock(&wb->lock);
+    return (true);
+  }
+  wb_free(wd16_cpu_state);
+  if ((interval_ms == 0) && (max_dirty == 0))
+    return (true);
+
+  if ((wb = calloc(1, sizeof(VDKWB))) == NULL)
+    return (false);
+  wb->interval_ms = interval_ms;
+  wb->max_dirty = max_dirty;
+  wb->cur = &wb->set[0];
+  wb->fl = &wb->set[1];
+  wb_clear(wb->cur);
+  wb_clear(wb->fl);
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+  pthread_mutex_init(&wb->lock, NULL);
+  pthread_cond_init(&wb->cond, &attr);
+  pthread_cond_init(&wb->done, NULL);
+  pthread_condattr_destroy(&attr);
+  wd16_cpu_state->vdk->wb = wb;
+  if (pthread_create(&wb->thread, NULL, wb_thread, wd16_cpu_state) != 0) {
+    wd16_cpu_state->vdk->wb = NULL;
+    wb_release(wb);
+    return (false);
+  }
+  return (true);
+}
+
+//
+// a barrier: returns once every write made before it is durable, true
+// if they all made it
+//
+int am_vdk_flush(wd16_cpu_state_t* wd16_cpu_state) {
+  VDKWB *wb;
+  uint64_t target, errors;
+
+  if ((wd16_cpu_state->vdk == NULL) || ((wb = wd16_cpu_state->vdk->wb) == NULL))
+    return (true);
+  pthread_mutex_lock(&wb->lock);
+  errors = wb->stat.errors;
+  target = wb->epoch + (wb->cur->n ? 1 : 0);
+  if (wb->cur->n) {
+    wb->urgent = 1;
+    pthread_cond_signal(&wb->cond);
+  }
+  while (wb->flushed < target)
+    pthread_cond_wait(&wb->done, &wb->lock);
+  errors = wb->stat.errors - errors;
+  pthread_mutex_unlock(&wb->lock);
+  return (errors == 0);
+}
+
+void am_vdk_wb_stats(wd16_cpu_state_t* wd16_cpu_state, VDKWBSTAT *stat) {
+  VDKWB *wb;
+
+  memset(stat, 0, sizeof(*stat));
+  if ((wd16_cpu_state->vdk == NULL) || ((wb = wd16_cpu_state->vdk->wb) == NULL))
+    return;
+  pthread_mutex_lock(&wb->lock);
+  *stat = wb->stat;
+  stat->dirty = wb->cur->n + wb->fl->n;
+  pthread_mutex_unlock(&wb->lock);
+}
+
+//
+// copy a record still waiting to be flushed to 'dst', true if it was
+// there.  the newer set wins.
+//
+int am_vdk_wb_get(wd16_cpu_state_t* wd16_cpu_state, int drive, uint32_t rnm, uint16_t len, uint8_t *dst) {
+  VDKWB *wb = wd16_cpu_state->vdk->wb;
+  WBREC *r;
+
+  if (wb == NULL)
+    return (false);
+  pthread_mutex_lock(&wb->lock);
+  if ((r = wb_lookup(wb->cur, drive, rnm)) == NULL)
+    r = wb_lookup(wb->fl, drive, rnm);
+  if (r && (r->len == len))
+    memcpy(dst, r->data, len);
+  else
+    r = NULL;
+  pthread_mutex_unlock(&wb->lock);
+  return (r != NULL);
+}
+
+//
+// true if the image is behind for a record (the read-ahead thread must
+// not cache what's there)
+//
+int am_vdk_wb_dirty(wd16_cpu_state_t* wd16_cpu_state, int drive, uint32_t rnm) {
+  VDKWB *wb = wd16_cpu_state->vdk->wb;
+  int dirty;
+
+  if (wb == NULL)
+    return (false);
+  pthread_mutex_lock(&wb->lock);
+  dirty = wb_lookup(wb->cur, drive, rnm) || wb_lookup(wb->fl, drive, rnm);
+  pthread_mutex_unlock(&wb->lock);
+  return (dirty);
+}
+
+//
+// add a written record to the dirty set, replacing any earlier write
+// of it that hasn't been taken for flushing yet.  false if there was
+// no memory for it; the caller then flushes and writes through.
+//
+int am_vdk_wb_put(wd16_cpu_state_t* wd16_cpu_state, int drive, uint32_t rnm, uint16_t len, const uint8_t *src) {
+  VDKWB *wb = wd16_cpu_state->vdk->wb;
+  WBREC *r, *rec;
+  WBSET *s;
+  uint8_t *data;
+  unsigned h;
+
+  pthread_mutex_lock(&wb->lock);
+  r = wb_lookup(wb->cur, drive, rnm);
+  if (r && (r->len == len)) {
+    memcpy(r->data, src, len);
+    pthread_mutex_unlock(&wb->lock);
+    return (true);
+  }
+  while (wb->max_dirty && (wb->cur->n >= wb->max_dirty * 2) && !r) {
+    pthread_cond_signal(&wb->cond);
+    pthread_cond_wait(&wb->done, &wb->lock);
+    r = wb_lookup(wb->cur, drive, rnm);
+  }
+  s = wb->cur;
+  if (r) {                                // same record, new size
+    free(r->data);
+    r->len = 0;
+    if ((r->data = malloc(len)) == NULL) {
+      pthread_mutex_unlock(&wb->lock);
+      return (false);
+    }
+    r->len = len;
+    memcpy(r->data, src, len);
+    pthread_mutex_unlock(&wb->lock);
+    return (true);
+  }
+
+  if (s->n == s->max) {
+    if ((rec = realloc(s->rec, (s->max ? s->max * 2 : 64) * sizeof(WBREC))) == NULL) {
+      pthread_mutex_unlock(&wb->lock);
+      return (false);
+    }
+    s->rec = rec;
+    s->max = s->max ? s->max * 2 : 64;
+  }
+  if ((data = malloc(len)) == NULL) {
+    pthread_mutex_unlock(&wb->lock);
+    return (false);
+  }
+  memcpy(data, src, len);
+  r = &s->rec[s->n];
+  h = wb_bucket(drive, rnm);
+  r->drive = drive;
+  r->rnm = rnm;
+  r->len = len;
+  r->data = data;
+  r->next = s->hash[h];
+  s->hash[h] = s->n;
+  if (s->n++ == 0) {
+    s->first = am_vdk_now();
+    pthread_cond_signal(&wb->cond);       // start the timer
+  } else if (wb->max_dirty && (s->n == wb->max_dirty))
+    pthread_cond_signal(&wb->cond);
+  pthread_mutex_unlock(&wb->lock);
+  return (true);
+}
+
+//
+// see am_vdk_atfork(), which has flushed everything first, so the child
+// starts with nothing dirty and a flusher of its own
+//
+void am_vdk_wb_atfork(wd16_cpu_state_t* wd16_cpu_state, int phase) {
+  VDKWB *wb = wd16_cpu_state->vdk->wb;
+
+  if (wb == NULL)
+    return;
+  if (phase == VDK_FORK_PREPARE) {
+    pthread_mutex_lock(&wb->lock);
+    return;
+  }
+  if (phase == VDK_FORK_CHILD)
+    wb->stop = wb->urgent = 0;
+  pthread_mutex_unlock(&wb->lock);
+  if ((phase == VDK_FORK_CHILD) && (pthread_create(&wb->thread, NULL, wb_thread, wd16_cpu_state) != 0)) {
+    wd16_cpu_state->vdk->wb = NULL;       // back to writing through
+    wb_release(wb);
+  }
+}
@@ -0,0 +1,324 @@
+/* am-vdk.c      (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "am-vdk.h"
+#include "am-ddb.h"
+#include "cpu-assist.h"
+#include "cpu-mem.h"
+#include "cpu-dirty.h"
+
+//
+// Virtual disk driver.  AMOS's VDKDVR does SVCC 0 with R0 pointing at
+// the DDB; each image file is memory mapped and a record moves between
+// the mapping and the DDB's buffer in one block copy (a memcpy if the
+// host has registered its memory with cpu_mem_region()).  images that
+// can't be mapped, and other backends such as copy-on-write overlays
+// and compressed images (which am_vdk_mount() recognises), are reached
+// through their VDKOPS and the block cache in am-vdk-cache.c.
+//
+// a DDB with DF$ASY set may instead be queued to io_uring if the host
+// has called am_vdk_async(), see am-vdk-aio.c, and am_vdk_sched() can
+// reorder those, see am-vdk-sched.c.  with am_vdk_writeback() on,
+// writes are batched and synced behind AMOS's back, see am-vdk-wb.c.
+//
+// mounting a drive installs the driver as the SVCC 0 assist.  requests
+// for drives not mounted here still go to the host's vdkdvr(), so a
+// host can move drives over one at a time.
+//
+
+static int vdk_svcc(wd16_cpu_state_t* wd16_cpu_state, int arg, void *ctx);
+
+static int file_read(VDKDRIVE *d, uint8_t *buf, uint32_t len, uint64_t off) {
+  return (pread(d->fd, buf, len, off) == len);
+}
+
+static int file_write(VDKDRIVE *d, const uint8_t *buf, uint32_t len, uint64_t off) {
+  return (pwrite(d->fd, buf, len, off) == len);
+}
+
+static int file_sync(VDKDRIVE *d) {
+  if (d->map)
+    return (msync(d->map, d->size, MS_SYNC) == 0);
+  return (fdatasync(d->fd) == 0);
+}
+
+static void file_close(VDKDRIVE *d) {
+  close(d->fd);
+}
+
+static const VDKOPS file_ops = {file_read, file_write, file_sync, file_close};
+
+static int lz_read(VDKDRIVE *d, uint8_t *buf, uint32_t len, uint64_t off) {
+  return (am_vdk_lz_read(d->priv, buf, len, off));
+}
+
+static int lz_write(VDKDRIVE *d, const uint8_t *buf, uint32_t len, uint64_t off) {
+  return (false);                         // mounted read-only
+}
+
+static void lz_close(VDKDRIVE *d) {
+  am_vdk_lz_close(d->priv);
+}
+
+static const VDKOPS lz_ops = {lz_read, lz_write, NULL, lz_close};
+
+//
+// mount a drive whose image is reached through 'ops' (see am-vdk-cow.c)
+//
+int am_vdk_attach(wd16_cpu_state_t* wd16_cpu_state, int drive, const VDKOPS *ops, void *priv, uint64_t size, int flags) {
+  VDKDRIVE *d;
+
+  if ((drive < 0) || (drive >= VDK_DRIVES))
+    return (false);
+  if (wd16_cpu_state->vdk == NULL)
+    if ((wd16_cpu_state->vdk = calloc(1, sizeof(AMVDK))) == NULL)
+      return (false);
+  am_vdk_unmount(wd16_cpu_state, drive);
+
+  d = &wd16_cpu_state->vdk->drive[drive];
+  d->ops = ops;
+  d->priv = priv;
+  d->fd = -1;
+  d->map = NULL;
+  d->size = size;
+  d->readonly = flags & VDK_RDONLY;
+  memset(&d->stat, 0, sizeof(d->stat));
+  d->stat.since = am_vdk_now();
+  d->seq_next = d->seq_run = d->ra_next = 0;
+  d->mounted = true;
+  cpu_assist_svc(wd16_cpu_state, ASSIST_SVCC, 0, vdk_svcc, NULL);
+  return (true);
+}
+
+int am_vdk_mount(wd16_cpu_state_t* wd16_cpu_state, int drive, const char *path, int flags) {
+  struct stat st;
+  int fd, readonly = flags & VDK_RDONLY;
+  void *map = MAP_FAILED;
+  struct _VDKLZ *lz;
+
+  if ((drive < 0) || (drive >= VDK_DRIVES))
+    return (false);
+  if ((lz = am_vdk_lz_open(path)) != NULL) {
+    if (am_vdk_attach(wd16_cpu_state, drive, &lz_ops, lz, am_vdk_lz_size(lz), flags | VDK_RDONLY))
+      return (true);
+    am_vdk_lz_close(lz);
+    return (false);
+  }
+  if ((fd = open(path, readonly ? O_RDONLY : O_RDWR)) < 0)
+    return (false);
+  if ((fstat(fd, &st) < 0) || (st.st_size == 0)) {
+    close(fd);
+    return (false);
+  }
+  // some filesystems can't be mapped; pread will do for those
+  if (!(flags & VDK_NOMAP))
+    map = mmap(NULL, st.st_size, readonly ? PROT_READ : PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  if (!am_vdk_attach(wd16_cpu_state, drive, &file_ops, NULL, st.st_size, flags)) {
+    if (map != MAP_FAILED)
+      munmap(map, st.st_size);
+    close(fd);
+    return (false);
+  }
+  wd16_cpu_state->vdk->drive[drive].fd = fd;
+  wd16_cpu_state->vdk->drive[drive].map = (map == MAP_FAILED) ? NULL : map;
+  return (true);
+}
+
+void am_vdk_unmount(wd16_cpu_state_t* wd16_cpu_state, int drive) {
+  VDKDRIVE *d;
+
+  if ((wd16_cpu_state->vdk == NULL) || (drive < 0) || (drive >= VDK_DRIVES))
+    return;
+  d = &wd16_cpu_state->vdk->drive[drive];
+  if (!d->mounted)
+    return;
+  am_vdk_aio_drain(wd16_cpu_state, drive);
+  am_vdk_flush(wd16_cpu_state);
+  am_vdk_cache_drop(wd16_cpu_state, drive);
+  d->mounted = false;
+  if (d->map) {
+    if (!d->readonly)
+      msync(d->map, d->size, MS_SYNC);
+    munmap(d->map, d->size);
+    d->map = NULL;
+  }
+  d->ops->close(d);
+}
+
+static int vdk_read(wd16_cpu_state_t* wd16_cpu_state, int dri, uint16_t rnm, uint16_t bad, uint16_t rsz, uint64_t off) {
+  VDKDRIVE *d = &wd16_cpu_state->vdk->drive[dri];
+  uint8_t *host = cpu_mem_host(wd16_cpu_state, bad, rsz);
+  uint8_t *buf = host ? host : wd16_cpu_state->vdk->bounce;
+
+  if (am_vdk_wb_get(wd16_cpu_state, dri, rnm, rsz, buf)) {
+    if (!host)                            // not flushed yet
+      cpu_mem_write(wd16_cpu_state, bad, buf, rsz);
+  } else if (d->map)
+    cpu_mem_write(wd16_cpu_state, bad, d->map + off, rsz);
+  else {
+    if (!am_vdk_cache_get(wd16_cpu_state, dri, rnm, rsz, buf)) {
+      if (!d->ops->read(d, buf, rsz, off))
+        return (DE$IO);
+      am_vdk_cache_put(wd16_cpu_state, dri, rnm, rsz, buf, true);
+    }
+    if (!host)
+      cpu_mem_write(wd16_cpu_state, bad, buf, rsz);
+  }
+  if (host)                               // read straight into memory
+    cpu_dirty_mark(wd16_cpu_state, bad, rsz);
+  am_vdk_cache_seq(wd16_cpu_state, dri, rnm, rsz);
+  return (DE$OK);
+}
+
+static int vdk_write(wd16_cpu_state_t* wd16_cpu_state, int dri, uint16_t rnm, uint16_t bad, uint16_t rsz, uint64_t off) {
+  VDKDRIVE *d = &wd16_cpu_state->vdk->drive[dri];
+  uint8_t *buf = cpu_mem_host(wd16_cpu_state, bad, rsz);
+  int queued = false;
+
+  if ((buf == NULL) && (wd16_cpu_state->vdk->wb || (d->map == NULL))) {
+    buf = wd16_cpu_state->vdk->bounce;
+    cpu_mem_read(wd16_cpu_state, buf, bad, rsz);
+  }
+  if (wd16_cpu_state->vdk->wb) {
+    queued = am_vdk_wb_put(wd16_cpu_state, dri, rnm, rsz, buf);
+    if (!queued && !am_vdk_flush(wd16_cpu_state))
+      return (DE$IO);                     // else write through, in order
+  }
+  if (!queued) {
+    if (d->map)
+      cpu_mem_read(wd16_cpu_state, d->map + off, bad, rsz);
+    else if (!d->ops->write(d, buf, rsz, off))
+      return (DE$IO);
+  }
+  if (d->map == NULL)
+    am_vdk_cache_put(wd16_cpu_state, dri, rnm, rsz, buf, false);
+  return (DE$OK);
+}
+
+static void vdk_ddb(wd16_cpu_state_t* wd16_cpu_state, uint16_t ddb, uint8_t *flg, uint8_t *dri, uint16_t *bad, uint16_t *rsz, uint16_t *rnm) {
+  wd16_cpu_state->getAMbyte(flg, ddb + DB$FLG);
+  wd16_cpu_state->getAMbyte(dri, ddb + DB$DRI);
+  wd16_cpu_state->getAMword((unsigned char *)bad, ddb + DB$BAD);
+  wd16_cpu_state->getAMword((unsigned char *)rsz, ddb + DB$RSZ);
+  wd16_cpu_state->getAMword((unsigned char *)rnm, ddb + DB$RNM);
+}
+
+//
+// DE$OK if the transfer can be done on the drive
+//
+static int vdk_check(wd16_cpu_state_t* wd16_cpu_state, uint8_t flg, uint8_t dri, uint16_t rsz, uint16_t rnm) {
+  VDKDRIVE *d = (wd16_cpu_state->vdk && (dri < VDK_DRIVES)) ? &wd16_cpu_state->vdk->drive[dri] : NULL;
+
+  if ((d == NULL) || !d->mounted)
+    return (DE$DRV);
+  if ((uint64_t)rnm * rsz + rsz > d->size)
+    return (DE$REC);
+  if ((flg & DF$WRT) && d->readonly)
+    return (DE$WPT);
+  return (DE$OK);
+}
+
+//
+// the DDB at 'ddb' has been queued to the scheduler; queue the ones
+// AMOS has linked after it with DB$QCL too, up to the first that it
+// will have to hand over itself.  SVCC 0 for one of these later does
+// nothing, see am_vdk_sched_ahead().
+//
+static void vdk_chain(wd16_cpu_state_t* wd16_cpu_state, uint16_t ddb) {
+  uint8_t flg, dri;
+  uint16_t bad, rsz, rnm;
+  int n;
+
+  if (!am_vdk_sched_chain(wd16_cpu_state))
+    return;
+  for (n = 0; n < 64; n++) {              // a looped chain ends too
+    wd16_cpu_state->getAMword((unsigned char *)&ddb, ddb + DB$QCL);
+    if (ddb == 0)
+      return;
+    vdk_ddb(wd16_cpu_state, ddb, &flg, &dri, &bad, &rsz, &rnm);
+    if (!(flg & DF$ASY) || (flg & DF$BSY) || (vdk_check(wd16_cpu_state, flg, dri, rsz, rnm) != DE$OK))
+      return;
+    if (!am_vdk_sched_queue(wd16_cpu_state, dri, ddb, bad, rsz, rnm, flg & DF$WRT, true))
+      return;
+    if (flg & DF$WRT)
+      am_vdk_cache_forget(wd16_cpu_state, dri, rnm);
+  }
+}
+
+//
+// do the transfer the DDB at 'ddb' asks for, returning the DE$ code
+// that is also left in DB$ERR
+//
+int am_vdk_request(wd16_cpu_state_t* wd16_cpu_state, uint16_t ddb) {
+  uint64_t off, start = am_vdk_now();
+  uint8_t flg, dri, err;
+  uint16_t bad, rsz, rnm;
+
+  vdk_ddb(wd16_cpu_state, ddb, &flg, &dri, &bad, &rsz, &rnm);
+  if (am_vdk_sched_ahead(wd16_cpu_state, ddb)) {
+    // vdk_chain() queued it already; DB$ERR is set on completion
+    wd16_cpu_state->getAMbyte(&err, ddb + DB$ERR);
+    return ((flg & DF$BSY) ? DE$OK : err);
+  }
+  off = (uint64_t)rnm * rsz;
+  err = vdk_check(wd16_cpu_state, flg, dri, rsz, rnm);
+  if ((err == DE$OK) && (flg & DF$ASY)) {
+    // DB$ERR is set on completion.  with the scheduler on, only its
+    // dispatcher may submit to the ring
+    if (am_vdk_sched_queue(wd16_cpu_state, dri, ddb, bad, rsz, rnm, flg & DF$WRT, false)) {
+      if (flg & DF$WRT)
+        am_vdk_cache_forget(wd16_cpu_state, dri, rnm);
+      vdk_chain(wd16_cpu_state, ddb);
+      return (DE$OK);
+    }
+    if (!wd16_cpu_state->vdk->sched && am_vdk_aio_submit(wd16_cpu_state, dri, ddb, bad, rsz, off, flg & DF$WRT, start)) {
+      if (flg & DF$WRT)
+        am_vdk_cache_forget(wd16_cpu_state, dri, rnm);
+      return (DE$OK);
+    }
+  }
+  if (err == DE$OK)
+    err = (flg & DF$WRT) ? vdk_write(wd16_cpu_state, dri, rnm, bad, rsz, off) : vdk_read(wd16_cpu_state, dri, rnm, bad, rsz, off);
+  if (err != DE$DRV)
+    am_vdk_account(wd16_cpu_state, dri, flg & DF$WRT, rsz, err, start, false);
+  cpu_putAMbyte(wd16_cpu_state, &err, ddb + DB$ERR);
+  return (err);
+}
+
+static int vdk_svcc(wd16_cpu_state_t* wd16_cpu_state, int arg, void *ctx) {
+  uint16_t ddb = wd16_cpu_state->regs.R0;
+  uint8_t dri;
+
+  wd16_cpu_state->getAMbyte(&dri, ddb + DB$DRI);
+  if ((dri >= VDK_DRIVES) || !wd16_cpu_state->vdk->drive[dri].mounted)
+    return (false);                       // the host's vdkdvr() then
+  am_vdk_request(wd16_cpu_state, ddb);
+  return (true);
+}
@@ -0,0 +1,207 @@
+/* am-vdk.h      (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+#ifndef __AM_VDK_H__
+#define __AM_VDK_H__
+
+#include "wd16.h"
+#include "cpu-hist.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*-------------------------------------------------------------------*/
+/* Structure definition for the virtual disk driver                  */
+/*-------------------------------------------------------------------*/
+#define VDK_DRIVES 16                   /* drives, by DB$DRI         */
+#define VDK_RDONLY 1                    /* am_vdk_mount() flags:     */
+#define VDK_NOMAP  2                    /* pread/pwrite, not mmap    */
+#define VDK_FORK_PREPARE 0              /* am_vdk_atfork() phases:   */
+#define VDK_FORK_PARENT  1              /* ... before fork(), then   */
+#define VDK_FORK_CHILD   2              /* ... in each process after */
+
+struct _VDKDRIVE;
+struct _VDKLZ;
+
+typedef struct _VDKOPS {                /* Disk image backend        */
+  // int read(VDKDRIVE *d, uint8_t *buf, uint32_t len, uint64_t off);
+  // int write(VDKDRIVE *d, const uint8_t *buf, uint32_t len, uint64_t off);
+  // int sync(VDKDRIVE *d);
+  // void close(VDKDRIVE *d);
+  int (*read)(struct _VDKDRIVE *d, uint8_t *buf, uint32_t len, uint64_t off);
+  int (*write)(struct _VDKDRIVE *d, const uint8_t *buf, uint32_t len, uint64_t off);
+  int (*sync)(struct _VDKDRIVE *d);
+  void (*close)(struct _VDKDRIVE *d);
+
+} VDKOPS;
+
+typedef struct _VDKDSTAT {              /* Per-drive statistics      */
+  uint64_t since;                       /* mount or reset, ns        */
+  uint64_t reads;                       /* records read              */
+  uint64_t writes;                      /* records written           */
+  uint64_t read_bytes;                  /* bytes read                */
+  uint64_t write_bytes;                 /* bytes written             */
+  uint64_t errors;                      /* requests not DE$OK        */
+  uint64_t async;                       /* ... completed off thread  */
+  HIST rsz;                             /* DB$RSZ of each request    */
+  HIST read_ns;                         /* read service time         */
+  HIST write_ns;                        /* write service time        */
+
+} VDKDSTAT;
+
+typedef struct _VDKDRIVE {              /* One disk image            */
+  int mounted;                          /* drive in use              */
+  const VDKOPS *ops;                    /* backend when not mapped   */
+  void *priv;                           /* backend's own state       */
+  uint8_t *map;                         /* mapped image, NULL=pread  */
+  uint64_t size;                        /* image bytes               */
+  int fd;                               /* image file, -1 if none    */
+  int readonly;                         /* write protected           */
+  int inflight;                         /* async transfers queued    */
+  uint32_t seq_next;                    /* record a sequential read  */
+                                        /* would ask for next        */
+  uint32_t seq_run;                     /* sequential reads so far   */
+  uint32_t ra_next;                     /* first record not yet read */
+                                        /* ahead                     */
+  int slock;                            /* held to update stat       */
+  VDKDSTAT stat;                        /* see am-vdk-stat.c         */
+
+} VDKDRIVE;
+
+typedef struct _VDKCSTAT {              /* Block cache statistics    */
+  uint64_t hits;                        /* reads found in the cache  */
+  uint64_t misses;                      /* ... and not               */
+  uint64_t prefetched;                  /* records read ahead        */
+  uint64_t prefetch_hits;               /* ... that were then read   */
+  uint64_t evicted;                     /* blocks reused             */
+
+} VDKCSTAT;
+
+typedef struct _VDKWBSTAT {             /* Write-back statistics     */
+  uint64_t dirty;                       /* records waiting to flush  */
+  uint64_t flushes;                     /* batches made durable      */
+  uint64_t flushed;                     /* records in those batches  */
+  uint64_t syncs;                       /* fdatasync/msync calls     */
+  uint64_t errors;                      /* records that failed       */
+  HIST flush_ns;                        /* batch write+sync time     */
+
+} VDKWBSTAT;
+
+typedef struct _VDKSSTAT {              /* Request scheduler stats   */
+  uint64_t queued;                      /* DDBs queued               */
+  uint64_t chained;                     /* ... found by DB$QCL       */
+  uint64_t dispatched;                  /* transfers started         */
+  uint64_t expired;                     /* ... out of order, late    */
+  uint64_t distance;                    /* records moved between     */
+  uint32_t maxq;                        /* most DDBs waiting         */
+
+} VDKSSTAT;
+
+typedef struct _AMVDK {                 /* Virtual disk driver       */
+  VDKDRIVE drive[VDK_DRIVES];           /* by DB$DRI                 */
+  struct _VDKAIO *aio;                  /* io_uring, NULL=sync only  */
+  struct _VDKCACHE *cache;              /* block cache, NULL=none    */
+  struct _VDKWB *wb;                    /* write-back, NULL=through  */
+  struct _VDKSCHED *sched;              /* DF$ASY queue, NULL=FIFO   */
+  uint32_t readahead;                   /* records to read ahead     */
+  VDKCSTAT cstat;                       /* cache statistics          */
+  uint8_t bounce[65536];                /* records not in a region   */
+
+} AMVDK;
+
+//
+// image file headers and indexes are little-endian whatever the host
+//
+static inline void vdk_put_le(uint8_t *p, uint64_t v, int n) {
+  int i;
+
+  for (i = 0; i < n; i++)
+    p[i] = v >> (8 * i);
+}
+
+static inline uint64_t vdk_get_le(const uint8_t *p, int n) {
+  uint64_t v = 0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    v |= (uint64_t)p[i] << (8 * i);
+  return (v);
+}
+
+int  am_vdk_mount(wd16_cpu_state_t* wd16_cpu_state, int drive, const char *path, int flags);
+int  am_vdk_mount_cow(wd16_cpu_state_t* wd16_cpu_state, int drive, const char *base, const char *overlay, int flags);
+int  am_vdk_attach(wd16_cpu_state_t* wd16_cpu_state, int drive, const VDKOPS *ops, void *priv, uint64_t size, int flags);
+void am_vdk_unmount(wd16_cpu_state_t* wd16_cpu_state, int drive);
+int  am_vdk_request(wd16_cpu_state_t* wd16_cpu_state, uint16_t ddb);
+int  am_vdk_async(wd16_cpu_state_t* wd16_cpu_state, int level);
+int  am_vdk_aio_able(wd16_cpu_state_t* wd16_cpu_state, int drive, uint16_t ddb, uint16_t bad, uint16_t rsz);
+int  am_vdk_aio_submit(wd16_cpu_state_t* wd16_cpu_state, int drive, uint16_t ddb, uint16_t bad, uint16_t rsz, uint64_t off, int write, uint64_t start);
+void am_vdk_aio_drain(wd16_cpu_state_t* wd16_cpu_state, int drive);
+void am_vdk_aio_done(wd16_cpu_state_t* wd16_cpu_state, int drive, uint8_t *ddb, int err, int write, uint16_t len, uint64_t start);
+int  am_vdk_sched(wd16_cpu_state_t* wd16_cpu_state, uint32_t depth, uint32_t expire_ms, int chain);
+void am_vdk_sched_stats(wd16_cpu_state_t* wd16_cpu_state, VDKSSTAT *stat);
+int  am_vdk_sched_queue(wd16_cpu_state_t* wd16_cpu_state, int drive, uint16_t ddb, uint16_t bad, uint16_t rsz, uint16_t rnm, int write, int chained);
+int  am_vdk_sched_chain(wd16_cpu_state_t* wd16_cpu_state);
+int  am_vdk_sched_ahead(wd16_cpu_state_t* wd16_cpu_state, uint16_t ddb);
+void am_vdk_sched_done(wd16_cpu_state_t* wd16_cpu_state, uint8_t *ddb);
+int  am_vdk_cache(wd16_cpu_state_t* wd16_cpu_state, uint32_t blocks, uint16_t block, uint32_t readahead);
+void am_vdk_cache_stats(wd16_cpu_state_t* wd16_cpu_state, VDKCSTAT *stat);
+int  am_vdk_cache_get(wd16_cpu_state_t* wd16_cpu_state, int drive, uint32_t rnm, uint16_t len, uint8_t *dst);
+void am_vdk_cache_put(wd16_cpu_state_t* wd16_cpu_state, int drive, uint32_t rnm, uint16_t len, const uint8_t *src, int add);
+void am_vdk_cache_forget(wd16_cpu_state_t* wd16_cpu_state, int drive, uint32_t rnm);
+void am_vdk_cache_drop(wd16_cpu_state_t* wd16_cpu_state, int drive);
+void am_vdk_cache_seq(wd16_cpu_state_t* wd16_cpu_state, int drive, uint32_t rnm, uint16_t len);
+void am_vdk_cache_stale(wd16_cpu_state_t* wd16_cpu_state);
+int  am_vdk_writeback(wd16_cpu_state_t* wd16_cpu_state, uint32_t interval_ms, uint32_t max_dirty);
+int  am_vdk_flush(wd16_cpu_state_t* wd16_cpu_state);
+void am_vdk_wb_stats(wd16_cpu_state_t* wd16_cpu_state, VDKWBSTAT *stat);
+int  am_vdk_wb_get(wd16_cpu_state_t* wd16_cpu_state, int drive, uint32_t rnm, uint16_t len, uint8_t *dst);
+int  am_vdk_wb_put(wd16_cpu_state_t* wd16_cpu_state, int drive, uint32_t rnm, uint16_t len, const uint8_t *src);
+int  am_vdk_wb_dirty(wd16_cpu_state_t* wd16_cpu_state, int drive, uint32_t rnm);
+uint64_t am_vdk_now(void);
+void am_vdk_account(wd16_cpu_state_t* wd16_cpu_state, int drive, int write, uint16_t len, int err, uint64_t start, int async);
+void am_vdk_stats(wd16_cpu_state_t* wd16_cpu_state, int drive, VDKDSTAT *stat);
+void am_vdk_stats_reset(wd16_cpu_state_t* wd16_cpu_state, int drive);
+void am_vdk_dump(wd16_cpu_state_t* wd16_cpu_state, FILE *f);
+struct _VDKLZ *am_vdk_lz_open(const char *path);
+int  am_vdk_lz_read(struct _VDKLZ *lz, uint8_t *buf, uint32_t len, uint64_t off);
+uint64_t am_vdk_lz_size(struct _VDKLZ *lz);
+void am_vdk_lz_close(struct _VDKLZ *lz);
+int  am_vdk_lz_create(const char *raw, const char *path, uint32_t block);
+void am_vdk_atfork(wd16_cpu_state_t* wd16_cpu_state, int phase);
+void am_vdk_aio_atfork(wd16_cpu_state_t* wd16_cpu_state, int phase);
+void am_vdk_cache_atfork(wd16_cpu_state_t* wd16_cpu_state, int phase);
+void am_vdk_wb_atfork(wd16_cpu_state_t* wd16_cpu_state, int phase);
+void am_vdk_sched_atfork(wd16_cpu_state_t* wd16_cpu_state, int phase);
+int  am_vdk_lz_pack(const uint8_t *src, int len, uint8_t *dst, int cap);
+int  am_vdk_lz_unpack(const uint8_t *src, int len, uint8_t *dst, int cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
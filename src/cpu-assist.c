@@ -0,0 +1,225 @@
+/* cpu-assist.c  (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include "cpu-assist.h"
+
+//
+// Native replacements for guest code.  There are two kinds:
+//
+//  - SVC assists, looked up by SVCA/SVCB/SVCC and the 6 bit argument
+//    before the trap is taken.  the callback gets the argument and
+//    does whatever the monitor's service routine would have done.
+//
+//  - code assists, for routines reached by JSR or TCALL.  each is the
+//    hash of the routine's first 'len' bytes and, optionally, its
+//    entry PC; with no PC a copy of the routine anywhere in memory
+//    (a relocated user program, say) is recognised by its first word
+//    and hash.  the callback gets the linkage register, and if it
+//    handles the call the registry returns as RTN would.
+//
+// callbacks return true if they did the work, false to let the guest
+// code run after all.  they may charge regs.instcount for the
+// instructions they stand in for if timing matters to the guest.
+//
+
+#define FNV_BASIS 0x811C9DC5
+#define FNV_PRIME 0x01000193
+
+#define map_test(map, n) ((map)[(n) >> 3] & (1 << ((n) & 7)))
+#define map_set(map, n)  ((map)[(n) >> 3] |= (1 << ((n) & 7)))
+
+uint32_t cpu_assist_hash(const uint8_t *code, uint16_t len) {
+  uint32_t hash = FNV_BASIS;
+
+  while (len--)
+    hash = (hash ^ *code++) * FNV_PRIME;
+  return (hash);
+}
+
+static uint32_t assist_guest_hash(wd16_cpu_state_t* wd16_cpu_state, uint16_t addr, uint16_t len) {
+  uint32_t hash = FNV_BASIS;
+  unsigned char byte;
+
+  while (len--) {
+    wd16_cpu_state->getAMbyte(&byte, addr++);
+    hash = (hash ^ byte) * FNV_PRIME;
+  }
+  return (hash);
+}
+
+//
+// register (or with a NULL callback, remove) the native routine for
+// one SVC.  'arg' is the argument as the monitor sees it, so SVCCs
+// counting down from 63 ("h" in cpu4_svcctxt) are already turned round
+//
+int cpu_assist_svc(wd16_cpu_state_t* wd16_cpu_state, int svc, int arg, assist_callback_t callback, void *ctx) {
+  ASSISTFN *fn;
+
+  if ((svc < ASSIST_SVCA) || (svc > ASSIST_SVCC) || (arg < 0) || (arg > 63))
+    return (false);
+  fn = &wd16_cpu_state->assist.svc[svc][arg];
+  fn->callback = NULL;
+  fn->ctx = ctx;
+  fn->callback = callback;
+  return (true);
+}
+
+int cpu_assist_svc_run(wd16_cpu_state_t* wd16_cpu_state, int svc, int arg) {
+  ASSISTFN *fn = &wd16_cpu_state->assist.svc[svc][arg & 63];
+
+  if (fn->callback == NULL)
+    return (false);
+  if (!fn->callback(wd16_cpu_state, arg, fn->ctx))
+    return (false);
+  wd16_cpu_state->assist.hits++;
+  return (true);
+}
+
+static void assist_maps(ASSIST *assist) {
+  ASSISTCODE *code;
+  int i;
+
+  memset(assist->addrmap, 0, sizeof(assist->addrmap));
+  memset(assist->wordmap, 0, sizeof(assist->wordmap));
+  assist->count = assist->anywhere = 0;
+  for (i = 0; i < MAX_ASSISTS; i++) {
+    code = &assist->code[i];
+    if (code->fn.callback == NULL)
+      continue;
+    assist->count++;
+    if (code->addr)
+      map_set(assist->addrmap, code->addr);
+    else {
+      map_set(assist->wordmap, code->first);
+      assist->anywhere++;
+    }
+  }
+}
+
+//
+// register a code assist, returns its id or -1.  with 'code' NULL the
+// routine is the 'len' bytes now in guest memory at 'addr'; otherwise
+// 'code' holds its bytes in guest order, and 'addr' 0 means match a
+// copy of them wherever it is called.
+//
+int cpu_assist_code(wd16_cpu_state_t* wd16_cpu_state, uint16_t addr, const uint8_t *code, uint16_t len, assist_callback_t callback, void *ctx) {
+  ASSIST *assist = &wd16_cpu_state->assist;
+  ASSISTCODE *entry;
+  uint16_t first;
+  int i;
+
+  if ((callback == NULL) || (len < 2) || ((code == NULL) && (addr == 0)))
+    return (-1);
+  for (i = 0; i < MAX_ASSISTS; i++)
+    if (assist->code[i].fn.callback == NULL)
+      break;
+  if (i == MAX_ASSISTS)
+    return (-1);
+
+  entry = &assist->code[i];
+  if (code) {
+    first = code[0] | (code[1] << 8);
+    entry->hash = cpu_assist_hash(code, len);
+  } else {
+    wd16_cpu_state->getAMword((unsigned char *)&first, addr);
+    entry->hash = assist_guest_hash(wd16_cpu_state, addr, len);
+  }
+  entry->addr = addr;
+  entry->len = len;
+  entry->first = first;
+  entry->hits = 0;
+  entry->fn.ctx = ctx;
+  entry->fn.callback = callback;
+  assist_maps(assist);
+  return (i);
+}
+
+void cpu_assist_remove(wd16_cpu_state_t* wd16_cpu_state, int id) {
+  if ((id < 0) || (id >= MAX_ASSISTS))
+    return;
+  wd16_cpu_state->assist.code[id].fn.callback = NULL;
+  assist_maps(&wd16_cpu_state->assist);
+}
+
+//
+// drop every code assist, e.g. when a different monitor is booted
+//
+void cpu_assist_flush(wd16_cpu_state_t* wd16_cpu_state) {
+  int i;
+
+  for (i = 0; i < MAX_ASSISTS; i++)
+    wd16_cpu_state->assist.code[i].fn.callback = NULL;
+  assist_maps(&wd16_cpu_state->assist);
+}
+
+//
+// a JSR or TCALL has just set PC to a routine's entry with 'link' as
+// the linkage register (PC for TCALL).  if an assist matches, run it
+// and return to the caller.  the maps keep the common case - no assist
+// here - to a bit test, plus one word read if relocatable assists are
+// registered.
+//
+int cpu_assist_call(wd16_cpu_state_t* wd16_cpu_state, int link) {
+  ASSIST *assist = &wd16_cpu_state->assist;
+  ASSISTCODE *entry;
+  uint16_t pc = wd16_cpu_state->regs.PC;
+  uint16_t first;
+  uint32_t hash = 0;
+  int i, hashed = -1;
+
+  if (wd16_cpu_state->regs.tracing || wd16_cpu_state->regs.stepping)
+    return (false);
+  if (!map_test(assist->addrmap, pc)) {
+    if (assist->anywhere == 0)
+      return (false);
+    wd16_cpu_state->getAMword((unsigned char *)&first, pc);
+    if (!map_test(assist->wordmap, first))
+      return (false);
+  } else
+    wd16_cpu_state->getAMword((unsigned char *)&first, pc);
+
+  for (i = 0; i < MAX_ASSISTS; i++) {
+    entry = &assist->code[i];
+    if ((entry->fn.callback == NULL) || (entry->first != first))
+      continue;
+    if (entry->addr && (entry->addr != pc))
+      continue;
+    if (entry->len != hashed) {
+      hash = assist_guest_hash(wd16_cpu_state, pc, entry->len);
+      hashed = entry->len;
+    }
+    if ((hash != entry->hash) || !entry->fn.callback(wd16_cpu_state, link, entry->fn.ctx))
+      continue;
+    entry->hits++;
+    assist->hits++;
+    // RTN link
+    wd16_cpu_state->regs.PC = wd16_cpu_state->regs.gpr[link];
+    wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.gpr[link], wd16_cpu_state->regs.SP);
+    wd16_cpu_state->regs.SP += 2;
+    return (true);
+  }
+  return (false);
+}
@@ -0,0 +1,171 @@
+/* cpu-dirty.c   (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include "cpu-dirty.h"
+
+//
+// Which guest memory has been written.  Snapshots, resets and
+// migration only need to copy what changed, so every store the core
+// makes (cpu_putAM* in wd16.h) sets the bit for its page.  Pages are
+// DIRTY_SHIFT bits, 256 bytes, small enough that a few stack pushes
+// don't drag in much.
+//
+// each consumer opens a log of its own, so a reset to a baseline and a
+// chain of delta snapshots each see every page written since they last
+// looked, whatever the other has taken.  stores set bits in one shared
+// map; a fetch moves those into every open log and then takes its own.
+//
+// the cost with a log open is one atomic OR per store; with none, a
+// test of dirty.on.  devices that write guest memory behind the core's
+// back (disk DMA completions) mark it themselves with cpu_dirty_mark()
+// or cpu_dirty_host().
+//
+
+//
+// open a log, starting clean, and start tracking if it wasn't.  the
+// caller should take its copy of memory after this and fetch changes
+// from then on.  returns the log's id, or 0 if all DIRTY_LOGS are open.
+// the CPU must be stopped (or the call made from the CPU thread).
+//
+int cpu_dirty_open(wd16_cpu_state_t* wd16_cpu_state) {
+  DIRTY *dirty = &wd16_cpu_state->dirty;
+  int i, id;
+
+  for (id = 1; id <= DIRTY_LOGS; id++)
+    if (!(dirty->used & (1 << (id - 1))))
+      break;
+  if (id > DIRTY_LOGS)
+    return (0);
+  if (!dirty->used)                       // nobody wanted these
+    cpu_dirty_fetch(wd16_cpu_state, 0, NULL);
+  for (i = 0; i < DIRTY_PAGES / 64; i++)
+    __atomic_store_n(&dirty->log[id - 1][i], 0, __ATOMIC_RELAXED);
+  __atomic_or_fetch(&dirty->used, 1 << (id - 1), __ATOMIC_ACQ_REL);
+  __atomic_store_n(&dirty->on, 1, __ATOMIC_RELEASE);
+  return (id);
+}
+
+//
+// close log 'id', stopping tracking if it was the last
+//
+void cpu_dirty_close(wd16_cpu_state_t* wd16_cpu_state, int id) {
+  DIRTY *dirty = &wd16_cpu_state->dirty;
+
+  if ((id < 1) || (id > DIRTY_LOGS))
+    return;
+  if (!__atomic_and_fetch(&dirty->used, ~(1 << (id - 1)), __ATOMIC_ACQ_REL))
+    __atomic_store_n(&dirty->on, 0, __ATOMIC_RELEASE);
+}
+
+//
+// take the pages written since log 'id' was last fetched into 'map'
+// (DIRTY_PAGES bits, page n is bit n % 64 of word n / 64) and clear
+// them, returning how many there were.  a NULL 'map' just clears.  id 0
+// only moves the shared map into the open logs.  each word is swapped
+// atomically, so a store racing with this lands in one fetch or the
+// next, never neither.
+//
+int cpu_dirty_fetch(wd16_cpu_state_t* wd16_cpu_state, int id, uint64_t *map) {
+  DIRTY *dirty = &wd16_cpu_state->dirty;
+  uint32_t used = __atomic_load_n(&dirty->used, __ATOMIC_ACQUIRE);
+  uint64_t bits;
+  int i, j, n = 0;
+
+  for (i = 0; i < DIRTY_PAGES / 64; i++) {
+    if (__atomic_load_n(&dirty->map[i], __ATOMIC_RELAXED) &&
+        (bits = __atomic_exchange_n(&dirty->map[i], 0, __ATOMIC_ACQ_REL)) != 0)
+      for (j = 0; j < DIRTY_LOGS; j++)
+        if (used & (1 << j))
+          __atomic_or_fetch(&dirty->log[j][i], bits, __ATOMIC_RELEASE);
+    if ((id < 1) || (id > DIRTY_LOGS))
+      continue;
+    bits = __atomic_exchange_n(&dirty->log[id - 1][i], 0, __ATOMIC_ACQ_REL);
+    n += __builtin_popcountll(bits);
+    if (map)
+      map[i] = bits;
+  }
+  return (n);
+}
+
+//
+// log 'id' couldn't use the pages in 'map' it fetched, so put them back
+// for its next fetch
+//
+void cpu_dirty_unfetch(wd16_cpu_state_t* wd16_cpu_state, int id, const uint64_t *map) {
+  DIRTY *dirty = &wd16_cpu_state->dirty;
+  int i;
+
+  if ((id < 1) || (id > DIRTY_LOGS))
+    return;
+  for (i = 0; i < DIRTY_PAGES / 64; i++)
+    if (map[i])
+      __atomic_or_fetch(&dirty->log[id - 1][i], map[i], __ATOMIC_RELEASE);
+}
+
+//
+// the owner of log 'id' rewrote the pages in 'map' itself (restoring a
+// snapshot or a baseline): every other log has to see them as changed,
+// but its own shouldn't
+//
+void cpu_dirty_others(wd16_cpu_state_t* wd16_cpu_state, int id, const uint64_t *map) {
+  DIRTY *dirty = &wd16_cpu_state->dirty;
+  uint32_t used = __atomic_load_n(&dirty->used, __ATOMIC_ACQUIRE);
+  int i, j;
+
+  for (j = 0; j < DIRTY_LOGS; j++)
+    if ((used & (1 << j)) && (j != id - 1))
+      for (i = 0; i < DIRTY_PAGES / 64; i++)
+        if (map[i])
+          __atomic_or_fetch(&dirty->log[j][i], map[i], __ATOMIC_RELEASE);
+}
+
+//
+// guest 'addr'..'addr'+'len'-1 was written other than through the core
+//
+void cpu_dirty_mark(wd16_cpu_state_t* wd16_cpu_state, uint32_t addr, uint32_t len) {
+  if (__atomic_load_n(&wd16_cpu_state->dirty.on, __ATOMIC_ACQUIRE) && len)
+    cpu_dirty(wd16_cpu_state, addr, len);
+}
+
+//
+// as cpu_dirty_mark(), for a host pointer into a registered region
+// (cpu_mem_region()); anything outside them isn't guest memory we
+// could copy anyway.
+//
+void cpu_dirty_host(wd16_cpu_state_t* wd16_cpu_state, const void *host, uint32_t len) {
+  MEMMAP *mem = &wd16_cpu_state->mem;
+  const uint8_t *p = host;
+  REGION *region;
+  int i;
+
+  for (i = 0; i < mem->count; i++) {
+    region = &mem->region[i];
+    if ((p >= region->host) && (p < region->host + region->size)) {
+      cpu_dirty_mark(wd16_cpu_state, region->base + (p - region->host), len);
+      return;
+    }
+  }
+}
@@ -0,0 +1,258 @@
+/* cpu-event.c   (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include "cpu-event.h"
+#include "cpu-pace.h"
+#include "cpu-rr.h"
+
+//
+// Devices schedule work in terms of emulated instructions instead of
+// host time, so a device model can run on the CPU thread and see the
+// same interrupt timing on every run.  The run loop only compares
+// instcount against events.next; everything else happens here.
+//
+// Apart from cpu_event_kick(), these must be called from the CPU
+// thread (an event callback, an assist..) or while the CPU is stopped.
+//
+
+#define before(q, a, b)                                                        \
+  ((q->slot[a].when < q->slot[b].when) ||                                      \
+   ((q->slot[a].when == q->slot[b].when) && (q->slot[a].seq < q->slot[b].seq)))
+
+// an id is the slot and its generation, which wraps before the id
+// would go negative
+#define event_id(e, i) ((int)((((e)->gen & 0x7FFFFF) << 8) | (i)))
+
+static void heap_swap(EVENTQ *q, int i, int j) {
+  int t = q->heap[i];
+
+  q->heap[i] = q->heap[j];
+  q->heap[j] = t;
+  q->slot[q->heap[i]].heap = i;
+  q->slot[q->heap[j]].heap = j;
+}
+
+static void heap_up(EVENTQ *q, int i) {
+  while ((i > 0) && before(q, q->heap[i], q->heap[(i - 1) / 2])) {
+    heap_swap(q, i, (i - 1) / 2);
+    i = (i - 1) / 2;
+  }
+}
+
+static void heap_down(EVENTQ *q, int i) {
+  int c;
+
+  for (;;) {
+    c = 2 * i + 1;
+    if (c >= q->count)
+      break;
+    if ((c + 1 < q->count) && before(q, q->heap[c + 1], q->heap[c]))
+      c++;
+    if (!before(q, q->heap[c], q->heap[i]))
+      break;
+    heap_swap(q, i, c);
+    i = c;
+  }
+}
+
+static void heap_remove(EVENTQ *q, int i) {
+  q->slot[q->heap[i]].heap = -1;
+  if (i != --q->count) {
+    q->heap[i] = q->heap[q->count];
+    q->slot[q->heap[i]].heap = i;
+    heap_up(q, i);
+    heap_down(q, i);
+  }
+}
+
+//
+// recompute the run loop deadline.  the pacing governor is folded in
+// here so the loop still has only the one compare.  pace.next is read
+// again after the store because cpu_pace_set() may change it from
+// another thread (see cpu_event_kick).
+//
+static void event_next(wd16_cpu_state_t* wd16_cpu_state) {
+  EVENTQ *q = &wd16_cpu_state->events;
+  uint64_t next, pace;
+
+  next = q->count ? q->slot[q->heap[0]].when : UINT64_MAX;
+  pace = __atomic_load_n(&wd16_cpu_state->pace.next, __ATOMIC_SEQ_CST);
+  if (pace < next)
+    next = pace;
+  __atomic_store_n(&q->next, next, __ATOMIC_SEQ_CST);
+  pace = __atomic_load_n(&wd16_cpu_state->pace.next, __ATOMIC_SEQ_CST);
+  if (pace < next)
+    __atomic_store_n(&q->next, pace, __ATOMIC_SEQ_CST);
+}
+
+static int event_add(wd16_cpu_state_t* wd16_cpu_state, uint64_t delay, event_callback_t callback, void *arg, int level) {
+  EVENTQ *q = &wd16_cpu_state->events;
+  EVENT *e;
+  int i;
+
+  if (q->count == 0)                          // (re)initialise free slots
+    for (i = 0; i < MAX_EVENTS; i++)
+      q->slot[i].heap = -1;
+  for (i = 0; i < MAX_EVENTS; i++)
+    if (q->slot[i].heap < 0)
+      break;
+  if (i == MAX_EVENTS)
+    return (-1);
+
+  e = &q->slot[i];
+  e->when = wd16_cpu_state->regs.instcount + delay;
+  e->seq = q->seq++;
+  e->callback = callback;
+  e->arg = arg;
+  e->level = level;
+  e->gen++;
+  e->heap = q->count;
+  q->heap[q->count++] = i;
+  heap_up(q, e->heap);
+  if (e->when < q->next)
+    q->next = e->when;
+
+  return (event_id(e, i));
+}
+
+//
+// call 'callback(arg)' once 'delay' instructions from now.  returns an
+// id for cpu_event_cancel(), or -1 if the queue is full.
+//
+int cpu_event_schedule(wd16_cpu_state_t* wd16_cpu_state, uint64_t delay, event_callback_t callback, void *arg) {
+  return (event_add(wd16_cpu_state, delay, callback, arg, -1));
+}
+
+//
+// raise interrupt 'level' (0=nv, 1-8 vectored) 'delay' instructions
+// from now.
+//
+int cpu_event_raise(wd16_cpu_state_t* wd16_cpu_state, uint64_t delay, int level) {
+  if ((level < 0) || (level > 8))
+    return (-1);
+  return (event_add(wd16_cpu_state, delay, NULL, NULL, level));
+}
+
+void cpu_event_cancel(wd16_cpu_state_t* wd16_cpu_state, int id) {
+  EVENTQ *q = &wd16_cpu_state->events;
+  EVENT *e;
+
+  if ((id < 0) || ((id & 255) >= MAX_EVENTS))
+    return;
+  e = &q->slot[id & 255];
+  if ((e->heap < 0) || (event_id(e, id & 255) != id))
+    return;
+  heap_remove(q, e->heap);
+}
+
+//
+// instcount has been set to a new value (a snapshot restored): keep
+// each event the same number of instructions away
+//
+void cpu_event_rebase(wd16_cpu_state_t* wd16_cpu_state, uint64_t from) {
+  EVENTQ *q = &wd16_cpu_state->events;
+  EVENT *e;
+  int i;
+
+  for (i = 0; i < q->count; i++) {
+    e = &q->slot[q->heap[i]];
+    e->when = (e->when > from) ? wd16_cpu_state->regs.instcount + (e->when - from) : wd16_cpu_state->regs.instcount;
+  }
+  event_next(wd16_cpu_state);
+}
+
+//
+// make the run loop call cpu_event_run() at the next instruction.
+// this one is safe from any thread.
+//
+void cpu_event_kick(wd16_cpu_state_t* wd16_cpu_state) {
+  __atomic_store_n(&wd16_cpu_state->events.next, 0, __ATOMIC_SEQ_CST);
+}
+
+//
+// with warp on the host promises that every interrupt source is a
+// scheduled event, so idle time can be skipped instead of slept
+// through.  (the pacing governor, if on, still turns the skipped
+// instructions back into host time.)
+//
+void cpu_event_warp(wd16_cpu_state_t* wd16_cpu_state, int warp) {
+  wd16_cpu_state->events.warp = warp;
+}
+
+//
+// called by WFI when nothing is pending.  jumps instcount straight to
+// the next event deadline, as if WFI had looped until then, and
+// returns true; returns false if the caller has to wait in host time.
+//
+int cpu_event_idle(wd16_cpu_state_t* wd16_cpu_state) {
+  EVENTQ *q = &wd16_cpu_state->events;
+  uint64_t when;
+
+  if (!q->warp || (q->count == 0))
+    return (false);
+  when = q->slot[q->heap[0]].when;
+  if (when > wd16_cpu_state->regs.instcount) {
+    q->warped += when - wd16_cpu_state->regs.instcount;
+    wd16_cpu_state->regs.instcount = when;
+  }
+  return (true);
+}
+
+//
+// called from the run loop when instcount reaches events.next
+//
+void cpu_event_run(wd16_cpu_state_t* wd16_cpu_state) {
+  EVENTQ *q = &wd16_cpu_state->events;
+  event_callback_t callback;
+  void *arg;
+  EVENT *e;
+  int level;
+
+  while (q->count && (q->slot[q->heap[0]].when <= wd16_cpu_state->regs.instcount)) {
+    e = &q->slot[q->heap[0]];
+    callback = e->callback;
+    arg = e->arg;
+    level = e->level;
+    heap_remove(q, 0);                        // callback may reschedule
+    if (level >= 0) {
+      pthread_mutex_lock(&wd16_cpu_state->intlock_t);
+      if (wd16_cpu_state->rr.mode)
+        cpu_rr_raise(wd16_cpu_state, level, false);
+      else {
+        wd16_cpu_state->regs.whichint[level] = 1;
+        wd16_cpu_state->regs.intpending = 1;
+      }
+      pthread_mutex_unlock(&wd16_cpu_state->intlock_t);
+    }
+    if (callback)
+      callback(arg);
+  }
+
+  if (wd16_cpu_state->regs.instcount >= wd16_cpu_state->pace.next)
+    cpu_pace(wd16_cpu_state);
+
+  event_next(wd16_cpu_state);
+}
@@ -25,6 +25,8 @@
 /* ----------------------------------------------------------------- */
 
 #include "cpu-fmt1.h"
+#include "cpu-event.h"
+#include "cpu-svcprof.h"
 
 #define do_each(opc)                                                           \
   if (wd16_cpu_state->regs.tracing)                                                            \
@@ -112,6 +114,7 @@ void do_fmt_1(wd16_cpu_state_t* wd16_cpu_state) {
     do_each("HALT");
     wd16_cpu_state->regs.PS.I2 = 0;
     wd16_cpu_state->regs.halting = 1;
+    cpu_cover_crash(wd16_cpu_state, COVER_HALT);
     break;
   case 5:
     //      XCT             EXECUTE SINGLE INSTRUCTION
@@ -138,6 +141,8 @@ void do_fmt_1(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("XCT");
     tmp = wd16_cpu_state->regs.PS.I2;
+    if (wd16_cpu_state->svcprof)
+      cpu_svcprof_return(wd16_cpu_state, wd16_cpu_state->regs.SP);
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP += 2;
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);
@@ -149,9 +154,9 @@ void do_fmt_1(wd16_cpu_state_t* wd16_cpu_state) {
     {
       wd16_cpu_state->regs.PC += 2; /* and stacked PS should be smashed too */
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
       wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PC, 0x1E);
       wd16_cpu_state->regs.PS.I2 = 0;
     } else { /* execute_instruction will refetch op */
@@ -160,9 +165,9 @@ void do_fmt_1(wd16_cpu_state_t* wd16_cpu_state) {
       execute_instruction();
       wd16_cpu_state->regs.trace = 0;
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
       wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PC, 0x20);
     }
     break;
@@ -179,9 +184,9 @@ void do_fmt_1(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("BPT");
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PC, 0x2C);
     break;
   case 7:
@@ -197,7 +202,12 @@ void do_fmt_1(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("WFI");
     if (wd16_cpu_state->regs.intpending != 1) {
-      usleep(500);
+      if (!cpu_event_idle(wd16_cpu_state)) {
+        // with no event to come either, only a device can end the wait;
+        // wd16_run_until() can stop on it
+        wd16_cpu_state->idle = (wd16_cpu_state->events.count == 0);
+        cpu_wait(500000);
+      }
       wd16_cpu_state->regs.PS.I2 = 0;
       wd16_cpu_state->regs.PC -= 2;
     }
@@ -228,6 +238,8 @@ void do_fmt_1(wd16_cpu_state_t* wd16_cpu_state) {
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.R5, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP += 2;
     wd16_cpu_state->regs.SP += 2;
+    if (wd16_cpu_state->svcprof)
+      cpu_svcprof_return(wd16_cpu_state, wd16_cpu_state->regs.SP);
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP += 2;
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);
@@ -256,6 +268,8 @@ void do_fmt_1(wd16_cpu_state_t* wd16_cpu_state) {
     wd16_cpu_state->regs.SP += 2;
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.R5, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP += 2;
+    if (wd16_cpu_state->svcprof)
+      cpu_svcprof_return(wd16_cpu_state, wd16_cpu_state->regs.SP);
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP += 2;
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);
@@ -276,17 +290,17 @@ void do_fmt_1(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("SAVE");
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R5, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R5, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R4, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R4, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R3, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R3, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R2, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R2, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R1, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R1, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R0, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R0, wd16_cpu_state->regs.SP);
     break;
   case 11:
     //      SAVS            SAVE STATUS
@@ -309,22 +323,22 @@ void do_fmt_1(wd16_cpu_state_t* wd16_cpu_state) {
     wd16_cpu_state->regs.PC += 2;
     do_each("SAVS"); /* done here so 'mask' avail */
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R5, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R5, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R4, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R4, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R3, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R3, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R2, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R2, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R1, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R1, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R0, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R0, wd16_cpu_state->regs.SP);
     wd16_cpu_state->getAMword((unsigned char *)&oldmask, 0x2E);
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&oldmask, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&oldmask, wd16_cpu_state->regs.SP);
     oldmask = mask | oldmask;
-    wd16_cpu_state->putAMword((unsigned char *)&oldmask, 0x2E);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&oldmask, 0x2E);
     // --------------   mask0?
     wd16_cpu_state->regs.PS.I2 = 1;
     break;
@@ -378,6 +392,8 @@ void do_fmt_1(wd16_cpu_state_t* wd16_cpu_state) {
     wd16_cpu_state->regs.SP += 2;
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.R5, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP += 2;
+    if (wd16_cpu_state->svcprof)
+      cpu_svcprof_return(wd16_cpu_state, wd16_cpu_state->regs.SP);
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP += 2;
     break;
@@ -398,7 +414,7 @@ void do_fmt_1(wd16_cpu_state_t* wd16_cpu_state) {
     do_each("RSTS");
     wd16_cpu_state->getAMword((unsigned char *)&mask, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP += 2;
-    wd16_cpu_state->putAMword((unsigned char *)&mask, 0x2E);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&mask, 0x2E);
     // --------------   mask0?
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.R0, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP += 2;
@@ -412,6 +428,8 @@ void do_fmt_1(wd16_cpu_state_t* wd16_cpu_state) {
     wd16_cpu_state->regs.SP += 2;
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.R5, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP += 2;
+    if (wd16_cpu_state->svcprof)
+      cpu_svcprof_return(wd16_cpu_state, wd16_cpu_state->regs.SP);
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP += 2;
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);
@@ -430,6 +448,8 @@ void do_fmt_1(wd16_cpu_state_t* wd16_cpu_state) {
     //                      C = Set per PS bit 0
     //
     do_each("RTT");
+    if (wd16_cpu_state->svcprof)
+      cpu_svcprof_return(wd16_cpu_state, wd16_cpu_state->regs.SP);
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP += 2;
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);
@@ -96,7 +96,7 @@ void do_fmt_10(wd16_cpu_state_t* wd16_cpu_state) {
     tmp2 = wd16_cpu_state->getAMwordBYmode(dreg, dmode, n2word);
     tmp3 = itmp = tmp + tmp2;
     wd16_cpu_state->undAMwordBYmode(dreg, dmode);
-    wd16_cpu_state->putAMwordBYmode(dreg, dmode, n2word, tmp3);
+    cpu_putAMwordBYmode(wd16_cpu_state, dreg, dmode, n2word, tmp3);
     wd16_cpu_state->regs.PS.N = (tmp3 >> 15) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp3 == 0)
@@ -133,7 +133,7 @@ void do_fmt_10(wd16_cpu_state_t* wd16_cpu_state) {
     tmp2 = wd16_cpu_state->getAMwordBYmode(dreg, dmode, n2word);
     tmp3 = itmp = tmp2 - tmp;
     wd16_cpu_state->undAMwordBYmode(dreg, dmode);
-    wd16_cpu_state->putAMwordBYmode(dreg, dmode, n2word, tmp3);
+    cpu_putAMwordBYmode(wd16_cpu_state, dreg, dmode, n2word, tmp3);
     wd16_cpu_state->regs.PS.N = (tmp3 >> 15) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp3 == 0)
@@ -167,7 +167,7 @@ void do_fmt_10(wd16_cpu_state_t* wd16_cpu_state) {
     tmp2 = wd16_cpu_state->getAMwordBYmode(dreg, dmode, n2word);
     tmp3 = tmp2 & tmp;
     wd16_cpu_state->undAMwordBYmode(dreg, dmode);
-    wd16_cpu_state->putAMwordBYmode(dreg, dmode, n2word, tmp3);
+    cpu_putAMwordBYmode(wd16_cpu_state, dreg, dmode, n2word, tmp3);
     wd16_cpu_state->regs.PS.N = (tmp3 >> 15) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp3 == 0)
@@ -197,7 +197,7 @@ void do_fmt_10(wd16_cpu_state_t* wd16_cpu_state) {
     tmp2 = wd16_cpu_state->getAMwordBYmode(dreg, dmode, n2word);
     tmp3 = (~tmp) & tmp2;
     wd16_cpu_state->undAMwordBYmode(dreg, dmode);
-    wd16_cpu_state->putAMwordBYmode(dreg, dmode, n2word, tmp3);
+    cpu_putAMwordBYmode(wd16_cpu_state, dreg, dmode, n2word, tmp3);
     wd16_cpu_state->regs.PS.N = (tmp3 >> 15) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp3 == 0)
@@ -225,7 +225,7 @@ void do_fmt_10(wd16_cpu_state_t* wd16_cpu_state) {
     tmp2 = wd16_cpu_state->getAMwordBYmode(dreg, dmode, n2word);
     tmp3 = tmp2 | tmp;
     wd16_cpu_state->undAMwordBYmode(dreg, dmode);
-    wd16_cpu_state->putAMwordBYmode(dreg, dmode, n2word, tmp3);
+    cpu_putAMwordBYmode(wd16_cpu_state, dreg, dmode, n2word, tmp3);
     wd16_cpu_state->regs.PS.N = (tmp3 >> 15) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp3 == 0)
@@ -255,7 +255,7 @@ void do_fmt_10(wd16_cpu_state_t* wd16_cpu_state) {
     tmp2 = wd16_cpu_state->getAMwordBYmode(dreg, dmode, n2word);
     tmp3 = tmp2 ^ tmp;
     wd16_cpu_state->undAMwordBYmode(dreg, dmode);
-    wd16_cpu_state->putAMwordBYmode(dreg, dmode, n2word, tmp3);
+    cpu_putAMwordBYmode(wd16_cpu_state, dreg, dmode, n2word, tmp3);
     wd16_cpu_state->regs.PS.N = (tmp3 >> 15) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp3 == 0)
@@ -344,7 +344,7 @@ void do_fmt_10(wd16_cpu_state_t* wd16_cpu_state) {
       wd16_cpu_state->getAMword((unsigned char *)&n2word, wd16_cpu_state->regs.PC);
       wd16_cpu_state->regs.PC += 2;
     }
-    wd16_cpu_state->putAMwordBYmode(dreg, dmode, n2word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, dreg, dmode, n2word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 15) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -417,7 +417,7 @@ void do_fmt_10(wd16_cpu_state_t* wd16_cpu_state) {
       wd16_cpu_state->getAMword((unsigned char *)&n2word, wd16_cpu_state->regs.PC);
       wd16_cpu_state->regs.PC += 2;
     }
-    wd16_cpu_state->putAMbyteBYmode(dreg, dmode, n2word, tmp);
+    cpu_putAMbyteBYmode(wd16_cpu_state, dreg, dmode, n2word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 7) & 1;
     if (dmode == 0) {
       wd16_cpu_state->regs.gpr[dreg] &= 0xff;
@@ -450,7 +450,7 @@ void do_fmt_10(wd16_cpu_state_t* wd16_cpu_state) {
     tmp2 = wd16_cpu_state->getAMbyteBYmode(dreg, dmode, n2word);
     tmp3 = tmp2 | tmp;
     wd16_cpu_state->undAMbyteBYmode(dreg, dmode);
-    wd16_cpu_state->putAMbyteBYmode(dreg, dmode, n2word, tmp3);
+    cpu_putAMbyteBYmode(wd16_cpu_state, dreg, dmode, n2word, tmp3);
     wd16_cpu_state->regs.PS.N = (tmp3 >> 7) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp3 == 0)
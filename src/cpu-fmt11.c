@@ -138,10 +138,11 @@ int afp_put(
 /*-------------------------------------------------------------------*/
 #define FP_trap                                                                \
   wd16_cpu_state->regs.SP -= 2;                                                                \
-  wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);                               \
+  cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);                               \
   wd16_cpu_state->regs.SP -= 2;                                                                \
-  wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);                               \
-  wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PC, 0x3E);
+  cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);                               \
+  wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PC, 0x3E);       \
+  cpu_cover_crash(wd16_cpu_state, COVER_FPTRAP);
 
 /*-------------------------------------------------------------------*/
 /* Fmt 11 entry for floating point instructions          */
@@ -293,7 +294,7 @@ void do_fmt_11(wd16_cpu_state_t* wd16_cpu_state) {
   wd16_cpu_state->getAMword((unsigned char *)&afp_s.words.AFP_1, saddr);
   if (op11 == 1) {
     afp_s.words.AFP_1.S = ~afp_s.words.AFP_1.S;
-    wd16_cpu_state->putAMword((unsigned char *)&afp_s.words.AFP_1, saddr);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&afp_s.words.AFP_1, saddr);
   }
   wd16_cpu_state->getAMword((unsigned char *)&afp_s.words.AFP_2, saddr + 2);
   wd16_cpu_state->getAMword((unsigned char *)&afp_s.words.AFP_3, saddr + 4);
@@ -352,9 +353,9 @@ void do_fmt_11(wd16_cpu_state_t* wd16_cpu_state) {
       FP_trap;
       break;
     }
-    wd16_cpu_state->putAMword((unsigned char *)&afp_r.words.AFP_1, daddr);
-    wd16_cpu_state->putAMword((unsigned char *)&afp_r.words.AFP_2, daddr + 2);
-    wd16_cpu_state->putAMword((unsigned char *)&afp_r.words.AFP_3, daddr + 4);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&afp_r.words.AFP_1, daddr);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&afp_r.words.AFP_2, daddr + 2);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&afp_r.words.AFP_3, daddr + 4);
     if (oflg < 0) {
       wd16_cpu_state->regs.PS.N = wd16_cpu_state->regs.PS.V = 1;
       FP_trap;
@@ -388,9 +389,9 @@ void do_fmt_11(wd16_cpu_state_t* wd16_cpu_state) {
       FP_trap;
       break;
     }
-    wd16_cpu_state->putAMword((unsigned char *)&afp_r.words.AFP_1, daddr);
-    wd16_cpu_state->putAMword((unsigned char *)&afp_r.words.AFP_2, daddr + 2);
-    wd16_cpu_state->putAMword((unsigned char *)&afp_r.words.AFP_3, daddr + 4);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&afp_r.words.AFP_1, daddr);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&afp_r.words.AFP_2, daddr + 2);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&afp_r.words.AFP_3, daddr + 4);
     if (oflg < 0) {
       wd16_cpu_state->regs.PS.N = wd16_cpu_state->regs.PS.V = 1;
       FP_trap;
@@ -430,9 +431,9 @@ void do_fmt_11(wd16_cpu_state_t* wd16_cpu_state) {
       FP_trap;
       break;
     }
-    wd16_cpu_state->putAMword((unsigned char *)&afp_r.words.AFP_1, daddr);
-    wd16_cpu_state->putAMword((unsigned char *)&afp_r.words.AFP_2, daddr + 2);
-    wd16_cpu_state->putAMword((unsigned char *)&afp_r.words.AFP_3, daddr + 4);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&afp_r.words.AFP_1, daddr);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&afp_r.words.AFP_2, daddr + 2);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&afp_r.words.AFP_3, daddr + 4);
     if (oflg < 0) {
       wd16_cpu_state->regs.PS.N = wd16_cpu_state->regs.PS.V = 1;
       FP_trap;
@@ -475,10 +476,10 @@ void do_fmt_11(wd16_cpu_state_t* wd16_cpu_state) {
     break;
   } /* end switch(op11) */
 
-  wd16_cpu_state->putAMword((unsigned char *)&daddr, 0x30); // fill 'save area'...
-  wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.SP, 0x32);
-  wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.PC, 0x34);
-  wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R0, 0x36);
-  wd16_cpu_state->putAMword((unsigned char *)&saddr, 0x38); /* real doesn't def... */
+  cpu_putAMword(wd16_cpu_state, (unsigned char *)&daddr, 0x30); // fill 'save area'...
+  cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.SP, 0x32);
+  cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.PC, 0x34);
+  cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R0, 0x36);
+  cpu_putAMword(wd16_cpu_state, (unsigned char *)&saddr, 0x38); /* real doesn't def... */
 
 } /* end function do_fmt_11 */
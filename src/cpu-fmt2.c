@@ -77,6 +77,7 @@ void do_fmt_2(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("RTN");
     wd16_cpu_state->regs.PC = wd16_cpu_state->regs.gpr[reg];
+    cpu_cover(wd16_cpu_state, wd16_cpu_state->regs.PC);
     wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.gpr[reg], wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.SP += 2;
     break;
@@ -92,7 +93,7 @@ void do_fmt_2(wd16_cpu_state_t* wd16_cpu_state) {
     //      INDICTORS:      Unchanged
     //
     do_each("MSKO");
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.gpr[reg], 0x2E);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.gpr[reg], 0x2E);
     // ??? mask out ???
     break;
   case 5:
@@ -26,6 +26,8 @@
 
 #include "am-ddb.h"
 #include "cpu-fmt4.h"
+#include "cpu-assist.h"
+#include "cpu-svcprof.h"
 
 #define do_each(opc)                                                           \
   if (wd16_cpu_state->regs.tracing) {                                                          \
@@ -75,14 +77,17 @@ void do_fmt_4(wd16_cpu_state_t* wd16_cpu_state) {
     do_each("SVCA");
     if (!svca_assist(wd16_cpu_state,arg)) {
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
       wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PC, 0x22);
       wd16_cpu_state->regs.PC += arg * 2;
       wd16_cpu_state->getAMword((unsigned char *)&tmpa, wd16_cpu_state->regs.PC);
       wd16_cpu_state->regs.PC += tmpa;
-    }
+      if (wd16_cpu_state->svcprof)
+        cpu_svcprof_call(wd16_cpu_state, ASSIST_SVCA, arg, wd16_cpu_state->regs.SP);
+    } else if (wd16_cpu_state->svcprof)
+      cpu_svcprof_call(wd16_cpu_state, ASSIST_SVCA, arg, 0);
     break;
   case 2:
     //      SVCB            SUPERVISOR CALL "B"
@@ -112,28 +117,31 @@ void do_fmt_4(wd16_cpu_state_t* wd16_cpu_state) {
     if (!svcb_assist(wd16_cpu_state,arg)) {
       tmpa = wd16_cpu_state->regs.SP;
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
       tmpb = wd16_cpu_state->regs.SP;
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&tmpa, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&tmpa, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R5, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R5, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R4, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R4, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R3, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R3, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R2, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R2, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R1, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R1, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R0, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R0, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.R1 = tmpb;
       wd16_cpu_state->regs.R5 = arg * 2;
       wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PC, 0x24);
-    }
+      if (wd16_cpu_state->svcprof)
+        cpu_svcprof_call(wd16_cpu_state, ASSIST_SVCB, arg, tmpb);
+    } else if (wd16_cpu_state->svcprof)
+      cpu_svcprof_call(wd16_cpu_state, ASSIST_SVCB, arg, 0);
     break;
   case 3:
     //      SVCC            SUPERVISOR CALL "C"
@@ -145,28 +153,31 @@ void do_fmt_4(wd16_cpu_state_t* wd16_cpu_state) {
     if (!svcc_assist(wd16_cpu_state,arg)) {
       tmpa = wd16_cpu_state->regs.SP;
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.PS, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.PC, wd16_cpu_state->regs.SP);
       tmpb = wd16_cpu_state->regs.SP;
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&tmpa, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&tmpa, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R5, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R5, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R4, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R4, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R3, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R3, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R2, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R2, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R1, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R1, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.SP -= 2;
-      wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.R0, wd16_cpu_state->regs.SP);
+      cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.R0, wd16_cpu_state->regs.SP);
       wd16_cpu_state->regs.R1 = tmpb;
       wd16_cpu_state->regs.R5 = arg * 2;
       wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.PC, 0x26);
-    }
+      if (wd16_cpu_state->svcprof)
+        cpu_svcprof_call(wd16_cpu_state, ASSIST_SVCC, arg, tmpb);
+    } else if (wd16_cpu_state->svcprof)
+      cpu_svcprof_call(wd16_cpu_state, ASSIST_SVCC, arg, 0);
     break;
   default:
     assert("cpu-fmt4.c - invalid return from fmt_4 lookup");
@@ -180,89 +191,128 @@ void do_fmt_4(wd16_cpu_state_t* wd16_cpu_state) {
 // they return 'true'  if they handled the call,
 //             'false' if the AMOS monitor service routine is to be used
 //
+// a native routine the host registered with cpu_assist_svc() comes
+// first, then the built in ones below, found by table not by testing
+// each argument in turn.
+//
 
-int svca_assist(wd16_cpu_state_t* wd16_cpu_state,int arg) {
-  if (arg == 9) { // turn off user trace on exit...
-    if (wd16_cpu_state->regs.utrace) {
-      wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.utRX, 0x4E); // JOBCUR
-      if (wd16_cpu_state->regs.utR0 == wd16_cpu_state->regs.utRX) {
-        wd16_cpu_state->regs.tracing = false;
-        wd16_cpu_state->regs.utrace = false;
-      }
+static int svca_utrace_exit(wd16_cpu_state_t* wd16_cpu_state, int arg, void *ctx) {
+  if (wd16_cpu_state->regs.utrace) { // turn off user trace on exit...
+    wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.utRX, 0x4E); // JOBCUR
+    if (wd16_cpu_state->regs.utR0 == wd16_cpu_state->regs.utRX) {
+      wd16_cpu_state->regs.tracing = false;
+      wd16_cpu_state->regs.utrace = false;
     }
   }
   return (false);
 }
 
-int svcb_assist(wd16_cpu_state_t* wd16_cpu_state,int arg) { return (false); }
+static int svcc_vdkdvr(wd16_cpu_state_t* wd16_cpu_state, int arg, void *ctx) {
+  vdkdvr(); // entry to virtual disk driver
+  return (true);
+}
+
+static int svcc_trace_off(wd16_cpu_state_t* wd16_cpu_state, int arg, void *ctx) {
+  wd16_cpu_state->regs.tracing = false;
+  wd16_cpu_state->regs.stepping = false;
+  return (true);
+}
+
+static int svcc_trace_on(wd16_cpu_state_t* wd16_cpu_state, int arg, void *ctx) {
+  wd16_cpu_state->regs.tracing = true;
+  return (true);
+}
+
+static int svcc_utrace_on(wd16_cpu_state_t* wd16_cpu_state, int arg, void *ctx) {
+  if (!wd16_cpu_state->regs.utrace)
+    wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.utR0, 0x4E); // JOBCUR
+  wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.utPC, 0x46);   // MEMBAS
+  wd16_cpu_state->regs.utrace = true;
+  wd16_cpu_state->regs.tracing = true;
+  wd16_cpu_state->regs.R0 = wd16_cpu_state->regs.utR0;
+  return (true);
+}
+
+static int svcc_utrace_off(wd16_cpu_state_t* wd16_cpu_state, int arg, void *ctx) {
+  wd16_cpu_state->regs.utrace = false;
+  wd16_cpu_state->regs.tracing = false;
+  wd16_cpu_state->regs.stepping = false;
+  return (true);
+}
+
+static int svcc_step_on(wd16_cpu_state_t* wd16_cpu_state, int arg, void *ctx) {
+  wd16_cpu_state->regs.tracing = true;
+  wd16_cpu_state->regs.stepping = true;
+  fprintf(stderr, "\n\rYou have entered single step mode.  ");
+  fprintf(stderr, "ALT-S to step.  ");
+  fprintf(stderr, "ALT-R to resume..\n\r");
+  return (true);
+}
+
+static int svcc_snap_job(wd16_cpu_state_t* wd16_cpu_state, int arg, void *ctx) {
+  uint16_t LINK, R0, SIZE; // snap JOBBAS thru JOBSIZ to trace
+  wd16_cpu_state->getAMword((unsigned char *)&R0, 0x4E);      // JOBCUR
+  wd16_cpu_state->getAMword((unsigned char *)&LINK, R0 + 12); // JOBBAS
+  wd16_cpu_state->getAMword((unsigned char *)&SIZE, R0 + 14); // JOBSIZ
+  fprintf(stderr, "\n\r<><>SVCC 7 memory dump<><>\n\r");
+  config_memdump(LINK, SIZE);
+  return (true);
+}
+
+// SVCC 8 was a special snap of a particular memory block to trace:
+//      uint16_t LINK, R0, SIZE;
+//      wd16_cpu_state->getAMword((unsigned char *)&R0,   0x4E);  // JOBCUR
+//      wd16_cpu_state->getAMword((unsigned char *)&LINK, R0+12); // JOBBAS
+//      fprintf(stderr,"\n\r<><>SVCC 8 memory dump<><>\n\r");
+//        wd16_cpu_state->getAMword((unsigned char *)&SIZE, LINK); LINK += SIZE; // s.b.
+//        link=464e wd16_cpu_state->getAMword((unsigned char *)&SIZE, LINK); LINK += SIZE; //
+//        s.b. link=4858 wd16_cpu_state->getAMword((unsigned char *)&SIZE, LINK); LINK +=
+//        SIZE; // s.b. link=4a62 wd16_cpu_state->getAMword((unsigned char *)&SIZE, LINK);
+//        LINK += SIZE; // s.b. link=4c6c wd16_cpu_state->getAMword((unsigned char *)&SIZE,
+//        LINK); // s.b. LINK= 4c6c, SIZE = 20e
+//      config_memdump(LINK, SIZE);
+//      return(true);
+
+static int svcc_shutdown(wd16_cpu_state_t* wd16_cpu_state, int arg, void *ctx) {
+  wd16_cpu_state->regs.halting = true; // shutdown!
+  return (true);
+}
+
+static const assist_callback_t svca_builtin[64] = {
+  [9] = svca_utrace_exit,
+};
+
+static const assist_callback_t svcc_builtin[64] = {
+  [0] = svcc_vdkdvr,
+  [1] = svcc_trace_off,
+  [2] = svcc_trace_on,
+  [4] = svcc_utrace_on,
+  [5] = svcc_utrace_off,
+  [6] = svcc_step_on,
+  [7] = svcc_snap_job,
+  [9] = svcc_shutdown,
+};
+
+int svca_assist(wd16_cpu_state_t* wd16_cpu_state,int arg) {
+  if (cpu_assist_svc_run(wd16_cpu_state, ASSIST_SVCA, arg))
+    return (true);
+  if (svca_builtin[arg])
+    return (svca_builtin[arg](wd16_cpu_state, arg, NULL));
+  return (false);
+}
+
+int svcb_assist(wd16_cpu_state_t* wd16_cpu_state,int arg) {
+  return (cpu_assist_svc_run(wd16_cpu_state, ASSIST_SVCB, arg));
+}
 
 int svcc_assist(wd16_cpu_state_t* wd16_cpu_state,int arg) {
 
   if (wd16_cpu_state->cpu4_svcctxt[0] == 'h')
     arg = 63 - arg;
 
-  if (arg == 0) { // entry to virtual disk driver
-    vdkdvr();
-    return (true);
-  }
-  if (arg == 1) { // turn tracing off
-    wd16_cpu_state->regs.tracing = false;
-    wd16_cpu_state->regs.stepping = false;
-    return (true);
-  }
-  if (arg == 2) { // turn tracing on
-    wd16_cpu_state->regs.tracing = true;
+  if (cpu_assist_svc_run(wd16_cpu_state, ASSIST_SVCC, arg))
     return (true);
-  }
-  if (arg == 4) { // turn user tracing on
-    if (!wd16_cpu_state->regs.utrace)
-      wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.utR0, 0x4E); // JOBCUR
-    wd16_cpu_state->getAMword((unsigned char *)&wd16_cpu_state->regs.utPC, 0x46);   // MEMBAS
-    wd16_cpu_state->regs.utrace = true;
-    wd16_cpu_state->regs.tracing = true;
-    wd16_cpu_state->regs.R0 = wd16_cpu_state->regs.utR0;
-    return (true);
-  }
-  if (arg == 5) { // turn user tracing off
-    wd16_cpu_state->regs.utrace = false;
-    wd16_cpu_state->regs.tracing = false;
-    wd16_cpu_state->regs.stepping = false;
-    return (true);
-  }
-  if (arg == 6) { // turn tracing on with stepping
-    wd16_cpu_state->regs.tracing = true;
-    wd16_cpu_state->regs.stepping = true;
-    fprintf(stderr, "\n\rYou have entered single step mode.  ");
-    fprintf(stderr, "ALT-S to step.  ");
-    fprintf(stderr, "ALT-R to resume..\n\r");
-    return (true);
-  }
-  if (arg == 7) { // snap JOBBAS thru JOBSIZ to trace
-    uint16_t LINK, R0, SIZE;
-    wd16_cpu_state->getAMword((unsigned char *)&R0, 0x4E);      // JOBCUR
-    wd16_cpu_state->getAMword((unsigned char *)&LINK, R0 + 12); // JOBBAS
-    wd16_cpu_state->getAMword((unsigned char *)&SIZE, R0 + 14); // JOBSIZ
-    fprintf(stderr, "\n\r<><>SVCC 7 memory dump<><>\n\r");
-    config_memdump(LINK, SIZE);
-    return (true);
-  }
-  // if (arg == 8) { // special snap of particular memory block to trace
-  //      uint16_t LINK, R0, SIZE;
-  //      wd16_cpu_state->getAMword((unsigned char *)&R0,   0x4E);  // JOBCUR
-  //      wd16_cpu_state->getAMword((unsigned char *)&LINK, R0+12); // JOBBAS
-  //      fprintf(stderr,"\n\r<><>SVCC 8 memory dump<><>\n\r");
-  //        wd16_cpu_state->getAMword((unsigned char *)&SIZE, LINK); LINK += SIZE; // s.b.
-  //        link=464e wd16_cpu_state->getAMword((unsigned char *)&SIZE, LINK); LINK += SIZE; //
-  //        s.b. link=4858 wd16_cpu_state->getAMword((unsigned char *)&SIZE, LINK); LINK +=
-  //        SIZE; // s.b. link=4a62 wd16_cpu_state->getAMword((unsigned char *)&SIZE, LINK);
-  //        LINK += SIZE; // s.b. link=4c6c wd16_cpu_state->getAMword((unsigned char *)&SIZE,
-  //        LINK); // s.b. LINK= 4c6c, SIZE = 20e
-  //      config_memdump(LINK, SIZE);
-  //      return(true);
-  //      }
-  if (arg == 9) { // shutdown!
-    wd16_cpu_state->regs.halting = true;
-    return (true);
-  }
+  if (svcc_builtin[arg])
+    return (svcc_builtin[arg](wd16_cpu_state, arg, NULL));
   return (false);
 }
@@ -26,11 +26,23 @@
 /* ----------------------------------------------------------------- */
 
 #include "cpu-fmt5.h"
+#include "cpu-spin.h"
+#include "am-idle.h"
 
 #define do_each(opc)                                                           \
   if (wd16_cpu_state->regs.tracing)                                                            \
     wd16_cpu_state->trace_fmt5(opc, dest);
 
+#define do_branch                                                              \
+  {                                                                            \
+    wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);            \
+    cpu_cover(wd16_cpu_state, wd16_cpu_state->regs.PC);                        \
+    if (dest < 0)                                                              \
+      if ((dest < -SPIN_POLL_WORDS) || !cpu_spin_poll(wd16_cpu_state))         \
+        if (wd16_cpu_state->amidle.on)                                         \
+          am_idle_branch(wd16_cpu_state);                                      \
+  }
+
 void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
   int op5, dest;
 
@@ -63,7 +75,7 @@ void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
     //                      is added to PC.
     //
     do_each("BR");
-    wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);
+    do_branch;
     break;
   case 2:
     //      BNE             BRANCH IF NOT EQUAL TO ZERO
@@ -73,7 +85,7 @@ void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("BNE");
     if (wd16_cpu_state->regs.PS.Z == 0)
-      wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);
+      do_branch;
     break;
   case 3:
     //      BEQ             BRANCH IF EQUAL TO ZERO
@@ -83,7 +95,7 @@ void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("BEQ");
     if (wd16_cpu_state->regs.PS.Z == 1)
-      wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);
+      do_branch;
     break;
   case 4:
     //      BGE             BRANCH IF GREATER THAN OR EQUAL TO ZERO
@@ -93,7 +105,7 @@ void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("BGE");
     if ((wd16_cpu_state->regs.PS.N ^ wd16_cpu_state->regs.PS.V) == 0)
-      wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);
+      do_branch;
     break;
   case 5:
     //      BLT             BRANCH IF LESS THAN ZERO
@@ -103,7 +115,7 @@ void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("BLT");
     if ((wd16_cpu_state->regs.PS.N ^ wd16_cpu_state->regs.PS.V) == 1)
-      wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);
+      do_branch;
     break;
   case 6:
     //      BGT             BRANCH IF GREATER THAN ZERO
@@ -113,7 +125,7 @@ void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("BGT");
     if ((wd16_cpu_state->regs.PS.Z | (wd16_cpu_state->regs.PS.N ^ wd16_cpu_state->regs.PS.V)) == 0)
-      wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);
+      do_branch;
     break;
   case 7:
     //      BLE             BRANCH IF LESS THAN or EQUAL TO ZERO
@@ -123,7 +135,7 @@ void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("BLE");
     if ((wd16_cpu_state->regs.PS.Z | (wd16_cpu_state->regs.PS.N ^ wd16_cpu_state->regs.PS.V)) == 1)
-      wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);
+      do_branch;
     break;
   case 128:
     //      BPL             BRANCH IF PLUS
@@ -133,7 +145,7 @@ void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("BPL");
     if (wd16_cpu_state->regs.PS.N == 0)
-      wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);
+      do_branch;
     break;
   case 129:
     //      BMI             BRANCH IF MINUS
@@ -143,7 +155,7 @@ void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("BMI");
     if (wd16_cpu_state->regs.PS.N == 1)
-      wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);
+      do_branch;
     break;
   case 130:
     //      BHI             BRANCH IF HIGHER
@@ -153,7 +165,7 @@ void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("BHI");
     if ((wd16_cpu_state->regs.PS.C | wd16_cpu_state->regs.PS.Z) == 0)
-      wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);
+      do_branch;
     break;
   case 131:
     //      BLOS            BRANCH IF LOWER OR SAME
@@ -163,7 +175,7 @@ void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("BLOS");
     if ((wd16_cpu_state->regs.PS.C | wd16_cpu_state->regs.PS.Z) == 1)
-      wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);
+      do_branch;
     break;
   case 132:
     //      BVC             BRANCH IF OVERFLOW CLEAR
@@ -173,7 +185,7 @@ void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("BVC");
     if (wd16_cpu_state->regs.PS.V == 0)
-      wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);
+      do_branch;
     break;
   case 133:
     //      BVS             BRANCH IF OVERFLOW SET
@@ -183,7 +195,7 @@ void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("BVS");
     if (wd16_cpu_state->regs.PS.V == 1)
-      wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);
+      do_branch;
     break;
   case 134:
     //      BCC             BRANCH IF CARRY CLEAR
@@ -195,7 +207,7 @@ void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("BCC");
     if (wd16_cpu_state->regs.PS.C == 0)
-      wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);
+      do_branch;
     break;
   case 135:
     //      BCS             BRANCH IF CARRY SET
@@ -207,7 +219,7 @@ void do_fmt_5(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("BCS");
     if (wd16_cpu_state->regs.PS.C == 1)
-      wd16_cpu_state->regs.PC = wd16_cpu_state->regs.PC + (dest * 2);
+      do_branch;
     break;
   default:
     assert("cpu-fmt5.c - invalid return from fmt_5 lookup");
@@ -25,6 +25,7 @@
 /* ----------------------------------------------------------------- */
 
 #include "cpu-fmt7.h"
+#include "cpu-assist.h"
 
 #define do_each(opc)                                                           \
   if (wd16_cpu_state->regs.tracing)                                                            \
@@ -86,7 +87,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
       tmp |= 0x8000;
     wd16_cpu_state->regs.PS.C = tmp2;
     wd16_cpu_state->undAMwordBYmode(reg, mode);
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 7) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -114,7 +115,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
       tmp |= 1;
     wd16_cpu_state->regs.PS.C = tmp2;
     wd16_cpu_state->undAMwordBYmode(reg, mode);
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 15) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -159,7 +160,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp = tmp << 1;
     wd16_cpu_state->regs.PS.C = tmp2;
     wd16_cpu_state->undAMwordBYmode(reg, mode);
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 15) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -179,7 +180,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("SET");
     tmp = -1;
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = 1;
     wd16_cpu_state->regs.PS.Z = 0;
     wd16_cpu_state->regs.PS.V = 0;
@@ -197,7 +198,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("CLR");
     tmp = 0;
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = 0;
     wd16_cpu_state->regs.PS.Z = 1;
     wd16_cpu_state->regs.PS.V = 0;
@@ -229,7 +230,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp = tmp | tmp3;
     wd16_cpu_state->regs.PS.C = tmp2;
     wd16_cpu_state->undAMwordBYmode(reg, mode);
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 7) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -254,7 +255,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp3 = (tmp & 0xff) << 8;
     tmp = tmp2 | tmp3;
     wd16_cpu_state->undAMwordBYmode(reg, mode);
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 7) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if ((tmp & 0xff) == 0)
@@ -276,7 +277,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp = wd16_cpu_state->getAMwordBYmode(reg, mode, n1word);
     tmp = (~tmp) & 0xffff;
     wd16_cpu_state->undAMwordBYmode(reg, mode);
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 15) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -299,7 +300,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp = wd16_cpu_state->getAMwordBYmode(reg, mode, n1word);
     tmp = (-tmp) & 0xffff;
     wd16_cpu_state->undAMwordBYmode(reg, mode);
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 15) & 1;
     wd16_cpu_state->regs.PS.V = 0;
     if (tmp == 0x8000)
@@ -328,7 +329,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp2 = (tmp >> 15) & 1;
     tmp = (tmp + 1) & 0xffff;
     wd16_cpu_state->undAMwordBYmode(reg, mode);
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 15) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -357,7 +358,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp2 = (tmp >> 15) & 1;
     tmp = (tmp - 1) & 0xffff;
     wd16_cpu_state->undAMwordBYmode(reg, mode);
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 15) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -388,7 +389,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     if (tmp == 0)
       wd16_cpu_state->regs.PS.C = 1;
     wd16_cpu_state->undAMwordBYmode(reg, mode);
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 15) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -410,7 +411,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp = 0;
     if (wd16_cpu_state->regs.PS.N == 1)
       tmp = 0xFFFF;
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     break;
   case 54:
     //      TCALL           TABLED SUBROUTINE CALL
@@ -440,10 +441,13 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp2 = wd16_cpu_state->regs.PC; // save return address
     tmp = wd16_cpu_state->getAMwordBYmode(reg, mode, n1word);
     wd16_cpu_state->regs.SP -= 2; // mov tmp,-(sp)
-    wd16_cpu_state->putAMword((unsigned char *)&tmp2, wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&tmp2, wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.PC += tmp; // add @pc,pc
     wd16_cpu_state->getAMword((unsigned char *)&tmp, wd16_cpu_state->regs.PC);
     wd16_cpu_state->regs.PC += tmp;
+    cpu_cover(wd16_cpu_state, wd16_cpu_state->regs.PC);
+    if (wd16_cpu_state->assist.count)
+      cpu_assist_call(wd16_cpu_state, 7);
 
     break;
   case 55:
@@ -463,6 +467,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     wd16_cpu_state->regs.PC += tmp;
     wd16_cpu_state->getAMword((unsigned char *)&tmp, wd16_cpu_state->regs.PC);
     wd16_cpu_state->regs.PC += tmp;
+    cpu_cover(wd16_cpu_state, wd16_cpu_state->regs.PC);
     break;
   case 56:
     //
@@ -499,7 +504,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
       tmp |= 0x80;
     wd16_cpu_state->regs.PS.C = tmp2;
     wd16_cpu_state->undAMbyteBYmode(reg, mode);
-    wd16_cpu_state->putAMbyteBYmode(reg, mode, n1word, tmp);
+    cpu_putAMbyteBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 7) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -527,7 +532,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
       tmp |= 1;
     wd16_cpu_state->regs.PS.C = tmp2;
     wd16_cpu_state->undAMbyteBYmode(reg, mode);
-    wd16_cpu_state->putAMbyteBYmode(reg, mode, n1word, tmp);
+    cpu_putAMbyteBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 7) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -572,7 +577,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp = (tmp << 1) & 0xff;
     wd16_cpu_state->regs.PS.C = tmp2;
     wd16_cpu_state->undAMbyteBYmode(reg, mode);
-    wd16_cpu_state->putAMbyteBYmode(reg, mode, n1word, tmp);
+    cpu_putAMbyteBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 7) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -592,7 +597,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("SETB");
     tmp = -1;
-    wd16_cpu_state->putAMbyteBYmode(reg, mode, n1word, tmp);
+    cpu_putAMbyteBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = 1;
     wd16_cpu_state->regs.PS.Z = 0;
     wd16_cpu_state->regs.PS.V = 0;
@@ -610,7 +615,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     //
     do_each("CLRB");
     tmp = 0;
-    wd16_cpu_state->putAMbyteBYmode(reg, mode, n1word, tmp);
+    cpu_putAMbyteBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = 0;
     wd16_cpu_state->regs.PS.Z = 1;
     wd16_cpu_state->regs.PS.V = 0;
@@ -641,7 +646,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp = tmp | tmp3;
     wd16_cpu_state->regs.PS.C = tmp2;
     wd16_cpu_state->undAMbyteBYmode(reg, mode);
-    wd16_cpu_state->putAMbyteBYmode(reg, mode, n1word, tmp);
+    cpu_putAMbyteBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 7) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -670,7 +675,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp3 = (tmp & 0x0f) << 4;
     tmp = tmp2 | tmp3;
     wd16_cpu_state->undAMbyteBYmode(reg, mode);
-    wd16_cpu_state->putAMbyteBYmode(reg, mode, n1word, tmp);
+    cpu_putAMbyteBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 7) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if ((tmp & 0xff) == 0)
@@ -693,7 +698,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp = wd16_cpu_state->getAMbyteBYmode(reg, mode, n1word);
     tmp = (~tmp) & 0xff;
     wd16_cpu_state->undAMbyteBYmode(reg, mode);
-    wd16_cpu_state->putAMbyteBYmode(reg, mode, n1word, tmp);
+    cpu_putAMbyteBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 7) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -716,7 +721,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp = wd16_cpu_state->getAMbyteBYmode(reg, mode, n1word);
     tmp = (-tmp) & 0xff;
     wd16_cpu_state->undAMbyteBYmode(reg, mode);
-    wd16_cpu_state->putAMbyteBYmode(reg, mode, n1word, tmp);
+    cpu_putAMbyteBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 7) & 1;
     wd16_cpu_state->regs.PS.V = 0;
     if (tmp == 0x80)
@@ -745,7 +750,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp2 = (tmp >> 7) & 1;
     tmp = (tmp + 1) & 0xff;
     wd16_cpu_state->undAMbyteBYmode(reg, mode);
-    wd16_cpu_state->putAMbyteBYmode(reg, mode, n1word, tmp);
+    cpu_putAMbyteBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 7) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -773,7 +778,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     tmp2 = (tmp >> 7) & 1;
     tmp = (tmp - 1) & 0xff;
     wd16_cpu_state->undAMbyteBYmode(reg, mode);
-    wd16_cpu_state->putAMbyteBYmode(reg, mode, n1word, tmp);
+    cpu_putAMbyteBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 7) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -809,7 +814,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     //      (DST), INDICATORS:     Unchanged
     //
     do_each("SSTS");
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, wd16_cpu_state->regs.gpr[8]);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, wd16_cpu_state->regs.gpr[8]);
     break;
   case 70:
     //      ADC             ADD CARRY
@@ -836,7 +841,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
         wd16_cpu_state->regs.PS.C = 1;
     }
     wd16_cpu_state->undAMwordBYmode(reg, mode);
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 15) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -861,7 +866,7 @@ void do_fmt_7(wd16_cpu_state_t* wd16_cpu_state) {
     if (wd16_cpu_state->regs.PS.C == 1)
       tmp--;
     wd16_cpu_state->undAMwordBYmode(reg, mode);
-    wd16_cpu_state->putAMwordBYmode(reg, mode, n1word, tmp);
+    cpu_putAMwordBYmode(wd16_cpu_state, reg, mode, n1word, tmp);
     wd16_cpu_state->regs.PS.N = (tmp >> 15) & 1;
     wd16_cpu_state->regs.PS.Z = 0;
     if (tmp == 0)
@@ -78,7 +78,7 @@ void do_fmt_8(wd16_cpu_state_t* wd16_cpu_state) {
     do_each("MBWU");
     do {
       t16 = wd16_cpu_state->getAMwordBYmode(sreg, 1, 0);
-      wd16_cpu_state->putAMwordBYmode(dreg, 1, 0, t16);
+      cpu_putAMwordBYmode(wd16_cpu_state, dreg, 1, 0, t16);
       wd16_cpu_state->regs.gpr[sreg] += 2;
       wd16_cpu_state->regs.gpr[dreg] += 2;
       wd16_cpu_state->regs.gpr[0] -= 1;
@@ -102,7 +102,7 @@ void do_fmt_8(wd16_cpu_state_t* wd16_cpu_state) {
     do_each("MBWD");
     do {
       t16 = wd16_cpu_state->getAMwordBYmode(sreg, 1, 0);
-      wd16_cpu_state->putAMwordBYmode(dreg, 1, 0, t16);
+      cpu_putAMwordBYmode(wd16_cpu_state, dreg, 1, 0, t16);
       wd16_cpu_state->regs.gpr[sreg] -= 2;
       wd16_cpu_state->regs.gpr[dreg] -= 2;
       wd16_cpu_state->regs.gpr[0] -= 1;
@@ -127,7 +127,7 @@ void do_fmt_8(wd16_cpu_state_t* wd16_cpu_state) {
     do_each("MBBU");
     do {
       t8 = wd16_cpu_state->getAMbyteBYmode(sreg, 1, 0);
-      wd16_cpu_state->putAMbyteBYmode(dreg, 1, 0, t8);
+      cpu_putAMbyteBYmode(wd16_cpu_state, dreg, 1, 0, t8);
       wd16_cpu_state->regs.gpr[sreg] += 1;
       wd16_cpu_state->regs.gpr[dreg] += 1;
       wd16_cpu_state->regs.gpr[0] -= 1;
@@ -151,7 +151,7 @@ void do_fmt_8(wd16_cpu_state_t* wd16_cpu_state) {
     do_each("MBBD");
     do {
       t8 = wd16_cpu_state->getAMbyteBYmode(sreg, 1, 0);
-      wd16_cpu_state->putAMbyteBYmode(dreg, 1, 0, t8);
+      cpu_putAMbyteBYmode(wd16_cpu_state, dreg, 1, 0, t8);
       wd16_cpu_state->regs.gpr[sreg] -= 1;
       wd16_cpu_state->regs.gpr[dreg] -= 1;
       wd16_cpu_state->regs.gpr[0] -= 1;
@@ -170,7 +170,7 @@ void do_fmt_8(wd16_cpu_state_t* wd16_cpu_state) {
     do_each("MBWA");
     do {
       t16 = wd16_cpu_state->getAMwordBYmode(sreg, 1, 0);
-      wd16_cpu_state->putAMwordBYmode(dreg, 1, 0, t16);
+      cpu_putAMwordBYmode(wd16_cpu_state, dreg, 1, 0, t16);
       wd16_cpu_state->regs.gpr[sreg] += 2;
       wd16_cpu_state->regs.gpr[0] -= 1;
     } while ((wd16_cpu_state->regs.gpr[0] != 0) & !(wd16_cpu_state->regs.PS.I2 & wd16_cpu_state->regs.intpending));
@@ -188,7 +188,7 @@ void do_fmt_8(wd16_cpu_state_t* wd16_cpu_state) {
     do_each("MBBA");
     do {
       t8 = wd16_cpu_state->getAMbyteBYmode(sreg, 1, 0);
-      wd16_cpu_state->putAMbyteBYmode(dreg, 1, 0, t8);
+      cpu_putAMbyteBYmode(wd16_cpu_state, dreg, 1, 0, t8);
       wd16_cpu_state->regs.gpr[sreg] += 1;
       wd16_cpu_state->regs.gpr[0] -= 1;
     } while ((wd16_cpu_state->regs.gpr[0] != 0) & !(wd16_cpu_state->regs.PS.I2 & wd16_cpu_state->regs.intpending));
@@ -207,7 +207,7 @@ void do_fmt_8(wd16_cpu_state_t* wd16_cpu_state) {
     do_each("MABW");
     do {
       t16 = wd16_cpu_state->getAMwordBYmode(sreg, 1, 0);
-      wd16_cpu_state->putAMwordBYmode(dreg, 1, 0, t16);
+      cpu_putAMwordBYmode(wd16_cpu_state, dreg, 1, 0, t16);
       wd16_cpu_state->regs.gpr[dreg] += 2;
       wd16_cpu_state->regs.gpr[0] -= 1;
     } while ((wd16_cpu_state->regs.gpr[0] != 0) & !(wd16_cpu_state->regs.PS.I2 & wd16_cpu_state->regs.intpending));
@@ -226,7 +226,7 @@ void do_fmt_8(wd16_cpu_state_t* wd16_cpu_state) {
     do_each("MABB");
     do {
       t8 = wd16_cpu_state->getAMbyteBYmode(sreg, 1, 0);
-      wd16_cpu_state->putAMbyteBYmode(dreg, 1, 0, t8);
+      cpu_putAMbyteBYmode(wd16_cpu_state, dreg, 1, 0, t8);
       wd16_cpu_state->regs.gpr[dreg] += 1;
       wd16_cpu_state->regs.gpr[0] -= 1;
     } while ((wd16_cpu_state->regs.gpr[0] != 0) & !(wd16_cpu_state->regs.PS.I2 & wd16_cpu_state->regs.intpending));
@@ -25,6 +25,8 @@
 /* ----------------------------------------------------------------- */
 
 #include "cpu-fmt9.h"
+#include "cpu-spin.h"
+#include "cpu-assist.h"
 
 #define do_each(opc)                                                    \
   if (wd16_cpu_state->regs.tracing) {                                   \
@@ -102,9 +104,12 @@ void do_fmt_9(wd16_cpu_state_t* wd16_cpu_state) {
     }
     /* see app c */ tmp = wd16_cpu_state->getAMaddrBYmode(dreg, dmode, n1word);
     wd16_cpu_state->regs.SP -= 2;
-    wd16_cpu_state->putAMword((unsigned char *)&wd16_cpu_state->regs.gpr[sreg], wd16_cpu_state->regs.SP);
+    cpu_putAMword(wd16_cpu_state, (unsigned char *)&wd16_cpu_state->regs.gpr[sreg], wd16_cpu_state->regs.SP);
     wd16_cpu_state->regs.gpr[sreg] = wd16_cpu_state->regs.PC;
     /* see app c */ wd16_cpu_state->regs.PC = tmp;
+    cpu_cover(wd16_cpu_state, tmp);
+    if (wd16_cpu_state->assist.count)
+      cpu_assist_call(wd16_cpu_state, sreg);
     break;
   case 1:
     //      LEA             LOAD EFFECTIVE ADDRESS
@@ -197,19 +202,9 @@ void do_fmt_9(wd16_cpu_state_t* wd16_cpu_state) {
     if (--wd16_cpu_state->regs.gpr[sreg] != 0) {
       doffset = ((dmode << 3) + dreg) << 1;
       wd16_cpu_state->regs.PC -= doffset;
+      cpu_cover(wd16_cpu_state, wd16_cpu_state->regs.PC);
       if (wd16_cpu_state->regs.PC == wd16_cpu_state->opPC)
-        if ((wd16_cpu_state->regs.PS.I2 == 1) && (wd16_cpu_state->regs.gpr[sreg] > 300)) { //
-          // if this is an interrupt enabled branch to self
-          // then cheat!  Wait a 1/100 a second and adjust
-          // register to make him think he looped for it...
-          //  ---- 4.5 monitor loop count is 400 ----
-          //
-          usleep(10000);
-          if (wd16_cpu_state->regs.gpr[sreg] <= 2000)
-            wd16_cpu_state->regs.gpr[sreg] = 1; // ~ 1500 for 2 mhz
-          else                  // ~ 2500 for 3.3 mhz
-            wd16_cpu_state->regs.gpr[sreg] -= 2000;
-        }
+        cpu_spin_sob(wd16_cpu_state, sreg); // branch to self, see cpu-spin.c
     }
     break;
   case 4:
@@ -228,7 +223,7 @@ void do_fmt_9(wd16_cpu_state_t* wd16_cpu_state) {
     wd16_cpu_state->regs.PS.C = 1;
     tmp = wd16_cpu_state->getAMwordBYmode(dreg, dmode, n1word);
     wd16_cpu_state->undAMwordBYmode(dreg, dmode);
-    wd16_cpu_state->putAMwordBYmode(dreg, dmode, n1word, wd16_cpu_state->regs.gpr[sreg]);
+    cpu_putAMwordBYmode(wd16_cpu_state, dreg, dmode, n1word, wd16_cpu_state->regs.gpr[sreg]);
     wd16_cpu_state->regs.gpr[sreg] = tmp;
     break;
   case 5:
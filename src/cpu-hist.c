@@ -0,0 +1,111 @@
+/* cpu-hist.c    (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include "cpu-hist.h"
+
+//
+// histograms with a bucket per power of two: cheap enough to update
+// on every sample and wide enough for instruction counts and host
+// nanoseconds alike.  percentiles are the top of the bucket they fall
+// in, so they are good to a factor of two, which is all a profile
+// needs to say where the time goes.
+//
+
+static int hist_bucket(uint64_t value) {
+  return (value ? 64 - __builtin_clzll(value) : 0);
+}
+
+void cpu_hist_add(HIST *hist, uint64_t value) {
+  if ((hist->count == 0) || (value < hist->min))
+    hist->min = value;
+  if (value > hist->max)
+    hist->max = value;
+  hist->count++;
+  hist->sum += value;
+  hist->bucket[hist_bucket(value)]++;
+}
+
+void cpu_hist_merge(HIST *into, const HIST *from) {
+  int i;
+
+  if (from->count == 0)
+    return;
+  if ((into->count == 0) || (from->min < into->min))
+    into->min = from->min;
+  if (from->max > into->max)
+    into->max = from->max;
+  into->count += from->count;
+  into->sum += from->sum;
+  for (i = 0; i < HIST_BUCKETS; i++)
+    into->bucket[i] += from->bucket[i];
+}
+
+uint64_t cpu_hist_percentile(const HIST *hist, double pct) {
+  uint64_t want, seen = 0, top;
+  int i;
+
+  if (hist->count == 0)
+    return (0);
+  want = (uint64_t)(hist->count * pct / 100.0);
+  if (want >= hist->count)
+    want = hist->count - 1;
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    seen += hist->bucket[i];
+    if (seen > want)
+      break;
+  }
+  top = (i == 0) ? 0 : (i == 64) ? UINT64_MAX : (1ULL << i) - 1;
+  return ((top > hist->max) ? hist->max : top);
+}
+
+//
+// one line summary, then the non-empty buckets with a bar each
+//
+void cpu_hist_dump(FILE *f, const HIST *hist, const char *unit) {
+  uint64_t peak = 0;
+  int i, lo, hi;
+
+  fprintf(f, "  n=%llu mean=%llu min=%llu p50=%llu p99=%llu max=%llu %s\n",
+          (unsigned long long)hist->count,
+          (unsigned long long)(hist->count ? hist->sum / hist->count : 0),
+          (unsigned long long)hist->min,
+          (unsigned long long)cpu_hist_percentile(hist, 50),
+          (unsigned long long)cpu_hist_percentile(hist, 99),
+          (unsigned long long)hist->max, unit);
+  for (lo = 0; (lo < HIST_BUCKETS) && !hist->bucket[lo]; lo++)
+    ;
+  for (hi = HIST_BUCKETS - 1; (hi > lo) && !hist->bucket[hi]; hi--)
+    ;
+  for (i = lo; i <= hi; i++)
+    if (hist->bucket[i] > peak)
+      peak = hist->bucket[i];
+  for (i = lo; (i <= hi) && peak; i++)
+    fprintf(f, "  %20llu %10llu %.*s\n",
+            (unsigned long long)(i ? 1ULL << (i - 1) : 0),
+            (unsigned long long)hist->bucket[i],
+            (int)(hist->bucket[i] * 40 / peak),
+            "########################################");
+}
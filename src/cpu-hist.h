@@ -0,0 +1,59 @@
+/* cpu-hist.h    (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+#ifndef __CPU_HIST_H__
+#define __CPU_HIST_H__
+
+#include "wd16.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*-------------------------------------------------------------------*/
+/* Structure definition for a log2 histogram                         */
+/*-------------------------------------------------------------------*/
+#define HIST_BUCKETS 65                 /* 0, then [2^(n-1), 2^n)    */
+
+typedef struct _HIST {                  /* Histogram                 */
+  uint64_t count;                       /* samples                   */
+  uint64_t sum;                         /* total of samples          */
+  uint64_t min;                         /* smallest, when count > 0  */
+  uint64_t max;                         /* largest                   */
+  uint64_t bucket[HIST_BUCKETS];        /* samples per power of two  */
+
+} HIST;
+
+void     cpu_hist_add(HIST *hist, uint64_t value);
+void     cpu_hist_merge(HIST *into, const HIST *from);
+uint64_t cpu_hist_percentile(const HIST *hist, double pct);
+void     cpu_hist_dump(FILE *f, const HIST *hist, const char *unit);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,111 @@
+/* cpu-mem.c     (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include "cpu-mem.h"
+
+//
+// The core only sees guest memory through the get/put callbacks, one
+// byte or word at a time.  A host whose memory is a plain array can
+// say so here, and block moves (disk transfers, mostly) then become a
+// memcpy.  Memory outside any region still goes through the callbacks,
+// so memory-mapped I/O keeps working.
+//
+
+//
+// register 'size' bytes of guest memory from 'base' as being held at
+// 'host', in guest byte order.  a NULL 'host' removes the region
+// starting at 'base'.
+//
+int cpu_mem_region(wd16_cpu_state_t* wd16_cpu_state, uint32_t base, uint32_t size, uint8_t *host) {
+  MEMMAP *mem = &wd16_cpu_state->mem;
+  int i, j;
+
+  for (i = 0; i < mem->count; i++)
+    if (mem->region[i].base == base)
+      break;
+  if (host == NULL) {
+    if (i == mem->count)
+      return (false);
+    for (j = i + 1; j < mem->count; j++)
+      mem->region[j - 1] = mem->region[j];
+    mem->count--;
+    return (true);
+  }
+  if ((i == mem->count) && (mem->count == MAX_REGIONS))
+    return (false);
+  if (i == mem->count) {
+    for (i = mem->count; (i > 0) && (mem->region[i - 1].base > base); i--)
+      mem->region[i] = mem->region[i - 1];
+    mem->count++;
+  }
+  mem->region[i].base = base;
+  mem->region[i].size = size;
+  mem->region[i].host = host;
+  return (true);
+}
+
+//
+// host address of guest 'addr'..'addr'+'len'-1, or NULL unless all of
+// it lies in one region
+//
+uint8_t *cpu_mem_host(wd16_cpu_state_t* wd16_cpu_state, uint32_t addr, uint32_t len) {
+  MEMMAP *mem = &wd16_cpu_state->mem;
+  REGION *region;
+  int i;
+
+  for (i = 0; i < mem->count; i++) {
+    region = &mem->region[i];
+    if ((addr >= region->base) && ((uint64_t)addr + len <= (uint64_t)region->base + region->size))
+      return (region->host + (addr - region->base));
+  }
+  return (NULL);
+}
+
+void cpu_mem_read(wd16_cpu_state_t* wd16_cpu_state, void *dst, uint32_t addr, uint32_t len) {
+  unsigned char *to = dst;
+  uint8_t *from = cpu_mem_host(wd16_cpu_state, addr, len);
+
+  if (from) {
+    memcpy(to, from, len);
+    return;
+  }
+  while (len--)
+    wd16_cpu_state->getAMbyte(to++, addr++);
+}
+
+void cpu_mem_write(wd16_cpu_state_t* wd16_cpu_state, uint32_t addr, const void *src, uint32_t len) {
+  unsigned char *from = (unsigned char *)src;
+  uint8_t *to = cpu_mem_host(wd16_cpu_state, addr, len);
+
+  if (to) {
+    memcpy(to, from, len);
+    if (wd16_cpu_state->dirty.on && len)
+      cpu_dirty(wd16_cpu_state, addr, len);
+    return;
+  }
+  while (len--)
+    cpu_putAMbyte(wd16_cpu_state, from++, addr++);
+}
@@ -0,0 +1,45 @@
+/* cpu-mem.h     (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+#ifndef __CPU_MEM_H__
+#define __CPU_MEM_H__
+
+#include "wd16.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+int      cpu_mem_region(wd16_cpu_state_t* wd16_cpu_state, uint32_t base, uint32_t size, uint8_t *host);
+uint8_t *cpu_mem_host(wd16_cpu_state_t* wd16_cpu_state, uint32_t addr, uint32_t len);
+void     cpu_mem_read(wd16_cpu_state_t* wd16_cpu_state, void *dst, uint32_t addr, uint32_t len);
+void     cpu_mem_write(wd16_cpu_state_t* wd16_cpu_state, uint32_t addr, const void *src, uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,121 @@
+/* cpu-pace.c    (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include <time.h>
+#include "cpu-pace.h"
+#include "cpu-event.h"
+
+#define PACE_PERIOD_NS   1000000        /* check ~ once per host ms   */
+#define PACE_SLACK_NS    50000000       /* re-anchor if 50ms behind   */
+#define PACE_MIN_QUANTUM 64
+
+static uint64_t pace_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+//
+// set the pacing ratio, 1.0 is the speed of a real AM-100, 2.0 twice
+// that, and 0 runs flat out.  'ips' is the instruction rate of the
+// machine being imitated, 0 selects PACE_NOMINAL_IPS.
+//
+void cpu_pace_set(wd16_cpu_state_t* wd16_cpu_state, double ratio, uint32_t ips) {
+  PACE *pace = &wd16_cpu_state->pace;
+
+  if (ips == 0)
+    ips = PACE_NOMINAL_IPS;
+  pace->ips = ips;
+  pace->ratio = (ratio > 0) ? ratio : 0;
+  pace->quantum = (uint32_t)((double)ips * pace->ratio * PACE_PERIOD_NS / 1e9);
+  if (pace->quantum < PACE_MIN_QUANTUM)
+    pace->quantum = PACE_MIN_QUANTUM;
+  pace->effective = 0;
+  pace->anchor_ns = 0;                       // re-anchor on next check
+  __atomic_store_n(&pace->next, wd16_cpu_state->regs.instcount, __ATOMIC_SEQ_CST);
+  cpu_event_kick(wd16_cpu_state);
+}
+
+//
+// the speed actually achieved, as a multiple of the real machine,
+// smoothed over the last few host milliseconds.
+//
+double cpu_pace_ratio(wd16_cpu_state_t* wd16_cpu_state) {
+  return (wd16_cpu_state->pace.effective);
+}
+
+//
+// called from cpu_event_run() when instcount reaches pace.next.  every
+// instcount maps to an absolute host time relative to the anchor, so
+// oversleeping in one quantum is made up in the next instead of adding
+// up as drift.  if we fall too far behind (host stalled, stepping, ..)
+// the anchor is moved rather than running flat out to catch up.
+//
+void cpu_pace(wd16_cpu_state_t* wd16_cpu_state) {
+  PACE *pace = &wd16_cpu_state->pace;
+  uint64_t inst = wd16_cpu_state->regs.instcount;
+  uint64_t now, target;
+  struct timespec ts;
+  double r;
+
+  if (pace->ratio <= 0) {
+    pace->effective = 0;
+    pace->next = UINT64_MAX;
+    return;
+  }
+
+  now = pace_now();
+  if (pace->anchor_ns == 0) {
+    pace->anchor_ns = pace->last_ns = now;
+    pace->anchor_inst = pace->last_inst = inst;
+    pace->next = inst + pace->quantum;
+    return;
+  }
+
+  target = pace->anchor_ns + (uint64_t)((double)(inst - pace->anchor_inst) * 1e9 / (pace->ips * pace->ratio));
+  if ((wd16_cpu_state->rr.mode == RR_REPLAY) || wd16_cpu_state->noparking) {  // flat out, then carry on from here
+    pace->anchor_ns = now;
+    pace->anchor_inst = inst;
+  } else if (target > now) {
+    ts.tv_sec = target / 1000000000ULL;
+    ts.tv_nsec = target % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+      ;
+    now = pace_now();
+  } else if (now - target > PACE_SLACK_NS) {
+    pace->anchor_ns = now;
+    pace->anchor_inst = inst;
+  }
+
+  if (now > pace->last_ns) {
+    r = ((double)(inst - pace->last_inst) * 1e9 / pace->ips) / (double)(now - pace->last_ns);
+    pace->effective = (pace->effective == 0) ? r : (pace->effective * 0.9 + r * 0.1);
+  }
+  pace->last_ns = now;
+  pace->last_inst = inst;
+  pace->next = inst + pace->quantum;
+}
@@ -0,0 +1,51 @@
+/* cpu-pace.h    (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+#ifndef __CPU_PACE_H__
+#define __CPU_PACE_H__
+
+#include "wd16.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//
+// nominal AM-100 instruction rate used to convert instcount to time.
+// it is calibrated from the SOB delay loop (~2500 per 1/100 sec at
+// 3.3 mhz) and is only an average, so hosts may supply their own.
+//
+#define PACE_NOMINAL_IPS  200000
+
+void cpu_pace_set(wd16_cpu_state_t* wd16_cpu_state, double ratio, uint32_t ips);
+double cpu_pace_ratio(wd16_cpu_state_t* wd16_cpu_state);
+void cpu_pace(wd16_cpu_state_t* wd16_cpu_state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,504 @@
+/* cpu-rr.c      (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include "cpu-rr.h"
+
+//
+// Recording and replaying what the CPU can't work out for itself.
+// Given the same memory and registers a run is a function of three
+// things: when interrupts become pending, what device registers read
+// back as, and how long a parked SOB loop (cpu-spin.c) waited in host
+// time.  Recording logs those, each with the instcount it happened at;
+// replaying feeds them back at the same instcounts, so the run is the
+// same instruction for instruction however the host is scheduled.
+//
+// interrupts raised by device threads (cpu_interrupt()) and by events
+// are held in rr.raised and only made pending at an instruction
+// boundary in cpu_step(), where they are logged.  deliveries are
+// logged as well, so a replay that takes an interrupt somewhere else
+// is noticed.  device reads are found by wrapping the host's read
+// callbacks and checking the address against iolo..iohi.
+//
+// in a replay nothing live gets in: interrupts raised are held until
+// it ends, device registers aren't read (so input a device has queued
+// is still there afterwards), and WFI, the idle and spin
+// parking and the pacing governor don't wait.  a replay ends at
+// 'until', or as soon as the run stops matching the log (counted in
+// rr.diverged); the log is cut there, and the mode becomes 'after'.
+//
+// rr.sink is told of each entry on the CPU thread, never with the
+// interrupt lock held, so it can write a file without holding up
+// device threads.
+//
+// what isn't covered: hosts that write whichint[] themselves rather
+// than calling cpu_interrupt(), and guest memory written by the host
+// outside the core (disk transfers from the async queue).  record with
+// those off, or expect a replay to diverge.
+//
+
+#define RR_GROW 4096                    /* entries added at a time   */
+
+static void rr_unwrap(wd16_cpu_state_t* wd16_cpu_state);
+
+static int rr_io(RR *rr, uint32_t addr) {
+  return ((addr & 0xFFFF) >= rr->iolo) && ((addr & 0xFFFF) <= rr->iohi);
+}
+
+static RRENT *rr_push(RR *rr) {
+  RRENT *log;
+
+  if (rr->count == rr->size) {
+    if ((log = realloc(rr->log, (rr->size + RR_GROW) * sizeof(RRENT))) == NULL) {
+      rr->lost++;
+      return (NULL);
+    }
+    rr->log = log;
+    rr->size += RR_GROW;
+  }
+  return (&rr->log[rr->count++]);
+}
+
+//
+// log an entry without telling rr.sink, NULL if there's no memory
+//
+static RRENT *rr_log(wd16_cpu_state_t* wd16_cpu_state, int kind, uint16_t addr, uint16_t value) {
+  RR *rr = &wd16_cpu_state->rr;
+  RRENT *e;
+
+  if ((e = rr_push(rr)) == NULL)
+    return (NULL);
+  e->when = wd16_cpu_state->regs.instcount;
+  e->addr = addr;
+  e->value = value;
+  e->kind = kind;
+  rr->pos++;
+  return (e);
+}
+
+static void rr_append(wd16_cpu_state_t* wd16_cpu_state, int kind, uint16_t addr, uint16_t value) {
+  RR *rr = &wd16_cpu_state->rr;
+  RRENT *e;
+
+  if (((e = rr_log(wd16_cpu_state, kind, addr, value)) != NULL) && rr->sink)
+    rr->sink(rr->ctx, e);
+}
+
+//
+// in a replay, whether there is a next entry, asking rr.fill for more
+// once those held have all been used
+//
+static int rr_more(wd16_cpu_state_t* wd16_cpu_state) {
+  RR *rr = &wd16_cpu_state->rr;
+
+  if (rr->pos < rr->first + rr->count)
+    return (true);
+  if ((rr->mode != RR_REPLAY) || (rr->fill == NULL))
+    return (false);
+  cpu_rr_trim(wd16_cpu_state, rr->pos);
+  return (rr->fill(rr->ctx) && (rr->pos < rr->first + rr->count));
+}
+
+//
+// in a replay, the next instcount cpu_rr_latch() has something to do
+//
+static void rr_next(wd16_cpu_state_t* wd16_cpu_state) {
+  RR *rr = &wd16_cpu_state->rr;
+  RRENT *e;
+
+  if (rr_more(wd16_cpu_state) && ((e = &rr->log[rr->pos - rr->first])->kind == RR_RAISE) && (e->when < rr->until))
+    rr->due = e->when;
+  else
+    rr->due = rr->until;
+}
+
+//
+// the replay is over: cut the log where it got to and carry on as
+// 'after'.  interrupts raised meanwhile become pending.
+//
+static void rr_end(wd16_cpu_state_t* wd16_cpu_state) {
+  RR *rr = &wd16_cpu_state->rr;
+  int i, raised = 0;
+
+  pthread_mutex_lock(&wd16_cpu_state->intlock_t);
+  rr->count = rr->pos - rr->first;
+  rr->mode = rr->after;
+  for (i = 0; i < 9; i++)
+    raised |= rr->raised[i];
+  if ((rr->mode == RR_OFF) && raised) {
+    for (i = 0; i < 9; i++)
+      if (rr->raised[i]) {
+        wd16_cpu_state->regs.whichint[i] = 1;
+        rr->raised[i] = 0;
+      }
+    wd16_cpu_state->regs.intpending = 1;
+  }
+  rr->due = raised ? 0 : UINT64_MAX;
+  pthread_mutex_unlock(&wd16_cpu_state->intlock_t);
+  if (rr->mode == RR_OFF)
+    rr_unwrap(wd16_cpu_state);
+}
+
+//
+// in a replay, the logged value if the next entry is this input, now.
+// anything else and the run has gone its own way.
+//
+static int rr_replayed(wd16_cpu_state_t* wd16_cpu_state, int kind, uint16_t addr, uint16_t *value) {
+  RR *rr = &wd16_cpu_state->rr;
+  RRENT *e;
+
+  if (rr->mode != RR_REPLAY)
+    return (false);
+  if (rr_more(wd16_cpu_state) && ((e = &rr->log[rr->pos - rr->first])->kind == kind) && (e->addr == addr) &&
+      (e->when == wd16_cpu_state->regs.instcount)) {
+    *value = e->value;
+    rr->pos++;
+    rr_next(wd16_cpu_state);
+    return (true);
+  }
+  rr->diverged++;
+  rr_end(wd16_cpu_state);
+  return (false);
+}
+
+//
+// an input the core has just seen: logged when recording, replaced by
+// the logged one when replaying
+//
+uint16_t cpu_rr_input(wd16_cpu_state_t* wd16_cpu_state, int kind, uint16_t addr, uint16_t value) {
+  uint16_t logged;
+
+  if (rr_replayed(wd16_cpu_state, kind, addr, &logged))
+    return (logged);
+  if (wd16_cpu_state->rr.mode == RR_RECORD)
+    rr_append(wd16_cpu_state, kind, addr, value);
+  return (value);
+}
+
+/*-------------------------------------------------------------------*/
+/* the host's read callbacks, wrapped                                */
+/*-------------------------------------------------------------------*/
+
+//
+// the core only has the one machine, and the callbacks don't say
+// which it is, so these work on wd16_cpu_state.  rr.nest stops reads
+// a wrapped *BYmode callback makes through the plain ones being seen
+// twice.
+//
+
+static void rr_getAMbyte(unsigned char *chr, long address) {
+  RR *rr = &wd16_cpu_state.rr;
+  uint16_t value;
+
+  if (rr->nest || !rr_io(rr, address)) {
+    rr->getAMbyte(chr, address);
+    return;
+  }
+  if (rr_replayed(&wd16_cpu_state, RR_READB, address, &value)) {
+    *chr = value;
+    return;
+  }
+  rr->getAMbyte(chr, address);
+  if (rr->mode == RR_RECORD)
+    rr_append(&wd16_cpu_state, RR_READB, address, *chr);
+}
+
+static void rr_getAMword(unsigned char *chr, long address) {
+  RR *rr = &wd16_cpu_state.rr;
+  uint16_t value;
+
+  if (rr->nest || !rr_io(rr, address)) {
+    rr->getAMword(chr, address);
+    return;
+  }
+  if (rr_replayed(&wd16_cpu_state, RR_READW, address, &value)) {
+    memcpy(chr, &value, 2);
+    return;
+  }
+  rr->getAMword(chr, address);
+  memcpy(&value, chr, 2);
+  if (rr->mode == RR_RECORD)
+    rr_append(&wd16_cpu_state, RR_READW, address, value);
+}
+
+//
+// the address is worked out first, as for a store; through a pointer
+// outside the registered regions it isn't known, and the read is
+// taken as one of memory.  a replayed read doesn't call the host, so
+// the mode's side effects on the register are made here.
+//
+static void rr_mode(int regnum, int mode, int size) {
+  uint16_t *r = &wd16_cpu_state.regs.gpr[regnum];
+
+  if (regnum >= 6)                        // SP and PC step by words
+    size = 2;
+  switch (mode) {
+  case 2:
+    *r += size;
+    break;
+  case 3:
+    *r += 2;
+    break;
+  case 4:
+    *r -= size;
+    break;
+  case 5:
+    *r -= 2;
+    break;
+  }
+}
+
+static uint16_t rr_getAMwordBYmode(int regnum, int mode, int offset) {
+  RR *rr = &wd16_cpu_state.rr;
+  uint16_t ea, value;
+  uint32_t len;
+
+  if (rr->nest || (mode == 0))
+    return (rr->getAMwordBYmode(regnum, mode, offset));
+  ea = cpu_dirty_ea(&wd16_cpu_state, regnum, mode, offset, &len);
+  if ((len == DIRTY_ANY) || !rr_io(rr, ea))
+    return (rr->getAMwordBYmode(regnum, mode, offset));
+  if (rr_replayed(&wd16_cpu_state, RR_READW, ea, &value)) {
+    rr_mode(regnum, mode, 2);
+    return (value);
+  }
+  rr->nest = 1;
+  value = rr->getAMwordBYmode(regnum, mode, offset);
+  rr->nest = 0;
+  if (rr->mode == RR_RECORD)
+    rr_append(&wd16_cpu_state, RR_READW, ea, value);
+  return (value);
+}
+
+static uint8_t rr_getAMbyteBYmode(int regnum, int mode, int offset) {
+  RR *rr = &wd16_cpu_state.rr;
+  uint16_t ea, value;
+  uint32_t len;
+
+  if (rr->nest || (mode == 0))
+    return (rr->getAMbyteBYmode(regnum, mode, offset));
+  ea = cpu_dirty_ea(&wd16_cpu_state, regnum, mode, offset, &len);
+  if ((mode == 4) && (regnum < 6))        // -(R) steps bytes by one
+    ea++;
+  if ((len == DIRTY_ANY) || !rr_io(rr, ea))
+    return (rr->getAMbyteBYmode(regnum, mode, offset));
+  if (rr_replayed(&wd16_cpu_state, RR_READB, ea, &value)) {
+    rr_mode(regnum, mode, 1);
+    return (value);
+  }
+  rr->nest = 1;
+  value = rr->getAMbyteBYmode(regnum, mode, offset);
+  rr->nest = 0;
+  if (rr->mode == RR_RECORD)
+    rr_append(&wd16_cpu_state, RR_READB, ea, value);
+  return (value);
+}
+
+static void rr_wrap(wd16_cpu_state_t* wd16_cpu_state) {
+  RR *rr = &wd16_cpu_state->rr;
+
+  rr->getAMbyte = wd16_cpu_state->getAMbyte;
+  rr->getAMword = wd16_cpu_state->getAMword;
+  rr->getAMwordBYmode = wd16_cpu_state->getAMwordBYmode;
+  rr->getAMbyteBYmode = wd16_cpu_state->getAMbyteBYmode;
+  wd16_cpu_state->getAMbyte = rr_getAMbyte;
+  wd16_cpu_state->getAMword = rr_getAMword;
+  wd16_cpu_state->getAMwordBYmode = rr_getAMwordBYmode;
+  wd16_cpu_state->getAMbyteBYmode = rr_getAMbyteBYmode;
+  rr->nest = 0;
+}
+
+static void rr_unwrap(wd16_cpu_state_t* wd16_cpu_state) {
+  RR *rr = &wd16_cpu_state->rr;
+
+  wd16_cpu_state->getAMbyte = rr->getAMbyte;
+  wd16_cpu_state->getAMword = rr->getAMword;
+  wd16_cpu_state->getAMwordBYmode = rr->getAMwordBYmode;
+  wd16_cpu_state->getAMbyteBYmode = rr->getAMbyteBYmode;
+}
+
+/*-------------------------------------------------------------------*/
+/* interrupts                                                        */
+/*-------------------------------------------------------------------*/
+
+//
+// an interrupt raised while recording or replaying, called with
+// intlock held.  'live' is false for one raised by an event, which a
+// replay will bring back from the log.
+//
+void cpu_rr_raise(wd16_cpu_state_t* wd16_cpu_state, int level, int live) {
+  RR *rr = &wd16_cpu_state->rr;
+
+  if ((rr->mode == RR_REPLAY) && !live)
+    return;
+  rr->raised[level] = 1;
+  if (rr->mode == RR_RECORD)
+    rr->due = 0;
+}
+
+//
+// called from cpu_step() at an instruction boundary once instcount
+// reaches rr.due: make what was raised pending and log it, or in a
+// replay, what the log says was
+//
+void cpu_rr_latch(wd16_cpu_state_t* wd16_cpu_state) {
+  RR *rr = &wd16_cpu_state->rr;
+  REGS *r = &wd16_cpu_state->regs;
+  RRENT *e, held[9];
+  int i, n = 0;
+
+  if (rr->mode == RR_RECORD) {
+    pthread_mutex_lock(&wd16_cpu_state->intlock_t);
+    rr->due = UINT64_MAX;
+    for (i = 0; i < 9; i++)
+      if (rr->raised[i]) {
+        rr->raised[i] = 0;
+        r->whichint[i] = 1;
+        r->intpending = 1;
+        if ((e = rr_log(wd16_cpu_state, RR_RAISE, i, 0)) != NULL)
+          held[n++] = *e;
+      }
+    pthread_mutex_unlock(&wd16_cpu_state->intlock_t);
+    for (i = 0; rr->sink && (i < n); i++)
+      rr->sink(rr->ctx, &held[i]);
+    return;
+  }
+
+  if (rr->mode != RR_REPLAY)
+    return;
+  while (rr_more(wd16_cpu_state) && ((e = &rr->log[rr->pos - rr->first])->kind == RR_RAISE) &&
+         (e->when <= r->instcount) && (e->when < rr->until)) {
+    pthread_mutex_lock(&wd16_cpu_state->intlock_t);
+    r->whichint[e->addr] = 1;
+    r->intpending = 1;
+    pthread_mutex_unlock(&wd16_cpu_state->intlock_t);
+    rr->pos++;
+  }
+  if (r->instcount >= rr->until)
+    rr_end(wd16_cpu_state);
+  else
+    rr_next(wd16_cpu_state);
+}
+
+/*-------------------------------------------------------------------*/
+/* starting and stopping                                             */
+/*-------------------------------------------------------------------*/
+
+//
+// start recording into an empty log.  reads of iolo..iohi (0, 0 for
+// RR_IOLO..RR_IOHI) are device reads.  the CPU must be stopped (or the
+// call made from the CPU thread).
+//
+int cpu_rr_record(wd16_cpu_state_t* wd16_cpu_state, uint16_t iolo, uint16_t iohi) {
+  RR *rr = &wd16_cpu_state->rr;
+
+  if (rr->mode != RR_OFF)
+    return (false);
+  free(rr->log);
+  rr->log = NULL;
+  rr->first = rr->pos = 0;
+  rr->count = rr->size = 0;
+  rr->diverged = rr->lost = 0;
+  rr->iolo = (iolo || iohi) ? iolo : RR_IOLO;
+  rr->iohi = (iolo || iohi) ? iohi : RR_IOHI;
+  memset(rr->raised, 0, sizeof(rr->raised));
+  rr_wrap(wd16_cpu_state);
+  rr->due = UINT64_MAX;
+  rr->mode = RR_RECORD;
+  return (true);
+}
+
+//
+// replay the log from entry 'pos' (counting from the first ever
+// recorded) until instcount reaches 'until', then carry on as 'after'
+// (RR_RECORD appends to the log from there).  the machine must be as it
+// was when entry 'pos' was recorded.  the CPU must be stopped.
+//
+int cpu_rr_replay(wd16_cpu_state_t* wd16_cpu_state, uint64_t pos, uint64_t until, int after) {
+  RR *rr = &wd16_cpu_state->rr;
+
+  if ((pos < rr->first) || (pos > rr->first + rr->count))
+    return (false);
+  if (rr->mode == RR_OFF)
+    rr_wrap(wd16_cpu_state);
+  pthread_mutex_lock(&wd16_cpu_state->intlock_t);
+  rr->pos = pos;
+  rr->until = until;
+  rr->after = after;
+  rr->mode = RR_REPLAY;
+  pthread_mutex_unlock(&wd16_cpu_state->intlock_t);
+  rr_next(wd16_cpu_state);
+  return (true);
+}
+
+//
+// add an entry read back from somewhere, for a replay (see rr.fill)
+//
+int cpu_rr_add(wd16_cpu_state_t* wd16_cpu_state, const RRENT *e) {
+  RRENT *to;
+
+  if ((to = rr_push(&wd16_cpu_state->rr)) == NULL)
+    return (false);
+  *to = *e;
+  return (true);
+}
+
+//
+// forget entries before 'upto', which nothing will replay from again
+//
+void cpu_rr_trim(wd16_cpu_state_t* wd16_cpu_state, uint64_t upto) {
+  RR *rr = &wd16_cpu_state->rr;
+  uint32_t n;
+
+  if (upto <= rr->first)
+    return;
+  if (upto > rr->pos)
+    upto = rr->pos;
+  n = upto - rr->first;
+  memmove(rr->log, rr->log + n, (rr->count - n) * sizeof(RRENT));
+  rr->count -= n;
+  rr->first = upto;
+}
+
+//
+// back to taking interrupts as they come, if a replay hasn't already
+// got there.  the log is freed.
+//
+void cpu_rr_stop(wd16_cpu_state_t* wd16_cpu_state) {
+  RR *rr = &wd16_cpu_state->rr;
+
+  if (rr->mode != RR_OFF) {
+    rr->after = RR_OFF;
+    rr->pos = rr->first + rr->count;      // keep the whole log
+    rr_end(wd16_cpu_state);
+  }
+  free(rr->log);
+  rr->log = NULL;
+  rr->first = rr->pos = 0;
+  rr->count = rr->size = 0;
+  rr->sink = NULL;
+  rr->fill = NULL;
+  rr->ctx = NULL;
+}
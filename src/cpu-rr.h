@@ -0,0 +1,50 @@
+/* cpu-rr.h      (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#ifndef __CPU_RR_H__
+#define __CPU_RR_H__
+
+#include "wd16.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+int      cpu_rr_record(wd16_cpu_state_t* wd16_cpu_state, uint16_t iolo, uint16_t iohi);
+int      cpu_rr_replay(wd16_cpu_state_t* wd16_cpu_state, uint64_t pos, uint64_t until, int after);
+void     cpu_rr_stop(wd16_cpu_state_t* wd16_cpu_state);
+void     cpu_rr_trim(wd16_cpu_state_t* wd16_cpu_state, uint64_t upto);
+int      cpu_rr_add(wd16_cpu_state_t* wd16_cpu_state, const RRENT *e);
+void     cpu_rr_raise(wd16_cpu_state_t* wd16_cpu_state, int level, int live);
+void     cpu_rr_latch(wd16_cpu_state_t* wd16_cpu_state);
+uint16_t cpu_rr_input(wd16_cpu_state_t* wd16_cpu_state, int kind, uint16_t addr, uint16_t value);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,197 @@
+/* cpu-spin.c    (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include "cpu-spin.h"
+#include "cpu-pace.h"
+#include "instruction-type.h"
+#include "cpu-rr.h"
+
+#define SPIN_PARK_NS     500000         /* longest poll loop park     */
+#define SPIN_BACKOFF_NS  2000           /* ... and the first          */
+#define SPIN_SPINS       64             /* poll passes run before it  */
+#define SPIN_MIN_PARK_NS 100000         /* shorter SOBs just collapse */
+
+static uint64_t spin_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+//
+// instructions we may skip before the next scheduled event (or pacing
+// check) has to run, UINT64_MAX if nothing is scheduled
+//
+static uint64_t spin_budget(wd16_cpu_state_t* wd16_cpu_state) {
+  if (wd16_cpu_state->events.next == UINT64_MAX)
+    return (UINT64_MAX);
+  if (wd16_cpu_state->events.next <= wd16_cpu_state->regs.instcount)
+    return (0);
+  return (wd16_cpu_state->events.next - wd16_cpu_state->regs.instcount);
+}
+
+//
+// SOB Rn,. has just branched to itself with Rn left to go.  the loop
+// touches nothing but Rn, so running it is the same as subtracting
+// from Rn and adding to instcount - except that an interrupt could
+// land part way through and see Rn.  so:
+//
+//  - interrupts off, or something scheduled: skip ahead in one step,
+//    stopping at the next event so it (or the pacing governor, which
+//    turns the skipped instructions back into host time) runs on time
+//  - interrupts on and nothing scheduled: an interrupt from a device
+//    thread is what the loop is timing, so park for as long as the
+//    loop would have taken at the nominal speed, and charge the time
+//    actually spent, which is less if woken early (by an interrupt or
+//    for no reason at all)
+//
+void cpu_spin_sob(wd16_cpu_state_t* wd16_cpu_state, int sreg) {
+  uint64_t left, n, budget, ns, start;
+  uint32_t ips;
+  int raised;
+
+  if ((wd16_cpu_state->spin.off & SPIN_SOB) || wd16_cpu_state->regs.tracing || wd16_cpu_state->regs.stepping)
+    return;
+  if (wd16_cpu_state->regs.PS.I2 && wd16_cpu_state->regs.intpending)
+    return;
+
+  left = wd16_cpu_state->regs.gpr[sreg];     // SOBs still to execute
+  budget = spin_budget(wd16_cpu_state);
+  ips = wd16_cpu_state->pace.ips ? wd16_cpu_state->pace.ips : PACE_NOMINAL_IPS;
+  ns = left * 1000000000ULL / ips;
+
+  if ((wd16_cpu_state->regs.PS.I2 == 0) || (budget != UINT64_MAX) || (ns < SPIN_MIN_PARK_NS) || wd16_cpu_state->noparking) {
+    n = (left < budget) ? left : budget;
+  } else {
+    wd16_cpu_state->spin.parked++;
+    start = spin_now();
+    raised = cpu_wait(ns);
+    n = (spin_now() - start) * ips / 1000000000ULL;
+    if (n > left)
+      n = left;
+    if (raised && (n == left))
+      n = left - 1;                          // let the interrupt see it
+    if (wd16_cpu_state->rr.mode)               // host time, so an input
+      n = cpu_rr_input(wd16_cpu_state, RR_SPIN, sreg, n);
+  }
+
+  wd16_cpu_state->regs.gpr[sreg] -= n;
+  wd16_cpu_state->regs.instcount += n;
+  wd16_cpu_state->spin.collapsed += n;
+  if (wd16_cpu_state->regs.gpr[sreg] == 0)
+    wd16_cpu_state->regs.PC += 2;            // fell out of the loop
+}
+
+//
+// length in words of an operand that is safe to re-read, 0 if the
+// mode has side effects (auto inc/dec of anything but PC)
+//
+static int spin_operand(int mode, int reg) {
+  if ((mode == 0) || (mode == 1))
+    return (1);
+  if ((mode == 2) || (mode == 3))              // #imm and @#addr only
+    return ((reg == 7) ? 2 : 0);
+  if ((mode == 6) || (mode == 7))
+    return (2);
+  return (0);
+}
+
+//
+// a short backward branch has just been taken.  if the loop is just
+// the branch, or one TST/TSTB/CMP/CMPB/BIT followed by the branch, it
+// tests the same thing the same way every time and can only exit if
+// an interrupt or a device changes memory.  rather than spin, skip to
+// the next scheduled event or park the thread; either way the loop
+// then runs one more pass so its reads happen as they would.  returns
+// true if it was such a loop.
+//
+// a device thread may change what is polled without cpu_interrupt()
+// to wake us (a console status bit, say), and with interrupts off
+// nothing else would.  so a loop just entered runs as it is for a few
+// passes, then parks for a short time that doubles each pass up to
+// SPIN_PARK_NS, starting over once the loop has been left.
+//
+int cpu_spin_poll(wd16_cpu_state_t* wd16_cpu_state) {
+  SPIN *spin = &wd16_cpu_state->spin;
+  uint16_t top = wd16_cpu_state->regs.PC;
+  uint64_t n, ns;
+  uint16_t op;
+  int len, a, b;
+
+  if ((wd16_cpu_state->spin.off & SPIN_POLL) || wd16_cpu_state->regs.tracing || wd16_cpu_state->regs.stepping)
+    return (false);
+  if (wd16_cpu_state->regs.PS.I2 && wd16_cpu_state->regs.intpending)
+    return (false);
+
+  if (top != wd16_cpu_state->opPC) {
+    wd16_cpu_state->getAMword((unsigned char *)&op, top);
+    switch (instruction_type(op)) {
+    case 7:
+      a = op >> 6;
+      if ((a != 42) && (a != 554))             // TST, TSTB
+        return (false);
+      len = spin_operand((op >> 3) & 7, op & 7);
+      if (len == 0)
+        return (false);
+      break;
+    case 10:
+      a = (op >> 12) & 15;
+      if ((a != 9) && (a != 10) && (a != 12))  // CMP, BIT, CMPB
+        return (false);
+      a = spin_operand((op >> 9) & 7, (op >> 6) & 7);
+      b = spin_operand((op >> 3) & 7, op & 7);
+      if ((a == 0) || (b == 0))
+        return (false);
+      len = a + b - 1;
+      break;
+    default:
+      return (false);
+    }
+    if ((uint16_t)(top + len * 2) != wd16_cpu_state->opPC)
+      return (false);
+  }
+
+  n = spin_budget(wd16_cpu_state);
+  if (n != UINT64_MAX) {
+    wd16_cpu_state->spin.collapsed += n;
+    wd16_cpu_state->regs.instcount += n;
+    return (true);
+  }
+
+  // a pass is the test and the branch, so more means it was left
+  if ((top != spin->poll) || (wd16_cpu_state->regs.instcount - spin->polled > 2)) {
+    spin->poll = top;
+    spin->passes = 0;
+  }
+  spin->polled = wd16_cpu_state->regs.instcount;
+  if (++spin->passes <= SPIN_SPINS)
+    return (false);
+  n = spin->passes - SPIN_SPINS - 1;
+  ns = (n < 8) ? (uint64_t)SPIN_BACKOFF_NS << n : SPIN_PARK_NS;
+  spin->parked++;
+  cpu_wait((ns < SPIN_PARK_NS) ? ns : SPIN_PARK_NS);
+  return (true);
+}
@@ -0,0 +1,183 @@
+/* cpu-svcprof.c (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include <time.h>
+#include "cpu-svcprof.h"
+
+//
+// Counts every SVCA/SVCB/SVCC by argument and, for those the monitor
+// services, measures guest instructions and host time until the
+// instruction (RTT, RSVC, RRTT, RSTS, RRTN or XCT) that pops the PC
+// the SVC pushed.  SVCs nest and jobs switch while a call is in the
+// monitor, so a call is matched to its return by the stack address of
+// its saved PC, which stays put until that return, rather than by
+// order.
+//
+// off, the core pays one pointer test per SVC and return.  the tables
+// are only allocated the first time the profiler is turned on, and
+// stay allocated (turning off only stops collection) so the CPU thread
+// never sees them freed under it; cpu_svcprof_free() is for after
+// cpu_stop().
+//
+
+static uint64_t svcprof_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+int cpu_svcprof_enable(wd16_cpu_state_t* wd16_cpu_state, int on) {
+  SVCPROF *prof = wd16_cpu_state->svcprof;
+
+  if (prof == NULL) {
+    if (!on)
+      return (true);
+    if ((prof = calloc(1, sizeof(SVCPROF))) == NULL)
+      return (false);
+    wd16_cpu_state->svcprof = prof;
+  }
+  prof->on = on;
+  return (true);
+}
+
+void cpu_svcprof_reset(wd16_cpu_state_t* wd16_cpu_state) {
+  SVCPROF *prof = wd16_cpu_state->svcprof;
+
+  if (prof) {
+    prof->lost = 0;
+    memset(prof->stat, 0, sizeof(prof->stat));
+    memset(prof->pend, 0, sizeof(prof->pend));
+  }
+}
+
+void cpu_svcprof_free(wd16_cpu_state_t* wd16_cpu_state) {
+  free(wd16_cpu_state->svcprof);
+  wd16_cpu_state->svcprof = NULL;
+}
+
+const SVCSTAT *cpu_svcprof_get(wd16_cpu_state_t* wd16_cpu_state, int svc, int arg) {
+  if ((wd16_cpu_state->svcprof == NULL) || (svc < ASSIST_SVCA) || (svc > ASSIST_SVCC) || (arg < 0) || (arg > 63))
+    return (NULL);
+  return (&wd16_cpu_state->svcprof->stat[svc][arg]);
+}
+
+void cpu_svcprof_dump(wd16_cpu_state_t* wd16_cpu_state, FILE *f) {
+  static const char *name[3] = {"SVCA", "SVCB", "SVCC"};
+  SVCPROF *prof = wd16_cpu_state->svcprof;
+  SVCSTAT *stat;
+  int svc, arg;
+
+  if (prof == NULL)
+    return;
+  fprintf(f, "SVC profile, %llu calls not seen to return\n", (unsigned long long)prof->lost);
+  for (svc = ASSIST_SVCA; svc <= ASSIST_SVCC; svc++)
+    for (arg = 0; arg < 64; arg++) {
+      stat = &prof->stat[svc][arg];
+      if (stat->calls == 0)
+        continue;
+      fprintf(f, "%s %2d: %llu calls, %llu assisted\n", name[svc], arg,
+              (unsigned long long)stat->calls, (unsigned long long)stat->assisted);
+      if (stat->inst.count) {
+        cpu_hist_dump(f, &stat->inst, "instructions");
+        cpu_hist_dump(f, &stat->ns, "ns");
+      }
+    }
+}
+
+#define SVCPROF_PROBES 4
+
+//
+// the entry for 'slot', or if there is none (and 'slot' isn't 0) the
+// first free entry it could go in, or failing that the one to evict
+//
+static SVCPEND *svcprof_find(SVCPROF *prof, uint16_t slot) {
+  SVCPEND *pend, *avail = NULL;
+  int i, h = slot >> 1;
+
+  for (i = 0; i < SVCPROF_PROBES; i++) {
+    pend = &prof->pend[(h + i) % SVCPROF_PENDING];
+    if (pend->slot == slot)
+      return (pend);
+    if ((pend->slot == 0) && (avail == NULL))
+      avail = pend;
+  }
+  return (avail ? avail : &prof->pend[h % SVCPROF_PENDING]);
+}
+
+//
+// an SVC was executed.  'slot' is where its PC was pushed, or 0 if an
+// assist handled it and there is no return to wait for.
+//
+void cpu_svcprof_call(wd16_cpu_state_t* wd16_cpu_state, int svc, int arg, uint16_t slot) {
+  SVCPROF *prof = wd16_cpu_state->svcprof;
+  SVCPEND *pend;
+
+  if (!prof->on)
+    return;
+  if ((svc == ASSIST_SVCC) && (wd16_cpu_state->cpu4_svcctxt[0] == 'h'))
+    arg = 63 - arg;                       // as the assists number them
+  prof->stat[svc][arg].calls++;
+  if (slot == 0) {
+    prof->stat[svc][arg].assisted++;
+    return;
+  }
+
+  // a slot still in use belongs to an SVC that never returned (EXIT,
+  // or a job that was killed) since its frame is being reused, or
+  // there are more SVCs outstanding than we can track
+  pend = svcprof_find(prof, slot);
+  if (pend->slot)
+    prof->lost++;
+  pend->slot = slot;
+  wd16_cpu_state->getAMword((unsigned char *)&pend->pc, slot);
+  pend->svc = svc;
+  pend->arg = arg;
+  pend->inst = wd16_cpu_state->regs.instcount;
+  pend->ns = svcprof_now();
+}
+
+//
+// PC is about to be popped from 'slot'.  most of these are returns
+// from interrupts or traps, which find nothing pending
+//
+void cpu_svcprof_return(wd16_cpu_state_t* wd16_cpu_state, uint16_t slot) {
+  SVCPROF *prof = wd16_cpu_state->svcprof;
+  SVCPEND *pend = svcprof_find(prof, slot);
+  SVCSTAT *stat;
+  uint16_t pc;
+
+  if (pend->slot != slot)
+    return;
+  wd16_cpu_state->getAMword((unsigned char *)&pc, slot);
+  if (pc == pend->pc) {
+    stat = &prof->stat[pend->svc][pend->arg];
+    cpu_hist_add(&stat->inst, wd16_cpu_state->regs.instcount - pend->inst);
+    cpu_hist_add(&stat->ns, svcprof_now() - pend->ns);
+  } else
+    prof->lost++;
+  pend->slot = 0;
+}
@@ -0,0 +1,79 @@
+/* cpu-svcprof.h (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+#ifndef __CPU_SVCPROF_H__
+#define __CPU_SVCPROF_H__
+
+#include "wd16.h"
+#include "cpu-hist.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*-------------------------------------------------------------------*/
+/* Structure definition for the SVC profiler                         */
+/*-------------------------------------------------------------------*/
+#define SVCPROF_PENDING 128             /* SVCs awaiting their RTT   */
+
+typedef struct _SVCSTAT {               /* One SVC argument          */
+  uint64_t calls;                       /* times executed            */
+  uint64_t assisted;                    /* ... handled natively      */
+  HIST inst;                            /* instructions to return    */
+  HIST ns;                              /* host nanoseconds          */
+
+} SVCSTAT;
+
+typedef struct _SVCPEND {               /* SVC awaiting its return   */
+  uint16_t slot;                        /* stack address of saved PC */
+  uint16_t pc;                          /* saved PC                  */
+  uint8_t svc, arg;                     /* which SVC                 */
+  uint64_t inst;                        /* instcount at the SVC      */
+  uint64_t ns;                          /* host time at the SVC      */
+
+} SVCPEND;
+
+typedef struct _SVCPROF {               /* SVC profiler              */
+  int on;                               /* collecting                */
+  uint64_t lost;                        /* SVCs never seen returning */
+  SVCSTAT stat[3][64];                  /* by ASSIST_SVCx and arg    */
+  SVCPEND pend[SVCPROF_PENDING];        /* hashed by slot            */
+
+} SVCPROF;
+
+int            cpu_svcprof_enable(wd16_cpu_state_t* wd16_cpu_state, int on);
+void           cpu_svcprof_reset(wd16_cpu_state_t* wd16_cpu_state);
+void           cpu_svcprof_free(wd16_cpu_state_t* wd16_cpu_state);
+const SVCSTAT *cpu_svcprof_get(wd16_cpu_state_t* wd16_cpu_state, int svc, int arg);
+void           cpu_svcprof_dump(wd16_cpu_state_t* wd16_cpu_state, FILE *f);
+void           cpu_svcprof_call(wd16_cpu_state_t* wd16_cpu_state, int svc, int arg, uint16_t slot);
+void           cpu_svcprof_return(wd16_cpu_state_t* wd16_cpu_state, uint16_t slot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,199 @@
+/* wd16-base.c   (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include "wd16-base.h"
+#include "cpu-dirty.h"
+#include "cpu-event.h"
+#include "cpu-pace.h"
+
+//
+// Resetting to a baseline.  A fuzzer or a test runner that starts the
+// same machine over and over can't afford to reload a snapshot each
+// time, so a baseline keeps a copy of the CPU state and of every
+// registered region (cpu_mem_region()) in host memory, and a reset
+// copies back only the pages written since, found from its own dirty
+// log (cpu-dirty.c).  the cost of a reset follows the pages the run
+// wrote, not the size of guest memory.
+//
+// regions above the 64K the dirty map covers are copied back whole.
+// the pages a reset restores count as changed to any other dirty log,
+// so a delta snapshot taken after one is still right.
+//
+// as with snapshots, the CPU must be stopped (or the call made from
+// the CPU thread); devices, disk drives and the host's settings aren't
+// part of a baseline, pending events are kept the same number of
+// instructions away, and 'halting' is left alone.  a host that writes
+// guest memory itself has to mark it (cpu_dirty_mark()) for a reset to
+// put it back.
+//
+
+typedef struct _BASEMEM {               /* One region's copy         */
+  uint32_t base;
+  uint32_t size;
+  uint8_t *host;                        /* the region, as it was     */
+  uint8_t *copy;                        /* its contents at baseline  */
+
+} BASEMEM;
+
+typedef struct _BASELINE {              /* Saved machine             */
+  int log;                              /* dirty log since baseline  */
+  REGS regs;
+  uint16_t oldPCs[256];
+  unsigned oldPCindex;
+  uint16_t op, opPC;
+  char cpu4_svcctxt[16];
+  int count;                            /* regions copied            */
+  BASEMEM mem[MAX_REGIONS];
+
+} BASELINE;
+
+static void base_release(BASELINE *base) {
+  int i;
+
+  for (i = 0; i < base->count; i++)
+    free(base->mem[i].copy);
+  base->count = 0;
+}
+
+//
+// make the machine as it is now the baseline, replacing any earlier one
+//
+int wd16_baseline_set(wd16_cpu_state_t* wd16_cpu_state) {
+  BASELINE *base = wd16_cpu_state->baseline;
+  REGION *region;
+  int i;
+
+  if (base == NULL) {
+    if ((base = calloc(1, sizeof(BASELINE))) == NULL)
+      return (false);
+    if ((base->log = cpu_dirty_open(wd16_cpu_state)) == 0) {
+      free(base);
+      return (false);
+    }
+    wd16_cpu_state->baseline = base;
+  } else {
+    base_release(base);
+    cpu_dirty_fetch(wd16_cpu_state, base->log, NULL);
+  }
+
+  for (i = 0; i < wd16_cpu_state->mem.count; i++) {
+    region = &wd16_cpu_state->mem.region[i];
+    if ((base->mem[i].copy = malloc(region->size)) == NULL) {
+      wd16_baseline_free(wd16_cpu_state);
+      return (false);
+    }
+    base->mem[i].base = region->base;
+    base->mem[i].size = region->size;
+    base->mem[i].host = region->host;
+    memcpy(base->mem[i].copy, region->host, region->size);
+    base->count++;
+  }
+
+  pthread_mutex_lock(&wd16_cpu_state->intlock_t);
+  base->regs = wd16_cpu_state->regs;
+  memcpy(base->oldPCs, wd16_cpu_state->oldPCs, sizeof(base->oldPCs));
+  base->oldPCindex = wd16_cpu_state->oldPCindex;
+  base->op = wd16_cpu_state->op;
+  base->opPC = wd16_cpu_state->opPC;
+  memcpy(base->cpu4_svcctxt, wd16_cpu_state->cpu4_svcctxt, sizeof(base->cpu4_svcctxt));
+  pthread_mutex_unlock(&wd16_cpu_state->intlock_t);
+  return (true);
+}
+
+//
+// copy back the parts of one region in the pages of 'map'
+//
+static void base_restore(BASEMEM *m, const uint64_t *map) {
+  uint64_t bits;
+  uint32_t addr, end, from, to, i;
+
+  if ((uint64_t)m->base + m->size > 65536) {
+    memcpy(m->host, m->copy, m->size);    // not tracked up there
+    return;
+  }
+  end = m->base + m->size;
+  for (i = m->base >> (DIRTY_SHIFT + 6); i <= (end - 1) >> (DIRTY_SHIFT + 6); i++)
+    for (bits = map[i]; bits; bits &= bits - 1) {
+      addr = ((i << 6) + __builtin_ctzll(bits)) << DIRTY_SHIFT;
+      from = (addr > m->base) ? addr : m->base;
+      to = (addr + (1 << DIRTY_SHIFT) < end) ? addr + (1 << DIRTY_SHIFT) : end;
+      if (from < to)
+        memcpy(m->host + (from - m->base), m->copy + (from - m->base), to - from);
+    }
+}
+
+//
+// put the machine back as it was at the baseline.  false if there is
+// none, or the host has registered different memory since.
+//
+int wd16_baseline_reset(wd16_cpu_state_t* wd16_cpu_state) {
+  BASELINE *base = wd16_cpu_state->baseline;
+  MEMMAP *mem = &wd16_cpu_state->mem;
+  REGS *r = &wd16_cpu_state->regs;
+  uint64_t map[DIRTY_PAGES / 64], from = r->instcount;
+  int i, halting;
+
+  if (base == NULL)
+    return (false);
+  if (base->count != mem->count)
+    return (false);
+  for (i = 0; i < base->count; i++)
+    if ((base->mem[i].base != mem->region[i].base) || (base->mem[i].size != mem->region[i].size) ||
+        (base->mem[i].host != mem->region[i].host))
+      return (false);
+
+  cpu_dirty_fetch(wd16_cpu_state, base->log, map);
+  for (i = 0; i < base->count; i++)
+    base_restore(&base->mem[i], map);
+  cpu_dirty_others(wd16_cpu_state, base->log, map);
+
+  pthread_mutex_lock(&wd16_cpu_state->intlock_t);
+  halting = r->halting;
+  *r = base->regs;
+  r->halting = halting;
+  memcpy(wd16_cpu_state->oldPCs, base->oldPCs, sizeof(base->oldPCs));
+  wd16_cpu_state->oldPCindex = base->oldPCindex;
+  wd16_cpu_state->op = base->op;
+  wd16_cpu_state->opPC = base->opPC;
+  memcpy(wd16_cpu_state->cpu4_svcctxt, base->cpu4_svcctxt, sizeof(base->cpu4_svcctxt));
+  pthread_mutex_unlock(&wd16_cpu_state->intlock_t);
+
+  cpu_event_rebase(wd16_cpu_state, from);
+  if (wd16_cpu_state->pace.ratio > 0)     // re-anchor to host time
+    cpu_pace_set(wd16_cpu_state, wd16_cpu_state->pace.ratio, wd16_cpu_state->pace.ips);
+  return (true);
+}
+
+void wd16_baseline_free(wd16_cpu_state_t* wd16_cpu_state) {
+  BASELINE *base = wd16_cpu_state->baseline;
+
+  if (base == NULL)
+    return;
+  cpu_dirty_close(wd16_cpu_state, base->log);
+  base_release(base);
+  free(base);
+  wd16_cpu_state->baseline = NULL;
+}
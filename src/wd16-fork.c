@@ -0,0 +1,166 @@
+/* wd16-fork.c   (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include <sys/wait.h>
+#include "wd16-fork.h"
+#include "wd16-snap.h"
+#include "am-vdk.h"
+#include "cpu-pace.h"
+#include "instruction-type.h"
+
+//
+// Fork server.  A test farm boots the same AMOS image over and over;
+// instead, boot it once to a chosen point with wd16_run_until(), then
+// have wd16_fork_server() fork() a child for each test.  A child starts
+// with the parent's CPU state and guest memory, copy-on-write through
+// fork(), so nothing is copied up front.  memory a host has mapped
+// MAP_SHARED is shared with every child, not copied.
+//
+// the protocol is AFL's: the server reads a 4 byte request from 'ctl'
+// and answers on 'st' with the child's pid, and if the request has
+// WD16_FORK_WAIT set, then with its wait() status once it exits.
+// 'ctl' and 'st' may be the two ends of pipes, or the same connected
+// Unix socket.  a request of 0 just clones.
+//
+// only the thread calling fork() exists in the child, so the server
+// holds the interrupt lock and the disk driver's locks over the fork
+// (am_vdk_atfork()), and the child starts its own CPU thread, with
+// writes to its disks kept private to it.
+//
+
+//
+// is the instruction at PC an SVC the caller wants to stop at?
+//
+static int fork_svc(wd16_cpu_state_t* wd16_cpu_state, const WD16STOP *stop) {
+  uint16_t op;
+  int arg;
+
+  wd16_cpu_state->getAMword((unsigned char *)&op, wd16_cpu_state->regs.PC);
+  if ((instruction_type(op) != 4) || ((op >> 6) != stop->svc + 1))
+    return (false);
+  arg = op & 63;
+  if ((stop->svc == ASSIST_SVCC) && (wd16_cpu_state->cpu4_svcctxt[0] == 'h'))
+    arg = 63 - arg;                       // as svcc_assist() sees it
+  return (arg == stop->arg);
+}
+
+//
+// run the CPU on this thread, which mustn't be the CPU thread or run
+// alongside it, until one of 'stop's conditions holds.  returns which
+// (a WD16_STOP_ flag), or 0 if something set 'halting' first.  the
+// instruction it stops at hasn't been executed.  WD16_STOP_WAIT is a
+// single step's wait, or a WFI with nothing to wake it, which is left
+// at PC.  nothing parks in host time meanwhile (cpu_wait(), pacing).
+//
+int wd16_run_until(wd16_cpu_state_t* wd16_cpu_state, const WD16STOP *stop) {
+  REGS *r = &wd16_cpu_state->regs;
+  int parking = wd16_cpu_state->noparking, why = 0;
+
+  wd16_cpu_state->noparking = 1;
+  wd16_cpu_state->idle = 0;
+  while (r->halting == 0) {
+    if ((stop->flags & WD16_STOP_WAIT) && (r->waiting || wd16_cpu_state->idle))
+      why = WD16_STOP_WAIT;
+    else if ((stop->flags & WD16_STOP_PC) && (r->PC == stop->pc) && (r->waiting == 0))
+      why = WD16_STOP_PC;
+    else if ((stop->flags & WD16_STOP_COUNT) && (r->instcount >= stop->count))
+      why = WD16_STOP_COUNT;
+    else if ((stop->flags & WD16_STOP_SVC) && (r->waiting == 0) && fork_svc(wd16_cpu_state, stop))
+      why = WD16_STOP_SVC;
+    if (why)
+      break;
+    wd16_cpu_state->idle = 0;
+    cpu_step();
+  }
+  wd16_cpu_state->noparking = parking;
+  return (why);
+}
+
+static void *fork_cpu(void *arg) {
+  cpu_thread();
+  return (NULL);
+}
+
+//
+// the child's half of the fork
+//
+static int fork_child(wd16_cpu_state_t* wd16_cpu_state) {
+  pthread_mutex_unlock(&wd16_cpu_state->intlock_t);
+  am_vdk_atfork(wd16_cpu_state, VDK_FORK_CHILD);
+  if (wd16_cpu_state->pace.ratio > 0)     // host time has moved on
+    cpu_pace_set(wd16_cpu_state, wd16_cpu_state->pace.ratio, wd16_cpu_state->pace.ips);
+  wd16_cpu_state->regs.halting = 0;
+  return (pthread_create(&wd16_cpu_state->cpu_t, NULL, fork_cpu, NULL) == 0);
+}
+
+static int fork_io(int fd, void *buf, int write_it) {
+  int n = write_it ? write(fd, buf, 4) : read(fd, buf, 4);
+
+  return (n == 4);
+}
+
+//
+// serve clone requests until 'ctl' is closed.  call it with the CPU
+// stopped, e.g. after wd16_run_until().  it returns 0 in each child,
+// with ctl and st closed and the CPU thread running, and -1 in the
+// parent once there are no more requests.
+//
+int wd16_fork_server(wd16_cpu_state_t* wd16_cpu_state, int ctl, int st) {
+  uint32_t req, reply;
+  int status;
+  pid_t pid;
+
+  wd16_snapshot_lazy_wait(wd16_cpu_state);  // a child wouldn't get the rest
+  while (fork_io(ctl, &req, false)) {
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+      ;                                   // children nobody waits for
+    pthread_mutex_lock(&wd16_cpu_state->intlock_t);
+    am_vdk_atfork(wd16_cpu_state, VDK_FORK_PREPARE);
+    if ((pid = fork()) == 0) {
+      close(ctl);
+      if (st != ctl)
+        close(st);
+      if (!fork_child(wd16_cpu_state))
+        _exit(127);
+      return (0);
+    }
+    am_vdk_atfork(wd16_cpu_state, VDK_FORK_PARENT);
+    pthread_mutex_unlock(&wd16_cpu_state->intlock_t);
+    reply = pid;
+    if ((pid < 0) || !fork_io(st, &reply, true))
+      break;
+    if (req & WD16_FORK_WAIT) {
+      if (waitpid(pid, &status, 0) < 0)
+        break;
+      reply = status;
+      if (!fork_io(st, &reply, true))
+        break;
+    }
+  }
+  while (waitpid(-1, NULL, WNOHANG) > 0)
+    ;
+  return (-1);
+}
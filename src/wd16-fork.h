@@ -0,0 +1,62 @@
+/* wd16-fork.h   (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+#ifndef __WD16_FORK_H__
+#define __WD16_FORK_H__
+
+#include "wd16.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*-------------------------------------------------------------------*/
+/* Structure definition for a run's stopping point                   */
+/*-------------------------------------------------------------------*/
+#define WD16_STOP_PC    1               /* reached 'pc'              */
+#define WD16_STOP_COUNT 2               /* instcount reached 'count' */
+#define WD16_STOP_SVC   4               /* about to do 'svc' 'arg'   */
+#define WD16_STOP_WAIT  8               /* waiting for an interrupt  */
+
+typedef struct _WD16STOP {              /* Where wd16_run_until() is */
+  int flags;                            /* WD16_STOP_, any of them   */
+  uint16_t pc;                          /* next instruction's PC     */
+  uint64_t count;                       /* instructions executed     */
+  int svc;                              /* ASSIST_SVCA/B/C           */
+  int arg;                              /* as the monitor sees it    */
+
+} WD16STOP;
+
+#define WD16_FORK_WAIT 1                /* request: report the exit  */
+
+int  wd16_run_until(wd16_cpu_state_t* wd16_cpu_state, const WD16STOP *stop);
+int  wd16_fork_server(wd16_cpu_state_t* wd16_cpu_state, int ctl, int st);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,230 @@
+/* wd16-fuzz.c   (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include <signal.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include "wd16-fuzz.h"
+#include "wd16-base.h"
+#include "wd16-snap.h"
+#include "am-vdk.h"
+#include "cpu-mem.h"
+
+//
+// Fuzzing guest programs.  A host boots AMOS and runs the program under
+// test to where it takes input, then calls wd16_fuzz_start() with an
+// AFL-style coverage map; that point becomes the baseline (wd16-base.c)
+// every input starts from.  wd16_fuzz_run() resets to the baseline,
+// copying back only the pages the last input dirtied, puts the new one
+// into guest memory (or hands it to a device), and runs it on the
+// caller's thread for at most 'budget' instructions.  no process or
+// machine is started per input, so what an input costs is the pages
+// reset and the instructions it runs.
+//
+// coverage comes from the control transfers themselves (cpu_cover() in
+// wd16.h): taken branches, SOB, JSR/RTN and TCALL/TJMP each count the
+// edge from the last one's target to theirs.  an illegal op code
+// (do_fmt_invalid()), a floating point trap or a HALT ends the run as a
+// crash.  so does anything that sets 'halting', with no reason.  a run
+// that reaches the 'stop' condition, or WAITs with nothing to wake it,
+// ended cleanly.
+//
+// wd16_fuzz_afl() serves afl-fuzz directly, in persistent mode: AFL's
+// fork server protocol on fds 198 and 199, with a child that runs
+// 'loops' inputs from stdin, stopping itself (SIGSTOP) after each, and
+// aborting on a crash.  the binary isn't instrumented, so run afl-fuzz
+// with AFL_SKIP_BIN_CHECK=1.
+//
+
+#define FUZZ_FORKSRV  198               /* AFL's control fd, +1 status */
+#define FUZZ_MAP_SIZE 65536             /* AFL's default map         */
+
+// afl-fuzz looks for this in the binary to know it's persistent
+static const char fuzz_persistent[] __attribute__((used)) = "##SIG_AFL_PERSISTENT##";
+
+//
+// start counting edges into 'map', 'size' bytes, a power of two, and
+// make the machine as it is now the point every run starts from
+//
+int wd16_fuzz_start(wd16_cpu_state_t* wd16_cpu_state, uint8_t *map, uint32_t size) {
+  COVER *cover = &wd16_cpu_state->cover;
+
+  if ((map == NULL) || (size < 2) || (size & (size - 1)))
+    return (false);
+  cover->map = map;
+  cover->mask = size - 1;
+  cover->prev = 0;
+  cover->crash = 0;
+  if (wd16_baseline_set(wd16_cpu_state))
+    return (true);
+  cover->map = NULL;
+  return (false);
+}
+
+//
+// run one input from the baseline, returning a WD16_FUZZ_ result
+//
+int wd16_fuzz_run(wd16_cpu_state_t* wd16_cpu_state, const WD16FUZZ *fuzz, const uint8_t *data, uint32_t len) {
+  COVER *cover = &wd16_cpu_state->cover;
+  REGS *r = &wd16_cpu_state->regs;
+  WD16STOP stop = fuzz->stop;
+  int why;
+
+  if (!wd16_baseline_reset(wd16_cpu_state))
+    return (WD16_FUZZ_ERROR);
+  if (len > fuzz->max)
+    len = fuzz->max;
+  if (fuzz->feed)
+    fuzz->feed(wd16_cpu_state, data, len);
+  else
+    cpu_mem_write(wd16_cpu_state, fuzz->addr, data, len);
+  if ((fuzz->lenreg >= 0) && (fuzz->lenreg < 8))
+    r->gpr[fuzz->lenreg] = len;
+
+  cover->prev = 0;
+  cover->crash = 0;
+  r->halting = 0;
+  stop.flags |= WD16_STOP_COUNT | WD16_STOP_WAIT;
+  stop.count = r->instcount + fuzz->budget;
+  why = wd16_run_until(wd16_cpu_state, &stop);
+  if (why == 0) {                         // a trap, or told to halt
+    r->halting = 0;
+    if (cover->crash == 0)
+      cover->crash = COVER_HALT;
+    return (WD16_FUZZ_CRASH);
+  }
+  return ((why == WD16_STOP_COUNT) ? WD16_FUZZ_HANG : WD16_FUZZ_OK);
+}
+
+//
+// the whole of stdin, which afl-fuzz rewrites for each input
+//
+static uint32_t fuzz_input(uint8_t *buf, uint32_t max) {
+  uint32_t len = 0;
+  ssize_t n;
+
+  lseek(0, 0, SEEK_SET);
+  while ((len < max) && ((n = read(0, buf + len, max - len)) > 0))
+    len += n;
+  return (len);
+}
+
+//
+// the persistent child: 'loops' inputs, then exit so the server forks
+// a fresh one
+//
+static void fuzz_child(wd16_cpu_state_t* wd16_cpu_state, const WD16FUZZ *fuzz, int loops, uint8_t *buf) {
+  uint32_t len;
+  int i;
+
+  pthread_mutex_unlock(&wd16_cpu_state->intlock_t);
+  am_vdk_atfork(wd16_cpu_state, VDK_FORK_CHILD);
+  close(FUZZ_FORKSRV);
+  close(FUZZ_FORKSRV + 1);
+  for (i = 0; i < loops; i++) {
+    len = fuzz_input(buf, fuzz->max);
+    if (wd16_fuzz_run(wd16_cpu_state, fuzz, buf, len) == WD16_FUZZ_CRASH)
+      abort();
+    raise(SIGSTOP);
+  }
+  _exit(0);
+}
+
+//
+// wd16_fuzz_afl() with the coverage map and input buffer it has made
+//
+static int fuzz_serve(wd16_cpu_state_t* wd16_cpu_state, const WD16FUZZ *fuzz, int loops, uint8_t *map, uint8_t *buf) {
+  uint32_t msg = 0;
+  pid_t child = -1;
+  int status, stopped = false;
+
+  if (!wd16_fuzz_start(wd16_cpu_state, map, FUZZ_MAP_SIZE))
+    return (WD16_FUZZ_ERROR);
+  if (loops < 1)
+    loops = 1;
+  wd16_snapshot_lazy_wait(wd16_cpu_state);
+
+  if (write(FUZZ_FORKSRV + 1, &msg, 4) != 4)
+    return (wd16_fuzz_run(wd16_cpu_state, fuzz, buf, fuzz_input(buf, fuzz->max)));
+  while (read(FUZZ_FORKSRV, &msg, 4) == 4) {
+    if (stopped) {
+      kill(child, SIGCONT);
+      stopped = false;
+    } else {
+      pthread_mutex_lock(&wd16_cpu_state->intlock_t);
+      am_vdk_atfork(wd16_cpu_state, VDK_FORK_PREPARE);
+      if ((child = fork()) == 0)
+        fuzz_child(wd16_cpu_state, fuzz, loops, buf);
+      am_vdk_atfork(wd16_cpu_state, VDK_FORK_PARENT);
+      pthread_mutex_unlock(&wd16_cpu_state->intlock_t);
+      if (child < 0)
+        break;
+    }
+    msg = child;
+    if ((write(FUZZ_FORKSRV + 1, &msg, 4) != 4) || (waitpid(child, &status, WUNTRACED) < 0))
+      break;
+    stopped = WIFSTOPPED(status);
+    msg = status;
+    if (write(FUZZ_FORKSRV + 1, &msg, 4) != 4)
+      break;
+  }
+  if (stopped)
+    kill(child, SIGKILL);
+  while (waitpid(-1, NULL, WNOHANG) > 0)
+    ;
+  return (WD16_FUZZ_OK);
+}
+
+//
+// be the target of afl-fuzz.  outside of it (no fork server to talk
+// to) run the one input on stdin and return its result.  under it,
+// return WD16_FUZZ_OK once afl-fuzz is done.  the coverage map is gone
+// by then, so counting stops; the baseline stays until
+// wd16_fuzz_stop().
+//
+int wd16_fuzz_afl(wd16_cpu_state_t* wd16_cpu_state, const WD16FUZZ *fuzz, int loops) {
+  const char *shm = getenv("__AFL_SHM_ID");
+  uint8_t *map, *buf;
+  int ok = WD16_FUZZ_ERROR;
+
+  map = shm ? shmat(atoi(shm), NULL, 0) : calloc(1, FUZZ_MAP_SIZE);
+  if ((map == NULL) || (map == (void *)-1))
+    return (WD16_FUZZ_ERROR);
+  if ((buf = malloc(fuzz->max + 1)) != NULL)
+    ok = fuzz_serve(wd16_cpu_state, fuzz, loops, map, buf);
+  wd16_cpu_state->cover.map = NULL;
+  free(buf);
+  if (shm)
+    shmdt(map);
+  else
+    free(map);
+  return (ok);
+}
+
+void wd16_fuzz_stop(wd16_cpu_state_t* wd16_cpu_state) {
+  wd16_cpu_state->cover.map = NULL;
+  wd16_baseline_free(wd16_cpu_state);
+}
@@ -0,0 +1,67 @@
+/* wd16-fuzz.h   (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#ifndef __WD16_FUZZ_H__
+#define __WD16_FUZZ_H__
+
+#include "wd16.h"
+#include "wd16-fork.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*-------------------------------------------------------------------*/
+/* Structure definition for a fuzzing target                         */
+/*-------------------------------------------------------------------*/
+#define WD16_FUZZ_ERROR -1              /* no baseline to reset to   */
+#define WD16_FUZZ_OK     0              /* ran to a stop, or idle    */
+#define WD16_FUZZ_HANG   1              /* used up its budget        */
+#define WD16_FUZZ_CRASH  2              /* trapped, see cover.crash  */
+
+typedef void (*wd16_fuzz_feed_t)(wd16_cpu_state_t* wd16_cpu_state, const uint8_t *data, uint32_t len);
+
+typedef struct _WD16FUZZ {              /* What wd16_fuzz_run() does */
+  uint16_t addr;                        /* where an input goes       */
+  uint16_t max;                         /* longest input, in bytes   */
+  int lenreg;                           /* gets its length, -1 none  */
+  wd16_fuzz_feed_t feed;                /* or hands it to a device   */
+  uint64_t budget;                      /* instructions per run      */
+  WD16STOP stop;                        /* a clean end, if any       */
+
+} WD16FUZZ;
+
+int  wd16_fuzz_start(wd16_cpu_state_t* wd16_cpu_state, uint8_t *map, uint32_t size);
+int  wd16_fuzz_run(wd16_cpu_state_t* wd16_cpu_state, const WD16FUZZ *fuzz, const uint8_t *data, uint32_t len);
+int  wd16_fuzz_afl(wd16_cpu_state_t* wd16_cpu_state, const WD16FUZZ *fuzz, int loops);
+void wd16_fuzz_stop(wd16_cpu_state_t* wd16_cpu_state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
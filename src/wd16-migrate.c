@@ -0,0 +1,253 @@
+/* wd16-migrate.c (c) Copyright Mike Sharkey, 2021                   */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#define _GNU_SOURCE                     // fopencookie()
+#include <time.h>
+#include "wd16-migrate.h"
+#include "wd16-snap.h"
+#include "am-vdk.h"
+#include "cpu-dirty.h"
+
+//
+// Live migration.  A running machine moves to another process (on this
+// host or, over a socket, another one) while it keeps running: the
+// sender streams a full snapshot with the CPU going, then a delta of
+// the pages written meanwhile, then a delta of those written during
+// that, and so on.  once what's left could be sent within 'downtime_ms'
+// at the rate the stream has been managing, or the rounds run out, it
+// stops the CPU, sends the last delta with the registers and pending
+// interrupts, and waits for the receiver to say it has them.  the
+// receiver applies each part as it arrives and then the host starts
+// its CPU thread.  the stream is:
+//
+//    frame            4 bytes, MIGRATE_ROUND or MIGRATE_FINAL
+//    snapshot         full, then deltas (wd16-snap.c), each a child of
+//                     the one before
+//
+// and the receiver answers the final one with 4 bytes, 1 if it has
+// the machine.  if it doesn't, the sender's CPU starts again.
+//
+// the sender's CPU thread must be running, and it is left stopped when
+// the machine has moved.  pending disk I/O is finished and written back
+// before the last delta, but the drives themselves aren't sent; the
+// receiver mounts the same images.  the transport is anything with a
+// read and a write (WD16STREAM); wd16_stream_fd() makes one of a pipe
+// pair or a socket.
+//
+
+#define MIGRATE_ROUND 1                 /* a pre-copy snapshot       */
+#define MIGRATE_FINAL 2                 /* the last, CPU stopped     */
+
+typedef struct _MIGIO {                 /* A stream as a FILE        */
+  WD16STREAM *s;
+  uint64_t bytes;                       /* written so far            */
+
+} MIGIO;
+
+static uint64_t migrate_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+static ssize_t stream_fd_read(WD16STREAM *s, void *buf, size_t len) {
+  return (read(s->in, buf, len));
+}
+
+static ssize_t stream_fd_write(WD16STREAM *s, const void *buf, size_t len) {
+  return (write(s->out, buf, len));
+}
+
+//
+// a stream over file descriptors, 'in' and 'out' the same for a socket
+//
+void wd16_stream_fd(WD16STREAM *s, int in, int out) {
+  s->read = stream_fd_read;
+  s->write = stream_fd_write;
+  s->ctx = NULL;
+  s->in = in;
+  s->out = out;
+}
+
+//
+// exactly 'len' bytes, or false
+//
+static int stream_all(WD16STREAM *s, void *buf, size_t len, int write_it) {
+  uint8_t *p = buf;
+  ssize_t n;
+
+  while (len) {
+    n = write_it ? s->write(s, p, len) : s->read(s, p, len);
+    if ((n < 0) && (errno == EINTR))
+      continue;
+    if (n <= 0)
+      return (false);
+    p += n;
+    len -= n;
+  }
+  return (true);
+}
+
+static ssize_t migio_read(void *cookie, char *buf, size_t len) {
+  MIGIO *io = cookie;
+  ssize_t n;
+
+  while (((n = io->s->read(io->s, buf, len)) < 0) && (errno == EINTR))
+    ;
+  return (n < 0 ? -1 : n);
+}
+
+static ssize_t migio_write(void *cookie, const char *buf, size_t len) {
+  MIGIO *io = cookie;
+
+  if (!stream_all(io->s, (void *)buf, len, true))
+    return (-1);
+  io->bytes += len;
+  return (len);
+}
+
+static FILE *migio_open(MIGIO *io, WD16STREAM *s, const char *mode) {
+  cookie_io_functions_t fns = {migio_read, migio_write, NULL, NULL};
+
+  io->s = s;
+  io->bytes = 0;
+  return (fopencookie(io, mode, fns));
+}
+
+static int migrate_frame(FILE *f, uint32_t frame) {
+  uint8_t b[4] = {frame, frame >> 8, frame >> 16, frame >> 24};
+
+  return (fwrite(b, 1, 4, f) == 4);
+}
+
+static void *migrate_cpu(void *arg) {
+  cpu_thread();
+  return (NULL);
+}
+
+//
+// stop the CPU and anything still writing guest memory for it
+//
+static void migrate_stop(wd16_cpu_state_t* wd16_cpu_state) {
+  int i;
+
+  cpu_stop();
+  if (wd16_cpu_state->vdk == NULL)
+    return;
+  for (i = 0; i < VDK_DRIVES; i++)
+    am_vdk_aio_drain(wd16_cpu_state, i);
+  am_vdk_flush(wd16_cpu_state);
+}
+
+//
+// move the machine to the receiver at the other end of 's'.  true once
+// it has it, with this CPU stopped; false with it running again.
+//
+int wd16_migrate_send(wd16_cpu_state_t* wd16_cpu_state, WD16STREAM *s, WD16MIGRATE *mig) {
+  uint64_t map[DIRTY_PAGES / 64], start, sent, t, ns_per_kb = 0, wait_ns;
+  int rounds = mig->max_rounds ? mig->max_rounds : MIGRATE_ROUNDS, n, ok;
+  uint32_t ack = 0;
+  MIGIO io;
+  FILE *f;
+
+  mig->rounds = 0;
+  mig->bytes = mig->downtime_ns = 0;
+  if ((f = migio_open(&io, s, "w")) == NULL)
+    return (false);
+
+  // the dirty log has to be open before the CPU next stores, or a store
+  // that looked before it was could miss both the copy and the log
+  if ((wd16_cpu_state->snaplog == 0) && (wd16_cpu_state->regs.halting == 0)) {
+    cpu_stop();
+    wd16_cpu_state->snaplog = cpu_dirty_open(wd16_cpu_state);
+    wd16_cpu_state->regs.halting = 0;
+    pthread_create(&wd16_cpu_state->cpu_t, NULL, migrate_cpu, NULL);
+  }
+
+  // pre-copy: everything, then what changed while that went
+  t = migrate_now();
+  ok = migrate_frame(f, MIGRATE_ROUND) && wd16_snapshot_write(wd16_cpu_state, f) && (fflush(f) == 0);
+  while (ok && (++mig->rounds < rounds)) {
+    t = migrate_now() - t;
+    ns_per_kb = t * 1024 / (io.bytes - mig->bytes + 1);
+    mig->bytes = io.bytes;
+
+    // a peek at what the next round would send
+    n = cpu_dirty_fetch(wd16_cpu_state, wd16_cpu_state->snaplog, map);
+    cpu_dirty_unfetch(wd16_cpu_state, wd16_cpu_state->snaplog, map);
+    wait_ns = (uint64_t)n * (1 << DIRTY_SHIFT) * ns_per_kb / 1024;
+    if (wait_ns <= (uint64_t)mig->downtime_ms * 1000000)
+      break;
+    t = migrate_now();
+    ok = migrate_frame(f, MIGRATE_ROUND) && wd16_snapshot_delta_write(wd16_cpu_state, f) && (fflush(f) == 0);
+  }
+
+  // stop and copy
+  start = migrate_now();
+  migrate_stop(wd16_cpu_state);
+  ok = ok && migrate_frame(f, MIGRATE_FINAL) && wd16_snapshot_delta_write(wd16_cpu_state, f) && (fflush(f) == 0);
+  ok = ok && stream_all(s, &ack, sizeof(ack), false) && (ack == 1);
+  sent = io.bytes;
+  fclose(f);
+  mig->bytes = sent;
+  mig->downtime_ns = migrate_now() - start;
+  if (ok)
+    return (true);
+  wd16_cpu_state->regs.halting = 0;       // it stays here
+  pthread_create(&wd16_cpu_state->cpu_t, NULL, migrate_cpu, NULL);
+  return (false);
+}
+
+//
+// take a machine from the sender at the other end of 's'.  the CPU must
+// be stopped, and the host starts it once this returns true.
+//
+int wd16_migrate_recv(wd16_cpu_state_t* wd16_cpu_state, WD16STREAM *s) {
+  uint8_t b[4];
+  uint32_t frame, ack;
+  int first = true, ok;
+  MIGIO io;
+  FILE *f;
+
+  if ((f = migio_open(&io, s, "r")) == NULL)
+    return (false);
+  do {
+    if (fread(b, 1, 4, f) != 4) {
+      ok = false;
+      break;
+    }
+    frame = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t)b[3] << 24);
+    if (first)
+      ok = (frame == MIGRATE_ROUND) && wd16_snapshot_read(wd16_cpu_state, f);
+    else
+      ok = ((frame == MIGRATE_ROUND) || (frame == MIGRATE_FINAL)) && wd16_snapshot_delta_read(wd16_cpu_state, f);
+    first = false;
+  } while (ok && (frame != MIGRATE_FINAL));
+  fclose(f);
+  ack = ok;
+  return (stream_all(s, &ack, sizeof(ack), true) && ok);
+}
@@ -0,0 +1,70 @@
+/* wd16-migrate.h (c) Copyright Mike Sharkey, 2021                   */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#ifndef __WD16_MIGRATE_H__
+#define __WD16_MIGRATE_H__
+
+#include "wd16.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/*-------------------------------------------------------------------*/
+/* Structure definition for a migration's transport                  */
+/*-------------------------------------------------------------------*/
+typedef struct _WD16STREAM {            /* Where a migration goes    */
+  ssize_t (*read)(struct _WD16STREAM *s, void *buf, size_t len);
+  ssize_t (*write)(struct _WD16STREAM *s, const void *buf, size_t len);
+  void *ctx;                            /* the transport's own       */
+  int in, out;                          /* fds, for wd16_stream_fd() */
+
+} WD16STREAM;
+
+/*-------------------------------------------------------------------*/
+/* Structure definition for a migration's limits and results         */
+/*-------------------------------------------------------------------*/
+#define MIGRATE_ROUNDS 30               /* pre-copy rounds, at most  */
+
+typedef struct _WD16MIGRATE {           /* wd16_migrate_send()'s     */
+  uint32_t downtime_ms;                 /* longest stop wanted       */
+  int max_rounds;                       /* 0 for MIGRATE_ROUNDS      */
+  int rounds;                           /* out: pre-copy rounds sent */
+  uint64_t bytes;                       /* out: bytes sent           */
+  uint64_t downtime_ns;                 /* out: how long it stopped  */
+
+} WD16MIGRATE;
+
+void wd16_stream_fd(WD16STREAM *s, int in, int out);
+int  wd16_migrate_send(wd16_cpu_state_t* wd16_cpu_state, WD16STREAM *s, WD16MIGRATE *mig);
+int  wd16_migrate_recv(wd16_cpu_state_t* wd16_cpu_state, WD16STREAM *s);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
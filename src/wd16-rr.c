@@ -0,0 +1,372 @@
+/* wd16-rr.c     (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include "wd16-rr.h"
+#include "wd16-snap.h"
+#include "cpu-rr.h"
+
+//
+// Recording a run to a file and replaying it.  Two runs of the same
+// workload differ because device threads raise interrupts whenever
+// they like; a replay takes its interrupts, device register reads and
+// parked SOB loops (cpu-rr.c) from the file instead, at the same
+// instcounts, so it is the same run instruction for instruction -
+// which is what comparing two builds of the engine needs.
+//
+// the file starts with a snapshot of the machine (wd16-snap.c) so a
+// replay starts from the same place.  the rest is appended as the run
+// goes, a few bytes an input:
+//
+//    header       "WD16RRLG", version, iolo, iohi, little-endian
+//    snapshot     the machine when recording started
+//    entries      tag, varint instcount delta, then by kind:
+//                   RR_RAISE, RR_TAKE   level in the tag
+//                   RR_READB            varint addr - iolo, byte
+//                   RR_READW            varint addr - iolo, word
+//                   RR_SPIN             register in the tag, varint n
+//    end          tag 0 and the delta to where recording stopped
+//
+// tags are the kind in the low nibble and the level or register in
+// the high one.  a file cut short (the host died) replays up to its
+// last whole entry.  the host has to set up events, pacing and the
+// like the same way for both runs; the calls need the CPU stopped.
+//
+
+#define RRF_MAGIC   "WD16RRLG"
+#define RRF_VERSION 1
+#define RRF_END     0                   /* tag of the end record     */
+#define RRF_BATCH   1024                /* entries read at a time    */
+#define RRF_HDRLEN  16                  /* header bytes in the file  */
+
+typedef struct _RRFHDR {                /* Log file header           */
+  char magic[8];                        /* RRF_MAGIC                 */
+  uint32_t version;                     /* RRF_VERSION               */
+  uint16_t iolo;                        /* device register range     */
+  uint16_t iohi;
+
+} RRFHDR;
+
+static void rrf_put(uint8_t *p, uint32_t v, int n) {
+  int i;
+
+  for (i = 0; i < n; i++)
+    p[i] = v >> (8 * i);
+}
+
+static uint32_t rrf_get(const uint8_t *p, int n) {
+  uint32_t v = 0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    v |= (uint32_t)p[i] << (8 * i);
+  return (v);
+}
+
+//
+// the header goes out a field at a time, little-endian like the
+// snapshot after it, so a log replays on any host
+//
+static int rrf_header_write(FILE *f, const RRFHDR *hdr) {
+  uint8_t b[RRF_HDRLEN];
+
+  memcpy(b, hdr->magic, 8);
+  rrf_put(b + 8, hdr->version, 4);
+  rrf_put(b + 12, hdr->iolo, 2);
+  rrf_put(b + 14, hdr->iohi, 2);
+  return (fwrite(b, 1, RRF_HDRLEN, f) == RRF_HDRLEN);
+}
+
+static int rrf_header_read(FILE *f, RRFHDR *hdr) {
+  uint8_t b[RRF_HDRLEN];
+
+  if (fread(b, 1, RRF_HDRLEN, f) != RRF_HDRLEN)
+    return (false);
+  memcpy(hdr->magic, b, 8);
+  hdr->version = rrf_get(b + 8, 4);
+  hdr->iolo = rrf_get(b + 12, 2);
+  hdr->iohi = rrf_get(b + 14, 2);
+  return (!memcmp(hdr->magic, RRF_MAGIC, sizeof(hdr->magic)) && (hdr->version == RRF_VERSION));
+}
+
+typedef struct _RRFILE {                /* An open log file          */
+  wd16_cpu_state_t* wd16_cpu_state;
+  FILE *f;
+  int own;                              /* we turned recording on    */
+  int error;                            /* a write failed            */
+  int done;                             /* end record read           */
+  uint16_t iolo;
+  uint64_t last;                        /* instcount of the last one */
+
+} RRFILE;
+
+static int rrf_putv(uint8_t *p, uint64_t v) {
+  int n = 0;
+
+  while (v >= 0x80) {
+    p[n++] = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  p[n++] = v;
+  return (n);
+}
+
+static int rrf_getv(FILE *f, uint64_t *v) {
+  int c, shift = 0;
+
+  for (*v = 0; shift < 64; shift += 7) {
+    if ((c = getc(f)) == EOF)
+      return (false);
+    *v |= (uint64_t)(c & 0x7F) << shift;
+    if (!(c & 0x80))
+      return (true);
+  }
+  return (false);
+}
+
+static void rrf_write(RRFILE *rf, int tag, uint64_t when, const RRENT *e) {
+  uint8_t b[32];
+  int n = 0;
+
+  b[n++] = tag;
+  n += rrf_putv(b + n, when - rf->last);
+  rf->last = when;
+  if (e)
+    switch (e->kind) {
+    case RR_READB:
+      n += rrf_putv(b + n, (uint16_t)(e->addr - rf->iolo));
+      b[n++] = e->value;
+      break;
+    case RR_READW:
+      n += rrf_putv(b + n, (uint16_t)(e->addr - rf->iolo));
+      b[n++] = e->value;
+      b[n++] = e->value >> 8;
+      break;
+    case RR_SPIN:
+      n += rrf_putv(b + n, e->value);
+      break;
+    }
+  if (fwrite(b, 1, n, rf->f) != (size_t)n)
+    rf->error = true;
+}
+
+//
+// cpu-rr's sink: append the entry.  with no time travel (wd16-tt.c)
+// wanting them, entries aren't kept in memory as well.
+//
+static void rrf_sink(void *ctx, const RRENT *e) {
+  RRFILE *rf = ctx;
+  wd16_cpu_state_t* wd16_cpu_state = rf->wd16_cpu_state;
+  int arg = ((e->kind == RR_READB) || (e->kind == RR_READW)) ? 0 : e->addr;
+
+  rrf_write(rf, e->kind | (arg << 4), e->when, e);
+  if (wd16_cpu_state->tt == NULL)
+    cpu_rr_trim(wd16_cpu_state, wd16_cpu_state->rr.pos);
+}
+
+//
+// cpu-rr's fill: read the next batch of entries
+//
+static int rrf_fill(void *ctx) {
+  RRFILE *rf = ctx;
+  wd16_cpu_state_t* wd16_cpu_state = rf->wd16_cpu_state;
+  uint64_t delta, v;
+  int tag, n;
+  RRENT e;
+
+  for (n = 0; !rf->done && (n < RRF_BATCH); n++) {
+    if (((tag = getc(rf->f)) == EOF) || !rrf_getv(rf->f, &delta))
+      break;
+    e.when = rf->last + delta;
+    e.kind = tag & 15;
+    e.addr = tag >> 4;
+    e.value = 0;
+    switch (e.kind) {
+    case RRF_END:
+      rf->last = e.when;
+      rf->done = true;
+      continue;
+    case RR_RAISE:
+    case RR_TAKE:
+      break;
+    case RR_READB:
+    case RR_READW:
+      if (!rrf_getv(rf->f, &v))
+        goto cut;
+      e.addr = rf->iolo + v;
+      if ((tag = getc(rf->f)) == EOF)
+        goto cut;
+      e.value = tag;
+      if (e.kind == RR_READW) {
+        if ((tag = getc(rf->f)) == EOF)
+          goto cut;
+        e.value |= tag << 8;
+      }
+      break;
+    case RR_SPIN:
+      if (!rrf_getv(rf->f, &v))
+        goto cut;
+      e.value = v;
+      break;
+    default:
+      goto cut;
+    }
+    if (!cpu_rr_add(wd16_cpu_state, &e))
+      break;
+    rf->last = e.when;
+  }
+  if (n < RRF_BATCH) {
+  cut:
+    rf->done = true;
+  }
+  if (rf->done)                           // the replay ends here
+    wd16_cpu_state->rr.until = rf->last;
+  return (true);
+}
+
+static void rrf_close(RRFILE *rf) {
+  if (rf->f)
+    fclose(rf->f);
+  free(rf);
+}
+
+/*-------------------------------------------------------------------*/
+/* recording                                                         */
+/*-------------------------------------------------------------------*/
+
+//
+// start recording to 'path', with reads of iolo..iohi (0, 0 for the
+// defaults) as device reads.  if time travel is already recording,
+// its device range is used.
+//
+int wd16_record_start(wd16_cpu_state_t* wd16_cpu_state, const char *path, uint16_t iolo, uint16_t iohi) {
+  RR *rr = &wd16_cpu_state->rr;
+  RRFHDR hdr;
+  RRFILE *rf;
+
+  if ((rr->mode == RR_REPLAY) || rr->ctx)
+    return (false);
+  if ((rf = calloc(1, sizeof(RRFILE))) == NULL)
+    return (false);
+  rf->wd16_cpu_state = wd16_cpu_state;
+  if ((rf->f = fopen(path, "wb")) == NULL) {
+    rrf_close(rf);
+    return (false);
+  }
+  if (rr->mode == RR_OFF) {
+    cpu_rr_record(wd16_cpu_state, iolo, iohi);
+    rf->own = true;
+  }
+
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, RRF_MAGIC, sizeof(hdr.magic));
+  hdr.version = RRF_VERSION;
+  hdr.iolo = rf->iolo = rr->iolo;
+  hdr.iohi = rr->iohi;
+  rf->last = wd16_cpu_state->regs.instcount;
+  // outside the snapshot chain, which the host's next delta continues
+  if (!rrf_header_write(rf->f, &hdr) || !wd16_snapshot_copy(wd16_cpu_state, rf->f)) {
+    if (rf->own)
+      cpu_rr_stop(wd16_cpu_state);
+    rrf_close(rf);
+    return (false);
+  }
+  rr->sink = rrf_sink;
+  rr->ctx = rf;
+  return (true);
+}
+
+//
+// end the recording, false if any of it couldn't be written
+//
+int wd16_record_stop(wd16_cpu_state_t* wd16_cpu_state) {
+  RR *rr = &wd16_cpu_state->rr;
+  RRFILE *rf = rr->ctx;
+  int ok;
+
+  if ((rf == NULL) || (rr->sink != rrf_sink))
+    return (false);
+  rrf_write(rf, RRF_END, wd16_cpu_state->regs.instcount, NULL);
+  ok = !rf->error && (rr->lost == 0) && (fflush(rf->f) == 0);
+  rr->sink = NULL;
+  rr->ctx = NULL;
+  if (rf->own)
+    cpu_rr_stop(wd16_cpu_state);
+  rrf_close(rf);
+  return (ok);
+}
+
+/*-------------------------------------------------------------------*/
+/* replaying                                                         */
+/*-------------------------------------------------------------------*/
+
+//
+// load the machine from the start of the recording at 'path' and
+// replay it from there as the CPU runs.  rr.mode drops to RR_OFF when
+// the replay has got to where recording stopped, or it went astray.
+//
+int wd16_replay_start(wd16_cpu_state_t* wd16_cpu_state, const char *path) {
+  RR *rr = &wd16_cpu_state->rr;
+  RRFHDR hdr;
+  RRFILE *rf;
+
+  if ((rr->mode != RR_OFF) || rr->ctx || wd16_cpu_state->tt)
+    return (false);
+  if ((rf = calloc(1, sizeof(RRFILE))) == NULL)
+    return (false);
+  rf->wd16_cpu_state = wd16_cpu_state;
+  if (((rf->f = fopen(path, "rb")) == NULL) || !rrf_header_read(rf->f, &hdr) ||
+      !wd16_snapshot_read(wd16_cpu_state, rf->f)) {
+    rrf_close(rf);
+    return (false);
+  }
+  rf->iolo = hdr.iolo;
+  rf->last = wd16_cpu_state->regs.instcount;
+
+  // an empty log with the recording's device range, filled as it goes
+  cpu_rr_record(wd16_cpu_state, hdr.iolo, hdr.iohi);
+  rr->fill = rrf_fill;
+  rr->ctx = rf;
+  cpu_rr_replay(wd16_cpu_state, 0, UINT64_MAX, RR_OFF);
+  return (true);
+}
+
+//
+// finish with the recording.  true if the replay got to the end of it
+// without going astray.
+//
+int wd16_replay_stop(wd16_cpu_state_t* wd16_cpu_state) {
+  RR *rr = &wd16_cpu_state->rr;
+  RRFILE *rf = rr->ctx;
+  int ok;
+
+  if ((rf == NULL) || (rr->fill != rrf_fill))
+    return (false);
+  ok = rf->done && (rr->diverged == 0) &&
+       ((rr->mode == RR_OFF) || (wd16_cpu_state->regs.instcount >= rr->until));
+  cpu_rr_stop(wd16_cpu_state);
+  rrf_close(rf);
+  return (ok);
+}
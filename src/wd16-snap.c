@@ -0,0 +1,1037 @@
+/* wd16-snap.c   (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/userfaultfd.h>
+#include "wd16-snap.h"
+#include "cpu-dirty.h"
+#include "cpu-event.h"
+#include "cpu-mem.h"
+#include "cpu-pace.h"
+
+//
+// Machine snapshots.  A snapshot is the CPU state and the guest memory
+// the host has registered with cpu_mem_region(), so a host can save a
+// machine that has finished booting AMOS and start every instance
+// from there.  The file is:
+//
+//    "WD16SNAP", version      12 bytes
+//    sections                 tag, length, payload, CRC-32
+//
+// the CRC covers the section's tag and length as well as its payload.
+// sections are:
+//
+//    CPU      registers, flags, pending interrupts, the prior PC table
+//             and the SVCC context, each field little-endian
+//    MEM      base, size, then that much guest memory; there may be
+//             any number, each inside one registered region
+//    LINK     this snapshot's id and its parent's, 0 for a full one
+//    END      the last section
+//
+// sections a reader doesn't know are skipped, so later versions can
+// add to the format.  memory goes in and out with one fread/fwrite per
+// region.  a load checks every section before changing anything.
+//
+// a delta snapshot (version 2) holds the CPU and only the pages written
+// since the snapshot before it, found from the dirty page bitmap
+// (cpu-dirty.c), so frequent checkpoints of a long-running machine
+// cost little I/O.  saving any snapshot starts dirty tracking, and each
+// delta names its parent, so a chain is a full snapshot and the deltas
+// after it, restored in order with wd16_snapshot_chain().  a chain is
+// kept short by compacting it (wd16_snapshot_compact()) into one full
+// snapshot with the id of its last delta, so the machine's next delta
+// follows on from the compacted file.  version 1 files are full
+// snapshots with no id.  wd16_snapshot_copy() writes a full snapshot
+// outside the chain, for a file that embeds one (wd16-rr.c), so the
+// machine's next delta still follows on from the last saved.
+//
+// the pages are only those written through the core or marked with
+// cpu_dirty_mark(); a host that writes guest memory itself has to mark
+// it, or the change waits for the next full snapshot.
+//
+// the CPU must be stopped (or the call made from the CPU thread).
+// devices, disk drives, scheduled events and the host's settings
+// (assists, pacing, profiling) aren't part of a snapshot; pending
+// events are kept the same number of instructions away.  'halting' is
+// left alone, as it belongs to whoever is running the CPU thread.
+//
+
+#define SNAP_MAGIC   "WD16SNAP"
+#define SNAP_VERSION 2
+#define SNAP_TAG(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+#define SNAP_CPU     SNAP_TAG('C', 'P', 'U', ' ')
+#define SNAP_MEM     SNAP_TAG('M', 'E', 'M', ' ')
+#define SNAP_LINK    SNAP_TAG('L', 'I', 'N', 'K')
+#define SNAP_END     SNAP_TAG('E', 'N', 'D', ' ')
+#define SNAP_CPU_LEN 606                /* CPU section in version 1  */
+#define SNAP_LINK_LEN 16                /* LINK section              */
+
+typedef struct _SNAPBUF {               /* Section being built/read  */
+  uint8_t *p;
+  size_t len;                           /* bytes used / read so far  */
+  size_t cap;                           /* bytes allocated / present */
+  int bad;                              /* overrun or out of memory  */
+
+} SNAPBUF;
+
+typedef struct _SNAPMEM {               /* Memory staged by a load   */
+  uint32_t base;
+  uint32_t size;
+  uint8_t *data;                        /* section payload           */
+  uint8_t *host;                        /* where it goes             */
+
+} SNAPMEM;
+
+typedef struct _SNAPFILE {              /* One file staged by a load */
+  uint64_t id;                          /* 0 if it has none          */
+  uint64_t parent;                      /* 0 if it's a full snapshot */
+  SNAPBUF cpu;                          /* CPU section payload       */
+  SNAPMEM *mem;                         /* MEM sections, in order    */
+  int n;
+
+} SNAPFILE;
+
+//
+// CRC-32 (IEEE 802.3, as zlib)
+//
+uint32_t wd16_crc32(uint32_t crc, const void *buf, size_t len) {
+  static uint32_t table[256];
+  const uint8_t *p = buf;
+  uint32_t c;
+  int i, j;
+
+  if (table[1] == 0)
+    for (i = 0; i < 256; i++) {
+      for (c = i, j = 0; j < 8; j++)
+        c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+      table[i] = c;
+    }
+  crc = ~crc;
+  while (len--)
+    crc = table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return (~crc);
+}
+
+static void snap_put(SNAPBUF *b, uint64_t v, int n) {
+  uint8_t *p;
+  int i;
+
+  if (b->len + n > b->cap) {
+    if ((p = realloc(b->p, b->cap * 2 + n)) == NULL) {
+      b->bad = 1;
+      return;
+    }
+    b->p = p;
+    b->cap = b->cap * 2 + n;
+  }
+  for (i = 0; i < n; i++)
+    b->p[b->len++] = v >> (8 * i);
+}
+
+static uint64_t snap_get(SNAPBUF *b, int n) {
+  uint64_t v = 0;
+  int i;
+
+  if (b->len + n > b->cap) {
+    b->bad = 1;
+    return (0);
+  }
+  for (i = 0; i < n; i++)
+    v |= (uint64_t)b->p[b->len++] << (8 * i);
+  return (v);
+}
+
+//
+// write a section whose payload is 'b' followed by 'len' bytes at
+// 'more'.  'more' is guest memory, which may be changing under us if
+// the machine is running (a migration): it goes out a piece at a time
+// through a copy, so the CRC is of what was written.
+//
+static int snap_section(FILE *f, uint32_t tag, SNAPBUF *b, const uint8_t *more, size_t len) {
+  SNAPBUF hdr = {0};
+  uint8_t piece[4096];
+  size_t done, n;
+  uint32_t crc;
+  int ok;
+
+  snap_put(&hdr, tag, 4);
+  snap_put(&hdr, b->len + len, 8);
+  crc = wd16_crc32(0, hdr.p, hdr.len);
+  crc = wd16_crc32(crc, b->p, b->len);
+  ok = !hdr.bad && !b->bad &&
+       (fwrite(hdr.p, 1, 12, f) == 12) &&
+       (fwrite(b->p, 1, b->len, f) == b->len);
+  for (done = 0; ok && (done < len); done += n) {
+    n = (len - done < sizeof(piece)) ? len - done : sizeof(piece);
+    memcpy(piece, more + done, n);
+    crc = wd16_crc32(crc, piece, n);
+    ok = (fwrite(piece, 1, n, f) == n);
+  }
+  snap_put(&hdr, crc, 4);               // goes after the payload
+  ok = ok && !hdr.bad && (fwrite(hdr.p + 12, 1, 4, f) == 4);
+  free(hdr.p);
+  return (ok);
+}
+
+static void snap_cpu(wd16_cpu_state_t* wd16_cpu_state, SNAPBUF *b) {
+  REGS *r = &wd16_cpu_state->regs;
+  uint16_t ps;
+  int i;
+
+  memcpy(&ps, &r->PS, sizeof(ps));
+  snap_put(b, r->instcount, 8);
+  for (i = 0; i < 8; i++)
+    snap_put(b, r->gpr[i], 2);
+  snap_put(b, ps, 2);
+  snap_put(b, r->trace, 4);
+  snap_put(b, r->BOOTing, 4);
+  snap_put(b, r->stepping, 4);
+  snap_put(b, r->tracing, 4);
+  snap_put(b, r->utrace, 4);
+  snap_put(b, r->utR0, 2);
+  snap_put(b, r->utRX, 2);
+  snap_put(b, r->utPC, 2);
+  snap_put(b, r->waiting, 4);
+  snap_put(b, r->intpending, 4);
+  for (i = 0; i < 9; i++)
+    snap_put(b, r->whichint[i], 1);
+  snap_put(b, r->LED, 1);
+  for (i = 0; i < 256; i++)
+    snap_put(b, wd16_cpu_state->oldPCs[i], 2);
+  snap_put(b, wd16_cpu_state->oldPCindex, 4);
+  snap_put(b, wd16_cpu_state->op, 2);
+  snap_put(b, wd16_cpu_state->opPC, 2);
+  for (i = 0; i < 16; i++)
+    snap_put(b, wd16_cpu_state->cpu4_svcctxt[i], 1);
+}
+
+
+//
+// a new snapshot id, nonzero and unlikely to be repeated by any other
+// snapshot of any machine
+//
+static uint64_t snap_newid(void) {
+  static uint64_t seq;
+  struct timespec ts;
+  uint64_t x;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  x = ((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec) ^ ((uint64_t)getpid() << 40) ^
+      (__atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED) * 0x9E3779B97F4A7C15ULL);
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;   // splitmix64's mix
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  x ^= x >> 31;
+  return (x ? x : 1);
+}
+
+static int snap_header(FILE *f) {
+  uint8_t ver[4] = {SNAP_VERSION, 0, 0, 0};
+
+  return ((fwrite(SNAP_MAGIC, 1, 8, f) == 8) && (fwrite(ver, 1, 4, f) == 4));
+}
+
+static int snap_link(FILE *f, SNAPBUF *b, uint64_t id, uint64_t parent) {
+  b->len = 0;
+  snap_put(b, id, 8);
+  snap_put(b, parent, 8);
+  return (snap_section(f, SNAP_LINK, b, NULL, 0));
+}
+
+static int snap_mem(FILE *f, SNAPBUF *b, uint32_t base, uint32_t size, const uint8_t *host) {
+  b->len = 0;
+  snap_put(b, base, 4);
+  snap_put(b, size, 4);
+  return (snap_section(f, SNAP_MEM, b, host, size));
+}
+
+static int snap_end(FILE *f, SNAPBUF *b) {
+  b->len = 0;
+  return (snap_section(f, SNAP_END, b, NULL, 0) && (fflush(f) == 0));
+}
+
+//
+// the start of every snapshot the machine writes: header, CPU, LINK
+//
+static int snap_begin(wd16_cpu_state_t* wd16_cpu_state, FILE *f, SNAPBUF *b, uint64_t id, uint64_t parent) {
+  int ok = snap_header(f);
+
+  b->len = 0;
+  snap_cpu(wd16_cpu_state, b);
+  ok = ok && snap_section(f, SNAP_CPU, b, NULL, 0);
+  return (ok && snap_link(f, b, id, parent));
+}
+
+//
+// is guest 'addr' in a page written since the last snapshot?  the dirty
+// map only covers the 64K the core can address, so anything a host has
+// registered above that is always saved.
+//
+static int snap_dirty(const uint64_t *map, uint64_t addr) {
+  uint32_t page = addr >> DIRTY_SHIFT;
+
+  return ((addr >= 65536) || ((map[page >> 6] >> (page & 63)) & 1));
+}
+
+//
+// the CPU and every registered region, as snapshot 'id'
+//
+static int snap_full(wd16_cpu_state_t* wd16_cpu_state, FILE *f, uint64_t id) {
+  SNAPBUF b = {0};
+  REGION *region;
+  int i, ok;
+
+  ok = snap_begin(wd16_cpu_state, f, &b, id, 0);
+  for (i = 0; ok && (i < wd16_cpu_state->mem.count); i++) {
+    region = &wd16_cpu_state->mem.region[i];
+    ok = snap_mem(f, &b, region->base, region->size, region->host);
+  }
+  ok = ok && snap_end(f, &b);
+  free(b.p);
+  return (ok);
+}
+
+int wd16_snapshot_write(wd16_cpu_state_t* wd16_cpu_state, FILE *f) {
+  uint64_t map[DIRTY_PAGES / 64] = {0}, id = snap_newid();
+  int ok;
+
+  // start the next delta's pages from here
+  if (wd16_cpu_state->snaplog)
+    cpu_dirty_fetch(wd16_cpu_state, wd16_cpu_state->snaplog, map);
+  else
+    wd16_cpu_state->snaplog = cpu_dirty_open(wd16_cpu_state);
+  ok = snap_full(wd16_cpu_state, f, id);
+  if (ok)
+    wd16_cpu_state->snapid = id;
+  else                                    // they go in the next one
+    cpu_dirty_unfetch(wd16_cpu_state, wd16_cpu_state->snaplog, map);
+  return (ok);
+}
+
+//
+// a full snapshot that leaves snapid and the dirty log alone
+//
+int wd16_snapshot_copy(wd16_cpu_state_t* wd16_cpu_state, FILE *f) {
+  return (snap_full(wd16_cpu_state, f, snap_newid()));
+}
+
+int wd16_snapshot_save(wd16_cpu_state_t* wd16_cpu_state, const char *path) {
+  FILE *f;
+  int ok;
+
+  if ((f = fopen(path, "wb")) == NULL)
+    return (false);
+  ok = wd16_snapshot_write(wd16_cpu_state, f);
+  return ((fclose(f) == 0) && ok);
+}
+
+//
+// the dirty pages of one region, a MEM section per run of them
+//
+static int snap_delta_region(FILE *f, SNAPBUF *b, REGION *region, const uint64_t *map) {
+  uint64_t addr = region->base, end = (uint64_t)region->base + region->size, from;
+  int ok = true;
+
+  while (ok && (addr < end)) {
+    if (!snap_dirty(map, addr)) {
+      addr = (addr | ((1 << DIRTY_SHIFT) - 1)) + 1;
+      continue;
+    }
+    for (from = addr; (addr < end) && snap_dirty(map, addr);)
+      addr = (addr | ((1 << DIRTY_SHIFT) - 1)) + 1;
+    if (addr > end)
+      addr = end;
+    ok = snap_mem(f, b, from, addr - from, region->host + (from - region->base));
+  }
+  return (ok);
+}
+
+//
+// a delta snapshot of what changed since the last snapshot this machine
+// saved or loaded.  false if there isn't one, or no dirty log was free
+// to follow it.
+//
+int wd16_snapshot_delta_write(wd16_cpu_state_t* wd16_cpu_state, FILE *f) {
+  SNAPBUF b = {0};
+  uint64_t map[DIRTY_PAGES / 64], id = snap_newid();
+  int i, ok;
+
+  if (!wd16_cpu_state->snaplog || !wd16_cpu_state->snapid)
+    return (false);
+  cpu_dirty_fetch(wd16_cpu_state, wd16_cpu_state->snaplog, map);
+  ok = snap_begin(wd16_cpu_state, f, &b, id, wd16_cpu_state->snapid);
+  for (i = 0; ok && (i < wd16_cpu_state->mem.count); i++)
+    ok = snap_delta_region(f, &b, &wd16_cpu_state->mem.region[i], map);
+  ok = ok && snap_end(f, &b);
+  free(b.p);
+  if (ok)
+    wd16_cpu_state->snapid = id;
+  else
+    cpu_dirty_unfetch(wd16_cpu_state, wd16_cpu_state->snaplog, map);
+  return (ok);
+}
+
+int wd16_snapshot_delta(wd16_cpu_state_t* wd16_cpu_state, const char *path) {
+  FILE *f;
+  int ok;
+
+  if ((f = fopen(path, "wb")) == NULL)
+    return (false);
+  ok = wd16_snapshot_delta_write(wd16_cpu_state, f);
+  return ((fclose(f) == 0) && ok);
+}
+
+//
+// read the next section into 'b', checking its CRC
+//
+static int snap_next(FILE *f, uint32_t *tag, SNAPBUF *b) {
+  uint8_t hdr[12], tail[4];
+  SNAPBUF h = {hdr, 0, sizeof(hdr), 0}, t = {tail, 0, sizeof(tail), 0};
+  uint64_t len;
+  uint32_t crc;
+
+  if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr))
+    return (false);
+  *tag = snap_get(&h, 4);
+  len = snap_get(&h, 8);
+  if (len > 0x100000008ULL)               // a 4GB region and its base/size
+    return (false);
+  free(b->p);
+  b->len = b->bad = 0;
+  b->cap = len;
+  if ((b->p = malloc(len ? len : 1)) == NULL)
+    return (false);
+  if ((fread(b->p, 1, len, f) != len) || (fread(tail, 1, sizeof(tail), f) != sizeof(tail)))
+    return (false);
+  crc = wd16_crc32(wd16_crc32(0, hdr, sizeof(hdr)), b->p, len);
+  return (crc == snap_get(&t, 4));
+}
+
+static void snap_restore_cpu(wd16_cpu_state_t* wd16_cpu_state, SNAPBUF *b) {
+  REGS *r = &wd16_cpu_state->regs;
+  uint64_t from = r->instcount;
+  uint16_t ps;
+  int i;
+
+  pthread_mutex_lock(&wd16_cpu_state->intlock_t);
+  r->instcount = snap_get(b, 8);
+  for (i = 0; i < 8; i++)
+    r->gpr[i] = snap_get(b, 2);
+  ps = snap_get(b, 2);
+  memcpy(&r->PS, &ps, sizeof(ps));
+  r->trace = snap_get(b, 4);
+  r->BOOTing = snap_get(b, 4);
+  r->stepping = snap_get(b, 4);
+  r->tracing = snap_get(b, 4);
+  r->utrace = snap_get(b, 4);
+  r->utR0 = snap_get(b, 2);
+  r->utRX = snap_get(b, 2);
+  r->utPC = snap_get(b, 2);
+  r->waiting = snap_get(b, 4);
+  r->intpending = snap_get(b, 4);
+  for (i = 0; i < 9; i++)
+    r->whichint[i] = snap_get(b, 1);
+  r->LED = snap_get(b, 1);
+  for (i = 0; i < 256; i++)
+    wd16_cpu_state->oldPCs[i] = snap_get(b, 2);
+  wd16_cpu_state->oldPCindex = snap_get(b, 4) % 256;
+  wd16_cpu_state->op = snap_get(b, 2);
+  wd16_cpu_state->opPC = snap_get(b, 2);
+  for (i = 0; i < 16; i++)
+    wd16_cpu_state->cpu4_svcctxt[i] = snap_get(b, 1);
+  pthread_mutex_unlock(&wd16_cpu_state->intlock_t);
+
+  cpu_event_rebase(wd16_cpu_state, from);
+  if (wd16_cpu_state->pace.ratio > 0)     // re-anchor to host time
+    cpu_pace_set(wd16_cpu_state, wd16_cpu_state->pace.ratio, wd16_cpu_state->pace.ips);
+}
+
+
+static void snap_free(SNAPFILE *s) {
+  int i;
+
+  for (i = 0; i < s->n; i++)
+    free(s->mem[i].data);
+  free(s->mem);
+  free(s->cpu.p);
+}
+
+static void snap_free_chain(SNAPFILE *file, int n) {
+  int i;
+
+  for (i = 0; file && (i < n); i++)
+    snap_free(&file[i]);
+  free(file);
+}
+
+//
+// read and check every section of one snapshot into 's'
+//
+static int snap_stage(FILE *f, SNAPFILE *s) {
+  SNAPBUF b = {0};
+  SNAPMEM *m;
+  uint8_t hdr[12];
+  uint32_t tag = 0;
+  int ok;
+
+  if ((fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr)) || memcmp(hdr, SNAP_MAGIC, 8) ||
+      (hdr[8] < 1) || (hdr[8] > SNAP_VERSION))
+    return (false);
+
+  while ((ok = snap_next(f, &tag, &b)) && (tag != SNAP_END)) {
+    if (tag == SNAP_CPU) {
+      free(s->cpu.p);
+      s->cpu = b;
+      b.p = NULL;
+      ok = (s->cpu.cap >= SNAP_CPU_LEN);
+    } else if (tag == SNAP_MEM) {
+      if ((m = realloc(s->mem, (s->n + 1) * sizeof(SNAPMEM))) == NULL)
+        break;
+      s->mem = m;
+      m = &s->mem[s->n++];
+      m->base = snap_get(&b, 4);
+      m->size = snap_get(&b, 4);
+      m->data = b.p;
+      m->host = NULL;
+      b.p = NULL;
+      ok = !b.bad && (b.cap - 8 == m->size);
+    } else if (tag == SNAP_LINK) {
+      s->id = snap_get(&b, 8);
+      s->parent = snap_get(&b, 8);
+      ok = !b.bad && (b.cap >= SNAP_LINK_LEN);
+    }
+    if (!ok)
+      break;
+  }
+  free(b.p);
+  return (ok && (tag == SNAP_END) && (s->cpu.p != NULL));
+}
+
+//
+// stage a full snapshot and the deltas after it, checking each one is
+// the child of the one before
+//
+static int snap_stage_chain(const char *const *paths, int n, SNAPFILE **chain) {
+  SNAPFILE *file;
+  FILE *f;
+  int i, ok;
+
+  if ((n < 1) || ((*chain = file = calloc(n, sizeof(SNAPFILE))) == NULL))
+    return (false);
+  for (ok = true, i = 0; ok && (i < n); i++) {
+    if ((f = fopen(paths[i], "rb")) == NULL)
+      return (false);
+    ok = snap_stage(f, &file[i]);
+    fclose(f);
+    if (i == 0)
+      ok = ok && (file[i].parent == 0);
+    else
+      ok = ok && file[i].parent && (file[i].parent == file[i - 1].id);
+  }
+  return (ok);
+}
+
+//
+// set the dirty map bits of guest 'base'..'base'+'size'-1
+//
+static void snap_pages(uint64_t *map, uint32_t base, uint32_t size) {
+  uint64_t addr;
+
+  for (addr = base & ~((1 << DIRTY_SHIFT) - 1); (addr < (uint64_t)base + size) && (addr < 65536); addr += 1 << DIRTY_SHIFT)
+    map[addr >> (DIRTY_SHIFT + 6)] |= 1ull << ((addr >> DIRTY_SHIFT) & 63);
+}
+
+//
+// snapshot 'id' has been loaded, changing the pages in 'map'.  the next
+// delta is of changes from it, but to anyone else following the machine
+// (a baseline, say) what was loaded is a change.
+//
+static void snap_loaded(wd16_cpu_state_t* wd16_cpu_state, uint64_t id, const uint64_t *map) {
+  if (wd16_cpu_state->snaplog)
+    cpu_dirty_fetch(wd16_cpu_state, wd16_cpu_state->snaplog, NULL);
+  else
+    wd16_cpu_state->snaplog = cpu_dirty_open(wd16_cpu_state);
+  cpu_dirty_others(wd16_cpu_state, wd16_cpu_state->snaplog, map);
+  wd16_cpu_state->snapid = id;
+}
+
+//
+// make staged snapshots, oldest first, the machine's state.  nothing
+// changes unless all of their memory is somewhere it can go.
+//
+static int snap_apply(wd16_cpu_state_t* wd16_cpu_state, SNAPFILE *file, int n) {
+  uint64_t map[DIRTY_PAGES / 64] = {0};
+  SNAPMEM *m;
+  int i, j;
+
+  for (i = 0; i < n; i++)
+    for (j = 0; j < file[i].n; j++) {
+      m = &file[i].mem[j];
+      if ((m->host = cpu_mem_host(wd16_cpu_state, m->base, m->size)) == NULL)
+        return (false);
+    }
+  for (i = 0; i < n; i++)
+    for (j = 0; j < file[i].n; j++) {
+      m = &file[i].mem[j];
+      memcpy(m->host, m->data + 8, m->size);
+      snap_pages(map, m->base, m->size);
+    }
+  snap_restore_cpu(wd16_cpu_state, &file[n - 1].cpu);
+  snap_loaded(wd16_cpu_state, file[n - 1].id, map);
+  return (true);
+}
+
+int wd16_snapshot_read(wd16_cpu_state_t* wd16_cpu_state, FILE *f) {
+  SNAPFILE s = {0};
+  int ok;
+
+  ok = snap_stage(f, &s) && (s.parent == 0) && snap_apply(wd16_cpu_state, &s, 1);
+  snap_free(&s);
+  return (ok);
+}
+
+//
+// apply a delta to the machine as it is, which must be the state its
+// parent was saved or loaded in
+//
+int wd16_snapshot_delta_read(wd16_cpu_state_t* wd16_cpu_state, FILE *f) {
+  SNAPFILE s = {0};
+  int ok;
+
+  ok = snap_stage(f, &s) && s.parent && (s.parent == wd16_cpu_state->snapid) && snap_apply(wd16_cpu_state, &s, 1);
+  snap_free(&s);
+  return (ok);
+}
+
+int wd16_snapshot_load(wd16_cpu_state_t* wd16_cpu_state, const char *path) {
+  FILE *f;
+  int ok;
+
+  if ((f = fopen(path, "rb")) == NULL)
+    return (false);
+  ok = wd16_snapshot_read(wd16_cpu_state, f);
+  fclose(f);
+  return (ok);
+}
+
+//
+// restore a full snapshot and the 'n'-1 deltas saved after it
+//
+int wd16_snapshot_chain(wd16_cpu_state_t* wd16_cpu_state, const char *const *paths, int n) {
+  SNAPFILE *file = NULL;
+  int ok;
+
+  ok = snap_stage_chain(paths, n, &file) && snap_apply(wd16_cpu_state, file, n);
+  snap_free_chain(file, n);
+  return (ok);
+}
+
+//
+// lazy loading.  a big snapshot's memory can take longer to read than
+// the machine needs to get going, so wd16_snapshot_lazy() maps the file,
+// restores the CPU, and leaves the memory to be filled in behind it:
+// each whole host page of a MEM section is replaced with fresh private
+// anonymous memory at the same address and registered with
+// userfaultfd.  the first touch of a page waits while a background
+// thread copies it in from the file; the rest of the time the thread
+// prefetches the pages in order.  the time to the first instruction is
+// the time to walk the section headers, whatever the size of memory.
+//
+// the partial pages at the ends of a section are copied straight away,
+// as is everything if userfaultfd isn't available.  MEM sections' CRCs
+// are checked once all of their pages are in, and the result is
+// wd16_snapshot_lazy_wait()'s.  a forked child wouldn't see the pages
+// still to come, so the fork server waits for them first.
+//
+#define LAZY_CHUNK (64 * 1024)          /* bytes prefetched at once  */
+
+typedef struct _LAZYMEM {               /* One section being filled  */
+  SNAPMEM m;                            /* data points into the file */
+  const uint8_t *sect;                  /* section, for its CRC      */
+  uint64_t len;                         /* payload length            */
+  uintptr_t lo, hi;                     /* pages filled on demand    */
+  uintptr_t next;                       /* next page to prefetch     */
+
+} LAZYMEM;
+
+typedef struct _SNAPLAZY {              /* Lazy load in progress     */
+  int uffd;                             /* -1 once finished          */
+  uint8_t *file;                        /* the snapshot, mapped      */
+  size_t size;
+  size_t page;                          /* host page size            */
+  LAZYMEM *mem;
+  int n;
+  SNAPBUF cpu;                          /* CPU section, in the file  */
+  uint64_t id;
+  int ok;                               /* MEM CRCs matched          */
+  pthread_t thread;
+
+} SNAPLAZY;
+
+//
+// walk the mapped file's sections, checking all but the MEM CRCs
+//
+static int lazy_stage(SNAPLAZY *z) {
+  SNAPBUF h;
+  LAZYMEM *lm;
+  const uint8_t *payload;
+  uint64_t len;
+  uint32_t tag, crc;
+  size_t off = 12;
+
+  if ((z->size < 12) || memcmp(z->file, SNAP_MAGIC, 8) || (z->file[8] < 1) || (z->file[8] > SNAP_VERSION))
+    return (false);
+  for (;;) {
+    if (z->size - off < 16)
+      return (false);
+    h = (SNAPBUF){z->file + off, 0, 12, 0};
+    tag = snap_get(&h, 4);
+    len = snap_get(&h, 8);
+    if (len > z->size - off - 16)
+      return (false);
+    payload = z->file + off + 12;
+    h = (SNAPBUF){(uint8_t *)payload + len, 0, 4, 0};
+    crc = snap_get(&h, 4);
+    if ((tag != SNAP_MEM) && (crc != wd16_crc32(0, z->file + off, 12 + len)))
+      return (false);
+    if (tag == SNAP_END)
+      break;
+    if (tag == SNAP_CPU) {
+      z->cpu = (SNAPBUF){(uint8_t *)payload, 0, len, 0};
+      if (len < SNAP_CPU_LEN)
+        return (false);
+    } else if (tag == SNAP_MEM) {
+      if ((lm = realloc(z->mem, (z->n + 1) * sizeof(LAZYMEM))) == NULL)
+        return (false);
+      z->mem = lm;
+      lm = &z->mem[z->n++];
+      memset(lm, 0, sizeof(LAZYMEM));
+      h = (SNAPBUF){(uint8_t *)payload, 0, len, 0};
+      lm->m.base = snap_get(&h, 4);
+      lm->m.size = snap_get(&h, 4);
+      lm->m.data = (uint8_t *)payload;
+      lm->sect = z->file + off;
+      lm->len = len;
+      if (h.bad || (len - 8 != lm->m.size))
+        return (false);
+    } else if (tag == SNAP_LINK) {
+      h = (SNAPBUF){(uint8_t *)payload, 0, len, 0};
+      z->id = snap_get(&h, 8);
+      if ((len < SNAP_LINK_LEN) || (snap_get(&h, 8) != 0))
+        return (false);                   // deltas need their parents
+    }
+    off += 16 + len;
+  }
+  return (z->cpu.p != NULL);
+}
+
+//
+// copy 'len' bytes of 'lm' from host address 'at' in through
+// userfaultfd, skipping pages something else filled first
+//
+static void lazy_copy(SNAPLAZY *z, LAZYMEM *lm, uintptr_t at, uintptr_t len) {
+  struct uffdio_copy copy;
+  uintptr_t end = at + len;
+
+  while (at < end) {
+    copy.dst = at;
+    copy.src = (uintptr_t)(lm->m.data + 8 + (at - (uintptr_t)lm->m.host));
+    copy.len = end - at;
+    copy.mode = 0;
+    copy.copy = 0;
+    if (ioctl(z->uffd, UFFDIO_COPY, &copy) == 0)
+      return;
+    if ((errno != EEXIST) && (errno != EAGAIN))
+      return;
+    if (copy.copy > 0)
+      at += copy.copy;
+    else if (errno == EEXIST)
+      at += z->page;
+  }
+}
+
+//
+// the page a fault is waiting for
+//
+static void lazy_fault(SNAPLAZY *z) {
+  struct uffd_msg msg;
+  uintptr_t addr;
+  int i;
+
+  while (read(z->uffd, &msg, sizeof(msg)) == sizeof(msg)) {
+    if (msg.event != UFFD_EVENT_PAGEFAULT)
+      continue;
+    addr = msg.arg.pagefault.address & ~(uintptr_t)(z->page - 1);
+    for (i = 0; i < z->n; i++)
+      if ((addr >= z->mem[i].lo) && (addr < z->mem[i].hi))
+        lazy_copy(z, &z->mem[i], addr, z->page);
+  }
+}
+
+static void *lazy_thread(void *arg) {
+  SNAPLAZY *z = arg;
+  struct pollfd pfd = {z->uffd, POLLIN, 0};
+  struct uffdio_range range;
+  LAZYMEM *lm;
+  uintptr_t len;
+  int i = 0;
+
+  while (i < z->n) {
+    if (poll(&pfd, 1, 0) > 0)
+      lazy_fault(z);
+    lm = &z->mem[i];
+    if (lm->next >= lm->hi) {
+      i++;
+      continue;
+    }
+    len = (lm->hi - lm->next < LAZY_CHUNK) ? lm->hi - lm->next : LAZY_CHUNK;
+    lazy_copy(z, lm, lm->next, len);
+    lm->next += len;
+  }
+
+  // every page is in: hand the memory back and check what it was
+  for (i = 0; i < z->n; i++) {
+    lm = &z->mem[i];
+    range.start = lm->lo;
+    range.len = lm->hi - lm->lo;
+    if (range.len)
+      ioctl(z->uffd, UFFDIO_UNREGISTER, &range);
+  }
+  close(z->uffd);
+  z->uffd = -1;
+  z->ok = true;
+  for (i = 0; i < z->n; i++) {
+    lm = &z->mem[i];
+    if (wd16_crc32(0, lm->sect, 12 + lm->len) != snap_get(&(SNAPBUF){(uint8_t *)lm->sect + 12 + lm->len, 0, 4, 0}, 4))
+      z->ok = false;
+  }
+  munmap(z->file, z->size);
+  z->file = NULL;
+  return (NULL);
+}
+
+//
+// set up one section: its whole pages lazily if they can be, the rest
+// now.  false only if memory couldn't be remapped.
+//
+static int lazy_region(SNAPLAZY *z, LAZYMEM *lm) {
+  struct uffdio_register reg;
+  uintptr_t host = (uintptr_t)lm->m.host, end = host + lm->m.size;
+
+  lm->lo = (host + z->page - 1) & ~(uintptr_t)(z->page - 1);
+  lm->hi = end & ~(uintptr_t)(z->page - 1);
+  if ((z->uffd < 0) || (lm->hi <= lm->lo)) {
+    lm->lo = lm->hi = lm->next = 0;
+    memcpy(lm->m.host, lm->m.data + 8, lm->m.size);
+    return (true);
+  }
+  memcpy(lm->m.host, lm->m.data + 8, lm->lo - host);
+  memcpy((uint8_t *)lm->hi, lm->m.data + 8 + (lm->hi - host), end - lm->hi);
+  if (mmap((void *)lm->lo, lm->hi - lm->lo, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+    return (false);
+  reg.range.start = lm->lo;
+  reg.range.len = lm->hi - lm->lo;
+  reg.mode = UFFDIO_REGISTER_MODE_MISSING;
+  if (ioctl(z->uffd, UFFDIO_REGISTER, &reg) < 0) {
+    memcpy((uint8_t *)lm->lo, lm->m.data + 8 + (lm->lo - host), lm->hi - lm->lo);
+    lm->lo = lm->hi = 0;
+  }
+  lm->next = lm->lo;
+  return (true);
+}
+
+static void lazy_free(SNAPLAZY *z) {
+  if (z->uffd >= 0)
+    close(z->uffd);
+  if (z->file)
+    munmap(z->file, z->size);
+  free(z->mem);
+  free(z);
+}
+
+//
+// load the full snapshot at 'path', with its memory to follow.  the
+// memory of its MEM sections is remapped, so the host mustn't depend
+// on it being shared.  false with the machine as it was if the file
+// isn't a snapshot that fits it; but if remapping its memory fails
+// part way, that memory is neither old nor new and the CPU is left as
+// it was, so the machine can't run until something else is loaded.
+//
+int wd16_snapshot_lazy(wd16_cpu_state_t* wd16_cpu_state, const char *path) {
+  struct uffdio_api api = {UFFD_API, 0, 0};
+  uint64_t map[DIRTY_PAGES / 64] = {0};
+  struct stat st;
+  SNAPLAZY *z;
+  int fd, i, ok;
+
+  wd16_snapshot_lazy_wait(wd16_cpu_state);
+  if ((z = calloc(1, sizeof(SNAPLAZY))) == NULL)
+    return (false);
+  z->uffd = -1;
+  z->page = sysconf(_SC_PAGESIZE);
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    free(z);
+    return (false);
+  }
+  if ((fstat(fd, &st) == 0) && (st.st_size > 0)) {
+    z->size = st.st_size;
+    if ((z->file = mmap(NULL, z->size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+      z->file = NULL;
+  }
+  close(fd);
+  ok = (z->file != NULL) && lazy_stage(z);
+  for (i = 0; ok && (i < z->n); i++)
+    ok = ((z->mem[i].m.host = cpu_mem_host(wd16_cpu_state, z->mem[i].m.base, z->mem[i].m.size)) != NULL);
+  if (!ok) {
+    lazy_free(z);
+    return (false);
+  }
+
+  // from here on the machine changes
+  if ((z->uffd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK)) >= 0 && (ioctl(z->uffd, UFFDIO_API, &api) < 0)) {
+    close(z->uffd);
+    z->uffd = -1;
+  }
+  for (i = 0; ok && (i < z->n); i++) {
+    ok = lazy_region(z, &z->mem[i]);
+    snap_pages(map, z->mem[i].m.base, z->mem[i].m.size);
+  }
+  if (!ok) {
+    lazy_free(z);
+    return (false);
+  }
+  snap_restore_cpu(wd16_cpu_state, &z->cpu);
+  snap_loaded(wd16_cpu_state, z->id, map);
+  if ((z->uffd >= 0) && (pthread_create(&z->thread, NULL, lazy_thread, z) == 0)) {
+    wd16_cpu_state->snaplazy = z;
+    return (true);
+  }
+  // no thread to fill pages, so it has to be done here
+  if (z->uffd >= 0)
+    lazy_thread(z);
+  else
+    z->ok = true;
+  ok = z->ok;
+  lazy_free(z);
+  return (ok);
+}
+
+//
+// wait for a lazy load's memory to be all in.  false if its CRCs were
+// wrong; true if there wasn't one.
+//
+int wd16_snapshot_lazy_wait(wd16_cpu_state_t* wd16_cpu_state) {
+  SNAPLAZY *z = wd16_cpu_state->snaplazy;
+  int ok;
+
+  if (z == NULL)
+    return (true);
+  pthread_join(z->thread, NULL);
+  ok = z->ok;
+  wd16_cpu_state->snaplazy = NULL;
+  lazy_free(z);
+  return (ok);
+}
+
+//
+// sync the directory holding 'path', so a rename into it is on disk
+//
+static int snap_syncdir(const char *path) {
+  char *dir, *slash;
+  int fd, ok;
+
+  if ((dir = strdup(path)) == NULL)
+    return (false);
+  if ((slash = strrchr(dir, '/')) == NULL)
+    strcpy(dir, ".");
+  else if (slash == dir)
+    slash[1] = 0;
+  else
+    *slash = 0;
+  ok = ((fd = open(dir, O_RDONLY | O_DIRECTORY)) >= 0) && (fsync(fd) == 0);
+  if (fd >= 0)
+    close(fd);
+  free(dir);
+  return (ok);
+}
+
+//
+// merge a chain into one full snapshot at 'out', which keeps the id of
+// the chain's last delta so later deltas still follow on from it.  the
+// file is written beside 'out', synced and renamed over it, so a crash
+// leaves the old one or the new, never part of either.  the machine isn't involved, so this can run while it
+// does.
+//
+int wd16_snapshot_compact(const char *const *paths, int n, const char *out) {
+  SNAPFILE *file = NULL, *last;
+  SNAPMEM *m, *to;
+  SNAPBUF b = {0}, cpu;
+  char *tmp = NULL;
+  FILE *f = NULL;
+  int i, j, k, ok;
+
+  ok = snap_stage_chain(paths, n, &file) && ((tmp = malloc(strlen(out) + 5)) != NULL);
+
+  // lay each delta's pages over the full snapshot's memory
+  for (i = 1; ok && (i < n); i++)
+    for (j = 0; ok && (j < file[i].n); j++) {
+      m = &file[i].mem[j];
+      for (to = NULL, k = 0; k < file[0].n; k++)
+        if ((m->base >= file[0].mem[k].base) &&
+            ((uint64_t)m->base + m->size <= (uint64_t)file[0].mem[k].base + file[0].mem[k].size))
+          to = &file[0].mem[k];
+      if ((ok = (to != NULL)))
+        memcpy(to->data + 8 + (m->base - to->base), m->data + 8, m->size);
+    }
+
+  if (ok) {
+    last = &file[n - 1];
+    cpu = last->cpu;
+    cpu.len = cpu.cap;
+    sprintf(tmp, "%s.tmp", out);
+    ok = ((f = fopen(tmp, "wb")) != NULL) && snap_header(f) &&
+         snap_section(f, SNAP_CPU, &cpu, NULL, 0) && snap_link(f, &b, last->id, 0);
+    for (k = 0; ok && (k < file[0].n); k++)
+      ok = snap_mem(f, &b, file[0].mem[k].base, file[0].mem[k].size, file[0].mem[k].data + 8);
+    ok = ok && snap_end(f, &b) && (fflush(f) == 0) && (fsync(fileno(f)) == 0);
+    if (f && (fclose(f) != 0))
+      ok = false;
+    if (f && (!ok || (rename(tmp, out) != 0))) {
+      unlink(tmp);
+      ok = false;
+    }
+    ok = ok && snap_syncdir(out);
+  }
+  free(b.p);
+  free(tmp);
+  snap_free_chain(file, n);
+  return (ok);
+}
@@ -0,0 +1,55 @@
+/* wd16-snap.h   (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#ifndef __WD16_SNAP_H__
+#define __WD16_SNAP_H__
+
+#include "wd16.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+int      wd16_snapshot_save(wd16_cpu_state_t* wd16_cpu_state, const char *path);
+int      wd16_snapshot_load(wd16_cpu_state_t* wd16_cpu_state, const char *path);
+int      wd16_snapshot_write(wd16_cpu_state_t* wd16_cpu_state, FILE *f);
+int      wd16_snapshot_copy(wd16_cpu_state_t* wd16_cpu_state, FILE *f);
+int      wd16_snapshot_read(wd16_cpu_state_t* wd16_cpu_state, FILE *f);
+int      wd16_snapshot_delta(wd16_cpu_state_t* wd16_cpu_state, const char *path);
+int      wd16_snapshot_delta_write(wd16_cpu_state_t* wd16_cpu_state, FILE *f);
+int      wd16_snapshot_delta_read(wd16_cpu_state_t* wd16_cpu_state, FILE *f);
+int      wd16_snapshot_lazy(wd16_cpu_state_t* wd16_cpu_state, const char *path);
+int      wd16_snapshot_lazy_wait(wd16_cpu_state_t* wd16_cpu_state);
+int      wd16_snapshot_chain(wd16_cpu_state_t* wd16_cpu_state, const char *const *paths, int n);
+int      wd16_snapshot_compact(const char *const *paths, int n, const char *out);
+uint32_t wd16_crc32(uint32_t crc, const void *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,444 @@
+/* wd16-tt.c     (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#include "wd16-tt.h"
+#include "cpu-dirty.h"
+#include "cpu-event.h"
+#include "cpu-rr.h"
+
+//
+// Time travel.  oldPCs[] only goes back 256 instructions; this goes
+// back as far as the checkpoints kept.  While it is on, the inputs are
+// recorded (cpu-rr.c) and every 'every' instructions an event takes a
+// checkpoint: the CPU state, the event queue, where the input log had
+// got to, and the pages of guest memory written since the checkpoint
+// before, found from a dirty log of its own.  the oldest checkpoint
+// has the whole of memory instead, and the next one is folded into it
+// when a new one needs the room.
+//
+// any earlier instruction is reached by restoring the nearest
+// checkpoint before it and replaying from there; the replay goes on
+// to where the machine was, and then it runs live again.  restoring
+// puts back only the pages written since, each as the newest
+// checkpoint at or before the one restored had it.
+//
+// the cost while running is the recording, one atomic OR per store for
+// the dirty log, and copying the pages written every 'every'
+// instructions.  only memory in regions (cpu_mem_region()) below 64K
+// goes back in time; disk contents and device state don't, so a guest
+// that reads back a record written later sees the later data.  events
+// in the queue are restored with it, so their callbacks must cope
+// with running again.  the calls below need the CPU stopped.
+//
+
+#define TT_PAGE (1 << DIRTY_SHIFT)
+
+typedef struct _TTCKPT {                /* One checkpoint            */
+  uint64_t pos;                         /* next input log entry      */
+  int event;                            /* our event id, then        */
+  REGS regs;
+  uint16_t oldPCs[256];
+  unsigned oldPCindex;
+  uint16_t op, opPC;
+  char cpu4_svcctxt[16];
+  EVENTQ events;
+  AMIDLE amidle;
+  uint64_t pace_next;
+  uint64_t map[DIRTY_PAGES / 64];       /* pages written since last  */
+  uint8_t *data;                        /* ... as they are here      */
+
+} TTCKPT;
+
+typedef struct _TIMETRAVEL {            /* Checkpoint ring           */
+  uint64_t every;                       /* instructions between      */
+  int event;                            /* checkpoint event id       */
+  int log;                              /* dirty log                 */
+  int recording;                        /* we started cpu-rr         */
+  uint64_t have[DIRTY_PAGES / 64];      /* pages held by regions     */
+  uint8_t image[65536];                 /* memory at the oldest      */
+  int keep, head, count;
+  TTCKPT *ring;                         /* oldest at 'head'          */
+
+} TIMETRAVEL;
+
+static TTCKPT *tt_ckpt(TIMETRAVEL *tt, int i) {
+  return (&tt->ring[(tt->head + i) % tt->keep]);
+}
+
+//
+// copy page 'page' between guest memory and 'buf', as much of it as
+// regions hold
+//
+static void tt_page(wd16_cpu_state_t* wd16_cpu_state, int page, uint8_t *buf, int toguest) {
+  uint32_t addr = page << DIRTY_SHIFT, from, to;
+  REGION *region;
+  int i;
+
+  for (i = 0; i < wd16_cpu_state->mem.count; i++) {
+    region = &wd16_cpu_state->mem.region[i];
+    from = (addr > region->base) ? addr : region->base;
+    to = (addr + TT_PAGE < (uint64_t)region->base + region->size) ? addr + TT_PAGE : region->base + region->size;
+    if (from >= to)
+      continue;
+    if (toguest)
+      memcpy(region->host + (from - region->base), buf + (from - addr), to - from);
+    else
+      memcpy(buf + (from - addr), region->host + (from - region->base), to - from);
+  }
+}
+
+//
+// where checkpoint 'ck' keeps page 'page', or NULL if it doesn't
+//
+static uint8_t *tt_find(TTCKPT *ck, int page) {
+  int i, n = 0;
+
+  if (!(ck->map[page >> 6] & ((uint64_t)1 << (page & 63))))
+    return (NULL);
+  for (i = 0; i < (page >> 6); i++)
+    n += __builtin_popcountll(ck->map[i]);
+  n += __builtin_popcountll(ck->map[page >> 6] & (((uint64_t)1 << (page & 63)) - 1));
+  return (ck->data + n * TT_PAGE);
+}
+
+static void tt_drop(TTCKPT *ck) {
+  free(ck->data);
+  ck->data = NULL;
+}
+
+//
+// fold the second oldest checkpoint into the image, making it the
+// oldest
+//
+static void tt_evict(wd16_cpu_state_t* wd16_cpu_state) {
+  TIMETRAVEL *tt = wd16_cpu_state->tt;
+  TTCKPT *next = tt_ckpt(tt, 1);
+  uint8_t *data = next->data;
+  uint64_t bits;
+  int i, page;
+
+  for (i = 0; i < DIRTY_PAGES / 64; i++)
+    for (bits = next->map[i]; bits; bits &= bits - 1) {
+      page = (i << 6) + __builtin_ctzll(bits);
+      memcpy(tt->image + page * TT_PAGE, data, TT_PAGE);
+      data += TT_PAGE;
+    }
+  tt_drop(next);
+  memset(next->map, 0, sizeof(next->map));
+  tt->head = (tt->head + 1) % tt->keep;
+  tt->count--;
+  cpu_rr_trim(wd16_cpu_state, next->pos);
+}
+
+static void tt_save(wd16_cpu_state_t* wd16_cpu_state, TTCKPT *ck) {
+  pthread_mutex_lock(&wd16_cpu_state->intlock_t);
+  ck->regs = wd16_cpu_state->regs;
+  pthread_mutex_unlock(&wd16_cpu_state->intlock_t);
+  ck->pos = wd16_cpu_state->rr.pos;
+  ck->event = wd16_cpu_state->tt->event;
+  memcpy(ck->oldPCs, wd16_cpu_state->oldPCs, sizeof(ck->oldPCs));
+  ck->oldPCindex = wd16_cpu_state->oldPCindex;
+  ck->op = wd16_cpu_state->op;
+  ck->opPC = wd16_cpu_state->opPC;
+  memcpy(ck->cpu4_svcctxt, wd16_cpu_state->cpu4_svcctxt, sizeof(ck->cpu4_svcctxt));
+  ck->events = wd16_cpu_state->events;
+  ck->amidle = wd16_cpu_state->amidle;
+  ck->pace_next = wd16_cpu_state->pace.next;
+}
+
+//
+// take a checkpoint of the machine as it is now
+//
+static int tt_checkpoint(wd16_cpu_state_t* wd16_cpu_state) {
+  TIMETRAVEL *tt = wd16_cpu_state->tt;
+  TTCKPT *ck;
+  uint64_t bits;
+  uint8_t *data;
+  int i, n = 0;
+
+  if (tt->count == tt->keep)
+    tt_evict(wd16_cpu_state);
+  ck = tt_ckpt(tt, tt->count);
+  cpu_dirty_fetch(wd16_cpu_state, tt->log, ck->map);
+  for (i = 0; i < DIRTY_PAGES / 64; i++) {
+    ck->map[i] &= tt->have[i];
+    n += __builtin_popcountll(ck->map[i]);
+  }
+  ck->data = NULL;
+  if (n && ((ck->data = malloc(n * TT_PAGE)) == NULL)) {
+    cpu_dirty_unfetch(wd16_cpu_state, tt->log, ck->map);
+    return (false);
+  }
+  for (i = 0, data = ck->data; i < DIRTY_PAGES / 64; i++)
+    for (bits = ck->map[i]; bits; bits &= bits - 1) {
+      tt_page(wd16_cpu_state, (i << 6) + __builtin_ctzll(bits), data, false);
+      data += TT_PAGE;
+    }
+  tt_save(wd16_cpu_state, ck);
+  tt->count++;
+  return (true);
+}
+
+static void tt_event(void *arg) {
+  wd16_cpu_state_t* wd16_cpu_state = arg;
+  TIMETRAVEL *tt = wd16_cpu_state->tt;
+
+  tt->event = cpu_event_schedule(wd16_cpu_state, tt->every, tt_event, wd16_cpu_state);
+  tt_checkpoint(wd16_cpu_state);
+}
+
+//
+// put the machine back as it was at checkpoint 'k', dropping the ones
+// after it, and replay from there to 'until'
+//
+static void tt_restore(wd16_cpu_state_t* wd16_cpu_state, int k, uint64_t until) {
+  TIMETRAVEL *tt = wd16_cpu_state->tt;
+  TTCKPT *ck = tt_ckpt(tt, k);
+  uint64_t map[DIRTY_PAGES / 64], bits;
+  REGS *r = &wd16_cpu_state->regs;
+  AMIDLE idle = wd16_cpu_state->amidle;
+  uint8_t *src;
+  int i, j, page, halting;
+
+  cpu_dirty_fetch(wd16_cpu_state, tt->log, map);
+  for (j = k + 1; j < tt->count; j++)
+    for (i = 0; i < DIRTY_PAGES / 64; i++)
+      map[i] |= tt_ckpt(tt, j)->map[i];
+  for (i = 0; i < DIRTY_PAGES / 64; i++) {
+    map[i] &= tt->have[i];
+    for (bits = map[i]; bits; bits &= bits - 1) {
+      page = (i << 6) + __builtin_ctzll(bits);
+      for (j = k, src = NULL; (j > 0) && (src == NULL); j--)
+        src = tt_find(tt_ckpt(tt, j), page);
+      tt_page(wd16_cpu_state, page, src ? src : tt->image + page * TT_PAGE, true);
+    }
+  }
+  cpu_dirty_others(wd16_cpu_state, tt->log, map);
+  for (j = k + 1; j < tt->count; j++)
+    tt_drop(tt_ckpt(tt, j));
+  tt->count = k + 1;
+
+  pthread_mutex_lock(&wd16_cpu_state->intlock_t);
+  halting = r->halting;
+  *r = ck->regs;
+  r->halting = halting;
+  pthread_mutex_unlock(&wd16_cpu_state->intlock_t);
+  memcpy(wd16_cpu_state->oldPCs, ck->oldPCs, sizeof(ck->oldPCs));
+  wd16_cpu_state->oldPCindex = ck->oldPCindex;
+  wd16_cpu_state->op = ck->op;
+  wd16_cpu_state->opPC = ck->opPC;
+  memcpy(wd16_cpu_state->cpu4_svcctxt, ck->cpu4_svcctxt, sizeof(ck->cpu4_svcctxt));
+  wd16_cpu_state->events = ck->events;
+  wd16_cpu_state->amidle = ck->amidle;
+  wd16_cpu_state->amidle.on = idle.on;      // settings and counters stay
+  wd16_cpu_state->amidle.lo = idle.lo;
+  wd16_cpu_state->amidle.hi = idle.hi;
+  wd16_cpu_state->amidle.parked = idle.parked;
+  wd16_cpu_state->amidle.parked_ns = idle.parked_ns;
+  wd16_cpu_state->pace.next = ck->pace_next;
+  wd16_cpu_state->pace.anchor_ns = 0;
+  tt->event = ck->event;
+
+  cpu_rr_replay(wd16_cpu_state, ck->pos, until, RR_RECORD);
+}
+
+//
+// the newest checkpoint at or before 'instcount', -1 if none
+//
+static int tt_before(TIMETRAVEL *tt, uint64_t instcount) {
+  int k;
+
+  for (k = tt->count - 1; k >= 0; k--)
+    if (tt_ckpt(tt, k)->regs.instcount <= instcount)
+      break;
+  return (k);
+}
+
+//
+// where the machine really is: the end of the replay, if in one
+//
+static uint64_t tt_present(wd16_cpu_state_t* wd16_cpu_state) {
+  if (wd16_cpu_state->rr.mode == RR_REPLAY)
+    return (wd16_cpu_state->rr.until);
+  return (wd16_cpu_state->regs.instcount);
+}
+
+//
+// from checkpoint 'k', the last instruction boundary before 'limit',
+// or if 'pc' isn't -1 the last one that went on to run the instruction
+// at 'pc' (which may be after taking an interrupt).  0 if none.
+//
+static uint64_t tt_scan(wd16_cpu_state_t* wd16_cpu_state, int k, uint64_t limit, int pc, uint64_t until) {
+  REGS *r = &wd16_cpu_state->regs;
+  uint64_t found = 0, at;
+
+  tt_restore(wd16_cpu_state, k, until);
+  while ((r->instcount < limit) && !r->waiting) {
+    at = r->instcount;
+    cpu_step();
+    if ((pc < 0) || (wd16_cpu_state->opPC == pc))
+      found = at;
+  }
+  return (found);
+}
+
+/*-------------------------------------------------------------------*/
+/* public                                                            */
+/*-------------------------------------------------------------------*/
+
+//
+// start checkpointing every 'every' instructions (0 for WD16_TT_EVERY),
+// keeping the last 'keep' (0 for WD16_TT_KEEP), and recording inputs if
+// that isn't already on.  the CPU must be stopped.
+//
+int wd16_tt_start(wd16_cpu_state_t* wd16_cpu_state, uint64_t every, int keep) {
+  TIMETRAVEL *tt;
+  REGION *region;
+  uint32_t addr, end;
+  int i, page;
+
+  if (wd16_cpu_state->tt)
+    return (false);
+  if ((tt = calloc(1, sizeof(TIMETRAVEL))) == NULL)
+    return (false);
+  tt->every = every ? every : WD16_TT_EVERY;
+  tt->keep = (keep > 1) ? keep : WD16_TT_KEEP;
+  if ((tt->ring = calloc(tt->keep, sizeof(TTCKPT))) == NULL) {
+    free(tt);
+    return (false);
+  }
+  for (i = 0; i < wd16_cpu_state->mem.count; i++) {
+    region = &wd16_cpu_state->mem.region[i];
+    end = ((uint64_t)region->base + region->size > 65536) ? 65536 : region->base + region->size;
+    for (addr = region->base & ~(TT_PAGE - 1); addr < end; addr += TT_PAGE)
+      tt->have[addr >> (DIRTY_SHIFT + 6)] |= (uint64_t)1 << ((addr >> DIRTY_SHIFT) & 63);
+  }
+  if ((tt->log = cpu_dirty_open(wd16_cpu_state)) == 0) {
+    free(tt->ring);
+    free(tt);
+    return (false);
+  }
+  if (wd16_cpu_state->rr.mode == RR_OFF) {
+    cpu_rr_record(wd16_cpu_state, 0, 0);
+    tt->recording = true;
+  }
+  wd16_cpu_state->tt = tt;
+
+  for (page = 0; page < DIRTY_PAGES; page++)
+    if (tt->have[page >> 6] & ((uint64_t)1 << (page & 63)))
+      tt_page(wd16_cpu_state, page, tt->image + page * TT_PAGE, false);
+  tt->event = cpu_event_schedule(wd16_cpu_state, tt->every, tt_event, wd16_cpu_state);
+  tt_save(wd16_cpu_state, tt_ckpt(tt, 0));
+  tt->count = 1;
+  return (true);
+}
+
+void wd16_tt_stop(wd16_cpu_state_t* wd16_cpu_state) {
+  TIMETRAVEL *tt = wd16_cpu_state->tt;
+  int i;
+
+  if (tt == NULL)
+    return;
+  cpu_event_cancel(wd16_cpu_state, tt->event);
+  if (tt->recording)
+    cpu_rr_stop(wd16_cpu_state);
+  cpu_dirty_close(wd16_cpu_state, tt->log);
+  for (i = 0; i < tt->count; i++)
+    tt_drop(tt_ckpt(tt, i));
+  free(tt->ring);
+  free(tt);
+  wd16_cpu_state->tt = NULL;
+}
+
+//
+// the earliest instcount that can be gone back to
+//
+uint64_t wd16_tt_oldest(wd16_cpu_state_t* wd16_cpu_state) {
+  TIMETRAVEL *tt = wd16_cpu_state->tt;
+
+  return (tt ? tt_ckpt(tt, 0)->regs.instcount : 0);
+}
+
+//
+// go to the first instruction boundary at or after 'instcount', which
+// may be ahead of where the machine is but not past where it really
+// is.  false if that's before the oldest checkpoint.
+//
+int wd16_tt_seek(wd16_cpu_state_t* wd16_cpu_state, uint64_t instcount) {
+  TIMETRAVEL *tt = wd16_cpu_state->tt;
+  REGS *r = &wd16_cpu_state->regs;
+  uint64_t until;
+  int k;
+
+  if (tt == NULL)
+    return (false);
+  until = tt_present(wd16_cpu_state);
+  if (instcount > until)
+    instcount = until;
+  if (instcount < r->instcount) {
+    if ((k = tt_before(tt, instcount)) < 0)
+      return (false);
+    tt_restore(wd16_cpu_state, k, until);
+  }
+  while ((r->instcount < instcount) && !r->waiting)
+    cpu_step();
+  return (true);
+}
+
+//
+// back one instruction
+//
+int wd16_tt_step_back(wd16_cpu_state_t* wd16_cpu_state) {
+  TIMETRAVEL *tt = wd16_cpu_state->tt;
+  uint64_t now = wd16_cpu_state->regs.instcount, found;
+  int k;
+
+  if ((tt == NULL) || ((k = tt_before(tt, now - 1)) < 0))
+    return (false);
+  found = tt_scan(wd16_cpu_state, k, now, -1, tt_present(wd16_cpu_state));
+  return (wd16_tt_seek(wd16_cpu_state, found));
+}
+
+//
+// back to just before the last time the CPU ran the instruction at
+// 'pc'.  false, and back where it was, if that's before the oldest
+// checkpoint.
+//
+int wd16_tt_continue_back(wd16_cpu_state_t* wd16_cpu_state, uint16_t pc) {
+  TIMETRAVEL *tt = wd16_cpu_state->tt;
+  uint64_t now = wd16_cpu_state->regs.instcount, limit = now, until, found = 0;
+  int k;
+
+  if ((tt == NULL) || ((k = tt_before(tt, now - 1)) < 0))
+    return (false);
+  until = tt_present(wd16_cpu_state);
+  for (; (k >= 0) && !found; k--) {
+    found = tt_scan(wd16_cpu_state, k, limit, pc, until);
+    limit = tt_ckpt(tt, k)->regs.instcount;
+  }
+  wd16_tt_seek(wd16_cpu_state, found ? found : now);
+  return (found != 0);
+}
@@ -0,0 +1,51 @@
+/* wd16-tt.h     (c) Copyright Mike Sharkey, 2021                    */
+/* ----------------------------------------------------------------- */
+/*                                                                   */
+/* This software is an emulator for the Alpha-Micro AM-100 computer. */
+/* It is copyright by Michael Noel and licensed for non-commercial   */
+/* hobbyist use under terms of the "Q public license", an open       */
+/* source certified license.  A copy of that license may be found    */
+/* here:       http://www.otterway.com/am100/license.html            */
+/*                                                                   */
+/* There exist known serious discrepancies between this software's   */
+/* internal functioning and that of a real AM-100, as well as        */
+/* between it and the WD-1600 manual describing the functionality of */
+/* a real AM-100, and even between it and the comments in the code   */
+/* describing what it is intended to do! Use it at your own risk!    */
+/*                                                                   */
+/* Reliability aside, it isn't the intent of the copyright holder to */
+/* use this software to compete with current or future Alpha-Micro   */
+/* products, and no such competing application of the software will  */
+/* be supported.                                                     */
+/*                                                                   */
+/* Alpha-Micro and other software that may be run on this emulator   */
+/* are not covered by the above copyright or license and must be     */
+/* legally obtained from an authorized source.                       */
+/*                                                                   */
+/* ----------------------------------------------------------------- */
+
+#ifndef __WD16_TT_H__
+#define __WD16_TT_H__
+
+#include "wd16.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define WD16_TT_EVERY 1000000           /* default checkpoint spacing*/
+#define WD16_TT_KEEP  64                /* default checkpoints kept  */
+
+int      wd16_tt_start(wd16_cpu_state_t* wd16_cpu_state, uint64_t every, int keep);
+void     wd16_tt_stop(wd16_cpu_state_t* wd16_cpu_state);
+uint64_t wd16_tt_oldest(wd16_cpu_state_t* wd16_cpu_state);
+int      wd16_tt_seek(wd16_cpu_state_t* wd16_cpu_state, uint64_t instcount);
+int      wd16_tt_step_back(wd16_cpu_state_t* wd16_cpu_state);
+int      wd16_tt_continue_back(wd16_cpu_state_t* wd16_cpu_state, uint16_t pc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
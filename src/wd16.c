@@ -24,6 +24,7 @@
 /*                                                                   */
 /* ----------------------------------------------------------------- */
 
+#include <time.h>
 #include "wd16.h"
 #include "cpu-fmt1.h"
 #include "cpu-fmt2.h"
@@ -37,8 +38,12 @@
 #include "cpu-fmt10.h"
 #include "cpu-fmt11.h"
 #include "instruction-type.h"
+#include "cpu-event.h"
+#include "cpu-rr.h"
 
-wd16_cpu_state_t wd16_cpu_state;
+// the host sets up intlock_t; cpu_wait() and cpu_interrupt() need the
+// condition ready before it does anything else
+wd16_cpu_state_t wd16_cpu_state = {.intcond_t = PTHREAD_COND_INITIALIZER};
 
 /*-------------------------------------------------------------------*/
 /* when the opcode is invalid...                                     */
@@ -79,9 +84,9 @@ void do_fmt_invalid() {
   // --- opcode is greater than F000 (fmt 11) when it will load from "1A".
   //
   wd16_cpu_state.regs.SP -= 2;
-  wd16_cpu_state.putAMword((unsigned char *)&wd16_cpu_state.regs.PS, wd16_cpu_state.regs.SP);
+  cpu_putAMword(&wd16_cpu_state, (unsigned char *)&wd16_cpu_state.regs.PS, wd16_cpu_state.regs.SP);
   wd16_cpu_state.regs.SP -= 2;
-  wd16_cpu_state.putAMword((unsigned char *)&wd16_cpu_state.regs.PC, wd16_cpu_state.regs.SP);
+  cpu_putAMword(&wd16_cpu_state, (unsigned char *)&wd16_cpu_state.regs.PC, wd16_cpu_state.regs.SP);
   wd16_cpu_state.regs.waiting = 0;
   wd16_cpu_state.regs.trace = 0;
   wd16_cpu_state.regs.PS.I2 = 0;
@@ -89,6 +94,7 @@ void do_fmt_invalid() {
     wd16_cpu_state.getAMword((unsigned char *)&wd16_cpu_state.regs.PC, 0x1A);
   else
     wd16_cpu_state.getAMword((unsigned char *)&wd16_cpu_state.regs.PC, 0x1C);
+  cpu_cover_crash(&wd16_cpu_state, COVER_INVALID);
 
 } /* end function do_fmt_invalid */
 
@@ -166,6 +172,9 @@ void perform_interrupt() {
   while ((wd16_cpu_state.regs.whichint[i] == 0) && (i < 9))
     i++;
 
+  if (wd16_cpu_state.rr.mode && (i < 9))
+    cpu_rr_input(&wd16_cpu_state, RR_TAKE, i, 0);
+
   if (wd16_cpu_state.regs.tracing)
     wd16_cpu_state.trace_Interrupt(i);
 
@@ -174,9 +183,9 @@ void perform_interrupt() {
   switch (i) {
   case 0: // non-vectored
     wd16_cpu_state.regs.SP -= 2;
-    wd16_cpu_state.putAMword((unsigned char *)&wd16_cpu_state.regs.PS, wd16_cpu_state.regs.SP);
+    cpu_putAMword(&wd16_cpu_state, (unsigned char *)&wd16_cpu_state.regs.PS, wd16_cpu_state.regs.SP);
     wd16_cpu_state.regs.SP -= 2;
-    wd16_cpu_state.putAMword((unsigned char *)&wd16_cpu_state.regs.PC, wd16_cpu_state.regs.SP);
+    cpu_putAMword(&wd16_cpu_state, (unsigned char *)&wd16_cpu_state.regs.PC, wd16_cpu_state.regs.SP);
     wd16_cpu_state.regs.waiting = 0;
     wd16_cpu_state.regs.trace = 0;
     wd16_cpu_state.regs.PS.I2 = 0;
@@ -192,9 +201,9 @@ void perform_interrupt() {
   case 7:
   case 8:
     wd16_cpu_state.regs.SP -= 2;
-    wd16_cpu_state.putAMword((unsigned char *)&wd16_cpu_state.regs.PS, wd16_cpu_state.regs.SP);
+    cpu_putAMword(&wd16_cpu_state, (unsigned char *)&wd16_cpu_state.regs.PS, wd16_cpu_state.regs.SP);
     wd16_cpu_state.regs.SP -= 2;
-    wd16_cpu_state.putAMword((unsigned char *)&wd16_cpu_state.regs.PC, wd16_cpu_state.regs.SP);
+    cpu_putAMword(&wd16_cpu_state, (unsigned char *)&wd16_cpu_state.regs.PC, wd16_cpu_state.regs.SP);
     wd16_cpu_state.regs.waiting = 0;
     wd16_cpu_state.regs.trace = 0;
     wd16_cpu_state.regs.PS.I2 = 0;
@@ -216,22 +225,33 @@ void perform_interrupt() {
 
 } /* end function perform_interrupt */
 
+/*-------------------------------------------------------------------*/
+/* One pass of the CPU loop: events, interrupts, an instruction      */
+/*-------------------------------------------------------------------*/
+void cpu_step() {
+  if (wd16_cpu_state.regs.waiting == 0) {
+    if (wd16_cpu_state.regs.instcount >= wd16_cpu_state.events.next)
+      cpu_event_run(&wd16_cpu_state);
+    if (wd16_cpu_state.rr.mode && (wd16_cpu_state.regs.instcount >= wd16_cpu_state.rr.due))
+      cpu_rr_latch(&wd16_cpu_state);
+    if ((wd16_cpu_state.regs.intpending == 1) && (wd16_cpu_state.regs.PS.I2 == 1))
+      perform_interrupt();
+    execute_instruction();
+    if (wd16_cpu_state.regs.stepping == 1) {
+      wd16_cpu_state.regs.waiting = 1;
+      wd16_cpu_state.regs.stepping = 0;
+    }
+  } else
+    usleep(500);
+} /* end function cpu_step */
+
 /*-------------------------------------------------------------------*/
 /* CPU instruction execution thread                                  */
 /*-------------------------------------------------------------------*/
 void cpu_thread() {
 
   do {
-    if (wd16_cpu_state.regs.waiting == 0) {
-      if ((wd16_cpu_state.regs.intpending == 1) && (wd16_cpu_state.regs.PS.I2 == 1))
-        perform_interrupt();
-      execute_instruction();
-      if (wd16_cpu_state.regs.stepping == 1) {
-        wd16_cpu_state.regs.waiting = 1;
-        wd16_cpu_state.regs.stepping = 0;
-      }
-    } else
-      usleep(500);
+    cpu_step();
   } while (wd16_cpu_state.regs.halting == 0);
   pthread_exit(0);
 } /* end function cpu_thread */
@@ -243,3 +263,51 @@ void cpu_stop() {
   wd16_cpu_state.regs.halting = 1;
   pthread_join(wd16_cpu_state.cpu_t, NULL);
 }
+
+/*-------------------------------------------------------------------*/
+/* Raise an interrupt from a device thread                           */
+/*-------------------------------------------------------------------*/
+void cpu_interrupt(int level) {
+  if ((level < 0) || (level > 8))
+    return;
+  pthread_mutex_lock(&wd16_cpu_state.intlock_t);
+  if (wd16_cpu_state.rr.mode)
+    cpu_rr_raise(&wd16_cpu_state, level, true);
+  else {
+    wd16_cpu_state.regs.whichint[level] = 1;
+    wd16_cpu_state.regs.intpending = 1;
+  }
+  pthread_cond_broadcast(&wd16_cpu_state.intcond_t);
+  pthread_mutex_unlock(&wd16_cpu_state.intlock_t);
+} /* end function cpu_interrupt */
+
+/*-------------------------------------------------------------------*/
+/* Park the CPU thread until an interrupt or 'ns' nanoseconds        */
+/*-------------------------------------------------------------------*/
+int cpu_wait(uint64_t ns) {
+  struct timespec ts;
+  int raised;
+
+  // replaying, the log says when, not the clock; wd16_run_until() has
+  // no use for the clock either
+  if ((wd16_cpu_state.rr.mode == RR_REPLAY) || wd16_cpu_state.noparking)
+    return (wd16_cpu_state.regs.intpending);
+
+  // hosts that still set whichint[] directly don't signal, so the
+  // timeout is what wakes us for them
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += ns / 1000000000ULL;
+  ts.tv_nsec += ns % 1000000000ULL;
+  if (ts.tv_nsec >= 1000000000L) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000L;
+  }
+  pthread_mutex_lock(&wd16_cpu_state.intlock_t);
+  raised = (wd16_cpu_state.rr.mode == RR_RECORD) && (wd16_cpu_state.rr.due == 0);  // held for cpu_rr_latch()
+  if ((wd16_cpu_state.regs.intpending == 0) && !raised) {
+    pthread_cond_timedwait(&wd16_cpu_state.intcond_t, &wd16_cpu_state.intlock_t, &ts);
+    raised = (wd16_cpu_state.rr.mode == RR_RECORD) && (wd16_cpu_state.rr.due == 0);
+  }
+  pthread_mutex_unlock(&wd16_cpu_state.intlock_t);
+  return (wd16_cpu_state.regs.intpending || raised);
+} /* end function cpu_wait */
@@ -125,6 +125,176 @@ typedef struct _REGS {                  /* Processor registers       */
 
 } REGS;
 
+/*-------------------------------------------------------------------*/
+/* Structure definition for real-time pacing governor                */
+/*-------------------------------------------------------------------*/
+typedef struct _PACE {                  /* Pacing governor           */
+  double ratio;                         /* target speed, 0=flat out  */
+  double effective;                     /* measured speed ratio      */
+  uint32_t ips;                         /* AM-100 instructions/sec   */
+  uint32_t quantum;                     /* instructions per check    */
+  uint64_t next;                        /* instcount of next check   */
+  uint64_t anchor_ns;                   /* host time at anchor       */
+  uint64_t anchor_inst;                 /* instcount at anchor       */
+  uint64_t last_ns;                     /* host time at last check   */
+  uint64_t last_inst;                   /* instcount at last check   */
+
+} PACE;
+
+/*-------------------------------------------------------------------*/
+/* Structure definition for instruction count event scheduler        */
+/*-------------------------------------------------------------------*/
+#define MAX_EVENTS 32                   /* scheduled events per CPU  */
+
+// void   callback(void *arg);
+typedef void (*event_callback_t)(void *arg);
+
+typedef struct _EVENT {                 /* Scheduled event           */
+  uint64_t when;                        /* instcount deadline        */
+  uint64_t seq;                         /* FIFO order within 'when'  */
+  event_callback_t callback;            /* function to call or NULL  */
+  void *arg;                            /* argument for callback     */
+  int level;                            /* interrupt to raise, or -1 */
+  int heap;                             /* heap index, -1 when free  */
+  unsigned gen;                         /* slot reuse generation     */
+
+} EVENT;
+
+typedef struct _EVENTQ {                /* Event queue (min-heap)    */
+  uint64_t next;                        /* instcount of next event   */
+  uint64_t seq;                         /* next sequence number      */
+  uint64_t warped;                      /* instructions skipped      */
+  int warp;                             /* WFI warps to next event   */
+  int count;                            /* number of queued events   */
+  int heap[MAX_EVENTS];                 /* slot numbers, heap order  */
+  EVENT slot[MAX_EVENTS];               /* event storage             */
+
+} EVENTQ;
+
+/*-------------------------------------------------------------------*/
+/* Structure definition for spin loop fast-forwarding                */
+/*-------------------------------------------------------------------*/
+#define SPIN_SOB  1                     /* SOB Rn,. delay loops      */
+#define SPIN_POLL 2                     /* TST/BIT/CMP + Bxx polling */
+
+typedef struct _SPIN {                  /* Spin loop detection       */
+  int off;                              /* SPIN_xxx kinds turned off */
+  uint64_t collapsed;                   /* loop instructions skipped */
+  uint64_t parked;                      /* times CPU thread parked   */
+  uint16_t poll;                        /* poll loop being waited on */
+  uint64_t polled;                      /* instcount at its last pass*/
+  uint32_t passes;                      /* its passes so far         */
+
+} SPIN;
+
+/*-------------------------------------------------------------------*/
+/* Structure definition for AMOS idle job detection                  */
+/*-------------------------------------------------------------------*/
+typedef struct _AMIDLE {                /* AMOS idle loop detector   */
+  int on;                               /* detector enabled          */
+  uint16_t lo, hi;                      /* idle loop PCs, 0=learn    */
+  uint16_t head;                        /* candidate loop head PC    */
+  uint16_t jobcur;                      /* JOBCUR at candidate       */
+  uint16_t r[7];                        /* R0-SP at candidate        */
+  uint64_t stores;                      /* stores made by the core   */
+  uint64_t stored;                      /* ... at candidate          */
+  int hits;                             /* identical passes seen     */
+  uint64_t inst;                        /* instcount at last pass    */
+  uint64_t period;                      /* instructions per pass     */
+  uint64_t parked;                      /* times CPU thread parked   */
+  uint64_t parked_ns;                   /* host time spent parked    */
+
+} AMIDLE;
+
+/*-------------------------------------------------------------------*/
+/* Structure definition for native routine assists                   */
+/*-------------------------------------------------------------------*/
+#define MAX_ASSISTS  32                 /* code assists per CPU      */
+#define ASSIST_SVCA  0                  /* svc kinds for the table   */
+#define ASSIST_SVCB  1
+#define ASSIST_SVCC  2
+
+struct _wd16_cpu_state_t;
+
+// int    assist(wd16_cpu_state_t* wd16_cpu_state, int arg, void *ctx);
+typedef int (*assist_callback_t)(struct _wd16_cpu_state_t *wd16_cpu_state, int arg, void *ctx);
+
+typedef struct _ASSISTFN {              /* Native routine            */
+  assist_callback_t callback;           /* function to call or NULL  */
+  void *ctx;                            /* host argument for it      */
+
+} ASSISTFN;
+
+typedef struct _ASSISTCODE {            /* Guest routine replaced    */
+  uint16_t addr;                        /* entry PC, 0=anywhere      */
+  uint16_t len;                         /* code bytes hashed         */
+  uint16_t first;                       /* first code word           */
+  uint32_t hash;                        /* FNV-1a of the code bytes  */
+  uint64_t hits;                        /* times replaced            */
+  ASSISTFN fn;                          /* native implementation     */
+
+} ASSISTCODE;
+
+typedef struct _ASSIST {                /* Assist registry           */
+  ASSISTFN svc[3][64];                  /* by ASSIST_SVCx and arg    */
+  int count;                            /* code assists in use       */
+  int anywhere;                         /* ... of those relocatable  */
+  uint64_t hits;                        /* native routines run       */
+  ASSISTCODE code[MAX_ASSISTS];         /* code assists              */
+  uint8_t addrmap[65536 / 8];           /* entry PCs with an assist  */
+  uint8_t wordmap[65536 / 8];           /* first words, relocatable  */
+
+} ASSIST;
+
+/*-------------------------------------------------------------------*/
+/* Structure definition for host memory regions                      */
+/*-------------------------------------------------------------------*/
+#define MAX_REGIONS 4                   /* regions the host can map  */
+
+typedef struct _REGION {                /* Guest memory in the host  */
+  uint32_t base;                        /* first guest address       */
+  uint32_t size;                        /* bytes                     */
+  uint8_t *host;                        /* guest byte order          */
+
+} REGION;
+
+typedef struct _MEMMAP {                /* Host memory regions       */
+  int count;                            /* regions in use            */
+  REGION region[MAX_REGIONS];           /* sorted by base            */
+
+} MEMMAP;
+
+/*-------------------------------------------------------------------*/
+/* Structure definition for guest memory dirty tracking              */
+/*-------------------------------------------------------------------*/
+#define DIRTY_SHIFT 8                   /* 256 byte pages            */
+#define DIRTY_PAGES (65536 >> DIRTY_SHIFT)
+#define DIRTY_ANY   65536               /* cpu_dirty_ea(): not known */
+#define DIRTY_LOGS  8                   /* consumers at once         */
+
+typedef struct _DIRTY {                 /* Pages written since fetch */
+  int on;                               /* a log is open             */
+  uint32_t used;                        /* open logs, a bit each     */
+  uint64_t map[DIRTY_PAGES / 64];       /* a bit per page            */
+  uint64_t log[DIRTY_LOGS][DIRTY_PAGES / 64]; /* each consumer's     */
+
+} DIRTY;
+
+/*-------------------------------------------------------------------*/
+/* Structure definition for branch coverage (fuzzing)                */
+/*-------------------------------------------------------------------*/
+#define COVER_INVALID 1                 /* do_fmt_invalid() trap     */
+#define COVER_FPTRAP  2                 /* floating point error trap */
+#define COVER_HALT    3                 /* HALT executed             */
+
+typedef struct _COVER {                 /* AFL-style edge coverage   */
+  uint8_t *map;                         /* hit counts, NULL when off */
+  uint32_t mask;                        /* map size - 1              */
+  uint32_t prev;                        /* last branch target >> 1   */
+  int crash;                            /* COVER_ that ended the run */
+
+} COVER;
+
 /*-------------------------------------------------------------------*/
 /* memory accesss callback typedefs                                  */
 /*-------------------------------------------------------------------*/
@@ -192,9 +362,81 @@ typedef void (*trace_fmt_H_callback_t)(int i);
 // void   trace_fmtInvalid(void);
 typedef void (*trace_fmt_I_callback_t)(void);
 
+/*-------------------------------------------------------------------*/
+/* Structure definition for input record/replay                      */
+/*-------------------------------------------------------------------*/
+#define RR_OFF    0                     /* interrupts as they come   */
+#define RR_RECORD 1                     /* logging inputs            */
+#define RR_REPLAY 2                     /* feeding them back         */
+
+#define RR_RAISE  1                     /* interrupt made pending    */
+#define RR_TAKE   2                     /* interrupt delivered       */
+#define RR_READB  3                     /* device byte read          */
+#define RR_READW  4                     /* device word read          */
+#define RR_SPIN   5                     /* SOB iterations parked     */
+
+#define RR_IOLO   0xFF00                /* default device registers  */
+#define RR_IOHI   0xFFFF
+
+typedef struct _RRENT {                 /* One logged input          */
+  uint64_t when;                        /* instcount it happened at  */
+  uint16_t addr;                        /* level or device address   */
+  uint16_t value;                       /* what was read             */
+  uint8_t kind;                         /* RR_                       */
+
+} RRENT;
+
+// void   sink(void *ctx, const RRENT *e);
+typedef void (*rr_sink_callback_t)(void *ctx, const RRENT *e);
+
+// int    fill(void *ctx);
+typedef int (*rr_fill_callback_t)(void *ctx);
+
+typedef struct _RR {                    /* Input log                 */
+  int mode;                             /* RR_OFF, _RECORD, _REPLAY  */
+  int after;                            /* mode when replay ends     */
+  uint64_t due;                         /* instcount to call latch   */
+  uint64_t until;                       /* instcount replay ends at  */
+  uint8_t raised[9];                    /* raised since last latch   */
+  uint16_t iolo, iohi;                  /* device register range     */
+  int nest;                             /* inside a wrapped callback */
+  RRENT *log;                           /* entries first..first+count*/
+  uint64_t first;                       /* number of log[0]          */
+  uint64_t pos;                         /* number of the next one    */
+  uint32_t count, size;
+  uint64_t diverged;                    /* replays that went astray  */
+  uint64_t lost;                        /* entries dropped, no memory*/
+  get_put_byte_callback_t getAMbyte;    /* the host's, while wrapped */
+  get_put_word_callback_t getAMword;
+  get_put_word_by_mode_callback_t getAMwordBYmode;
+  get_byte_by_mode_callback_t getAMbyteBYmode;
+  rr_sink_callback_t sink;              /* told each entry recorded  */
+  rr_fill_callback_t fill;              /* adds more to replay       */
+  void *ctx;                            /* for sink and fill         */
+
+} RR;
+
 typedef struct _wd16_cpu_state_t
 {
   REGS regs;
+  PACE pace;                  /* real-time pacing governor */
+  EVENTQ events;              /* device event scheduler */
+  SPIN spin;                  /* spin loop fast-forwarding */
+  AMIDLE amidle;              /* AMOS idle job detection */
+  int idle;                   /* WFI with nothing to wake it */
+  int noparking;              /* cpu_wait() returns at once */
+  ASSIST assist;              /* native routine assists */
+  struct _SVCPROF *svcprof;   /* SVC profiler, NULL when off */
+  MEMMAP mem;                 /* guest memory the host can share */
+  DIRTY dirty;                /* guest pages written */
+  COVER cover;                /* branch coverage, when fuzzing */
+  RR rr;                      /* input record/replay */
+  uint64_t snapid;            /* last snapshot saved or loaded */
+  int snaplog;                /* its dirty log, 0 before the first */
+  struct _SNAPLAZY *snaplazy; /* lazy load filling memory, or NULL */
+  struct _BASELINE *baseline; /* reset point, NULL if none */
+  struct _TIMETRAVEL *tt;     /* checkpoints, NULL when off */
+  struct _AMVDK *vdk;         /* virtual disk drives, NULL if none */
 
   uint16_t oldPCs[256];       /* table of prior PC's */
   unsigned oldPCindex;        /* pointer to next entry in prior PC's table */
@@ -203,6 +445,7 @@ typedef struct _wd16_cpu_state_t
                               /*          starts HI and go down.. */
 
   pthread_mutex_t intlock_t;  /* interrupt lock */
+  pthread_cond_t intcond_t;   /* signalled by cpu_interrupt() */
   pthread_t cpu_t;            /* cpu thread */
 
   /* trace callbacks */
@@ -247,8 +490,149 @@ extern wd16_cpu_state_t wd16_cpu_state;
 void do_fmt_invalid(void);
 void execute_instruction(void);
 void perform_interrupt(void);
+void cpu_step(void);
 void cpu_thread(void);
 void cpu_stop(void);
+void cpu_interrupt(int level);
+int cpu_wait(uint64_t ns);
+
+/*-------------------------------------------------------------------*/
+/* guest stores                                                      */
+/*-------------------------------------------------------------------*/
+
+//
+// every store the core makes goes through these, which mark the pages
+// written in wd16_cpu_state->dirty (cpu-dirty.c) once the callback has
+// stored.  marking after the store means a reader that clears the bits
+// and then copies the pages can never miss a write.  they also count
+// stores for the idle loop detector (am-idle.c).
+//
+
+static inline void cpu_dirty(wd16_cpu_state_t* wd16_cpu_state, uint32_t addr, uint32_t len) {
+  uint32_t page, last = ((addr + len - 1) & 0xFFFF) >> DIRTY_SHIFT;
+
+  for (page = (addr & 0xFFFF) >> DIRTY_SHIFT;; page = (page + 1) % DIRTY_PAGES) {
+    __atomic_fetch_or(&wd16_cpu_state->dirty.map[page >> 6], (uint64_t)1 << (page & 63), __ATOMIC_RELAXED);
+    if (page == last)
+      break;
+  }
+}
+
+static inline void cpu_putAMbyte(wd16_cpu_state_t* wd16_cpu_state, unsigned char *chr, long address) {
+  wd16_cpu_state->putAMbyte(chr, address);
+  wd16_cpu_state->amidle.stores++;
+  if (wd16_cpu_state->dirty.on)
+    cpu_dirty(wd16_cpu_state, address, 1);
+}
+
+static inline void cpu_putAMword(wd16_cpu_state_t* wd16_cpu_state, unsigned char *chr, long address) {
+  wd16_cpu_state->putAMword(chr, address);
+  wd16_cpu_state->amidle.stores++;
+  if (wd16_cpu_state->dirty.on)
+    cpu_dirty(wd16_cpu_state, address, 2);
+}
+
+//
+// the pointer a deferred mode goes through, read from a registered
+// region (cpu_mem_region()) rather than by the get callback, which
+// might be a device register's.  outside them it isn't known, and
+// *len is set to DIRTY_ANY: every page is marked.
+//
+static inline uint16_t cpu_dirty_ptr(wd16_cpu_state_t* wd16_cpu_state, uint16_t addr, uint32_t *len) {
+  MEMMAP *mem = &wd16_cpu_state->mem;
+  REGION *region;
+  uint8_t *p;
+  int i;
+
+  for (i = 0; i < mem->count; i++) {
+    region = &mem->region[i];
+    if ((addr >= region->base) && ((uint64_t)addr + 2 <= (uint64_t)region->base + region->size)) {
+      p = region->host + (addr - region->base);
+      return (p[0] | (p[1] << 8));
+    }
+  }
+  *len = DIRTY_ANY;
+  return (0);
+}
+
+//
+// the address a *BYmode store will write, worked out before the
+// callback applies the mode's side effects (callers have already
+// undone those of the matching get).  autodecrement is -1 or -2
+// depending on the register and operand size, so both are marked.
+//
+static inline uint16_t cpu_dirty_ea(wd16_cpu_state_t* wd16_cpu_state, int regnum, int mode, int offset, uint32_t *len) {
+  uint16_t r = wd16_cpu_state->regs.gpr[regnum];
+
+  *len = 2;
+  switch (mode) {
+  case 3:                                 // @(R)+
+    return (cpu_dirty_ptr(wd16_cpu_state, r, len));
+  case 4:                                 // -(R)
+    return (r - 2);
+  case 5:                                 // @-(R)
+    return (cpu_dirty_ptr(wd16_cpu_state, r - 2, len));
+  case 6:                                 // X(R)
+    return (r + offset);
+  case 7:                                 // @X(R)
+    return (cpu_dirty_ptr(wd16_cpu_state, r + offset, len));
+  default:                                // (R), (R)+
+    return (r);
+  }
+}
+
+static inline void cpu_putAMwordBYmode(wd16_cpu_state_t* wd16_cpu_state, int regnum, int mode, int offset, uint16_t theword) {
+  uint32_t len = 0;
+  uint16_t ea = 0;
+
+  if (wd16_cpu_state->dirty.on && mode)
+    ea = cpu_dirty_ea(wd16_cpu_state, regnum, mode, offset, &len);
+  wd16_cpu_state->putAMwordBYmode(regnum, mode, offset, theword);
+  wd16_cpu_state->amidle.stores += (mode != 0);
+  if (len)
+    cpu_dirty(wd16_cpu_state, ea, len);
+}
+
+static inline void cpu_putAMbyteBYmode(wd16_cpu_state_t* wd16_cpu_state, int regnum, int mode, int offset, uint8_t thebyte) {
+  uint32_t len = 0;
+  uint16_t ea = 0;
+
+  if (wd16_cpu_state->dirty.on && mode)
+    ea = cpu_dirty_ea(wd16_cpu_state, regnum, mode, offset, &len);
+  wd16_cpu_state->putAMbyteBYmode(regnum, mode, offset, thebyte);
+  wd16_cpu_state->amidle.stores += (mode != 0);
+  if (len)
+    cpu_dirty(wd16_cpu_state, ea, len);
+}
+
+/*-------------------------------------------------------------------*/
+/* fuzzing                                                           */
+/*-------------------------------------------------------------------*/
+
+//
+// the control transfers a fuzzer learns from (taken branches, SOB,
+// JSR/RTN, TCALL/TJMP) report where they went; the edge between this
+// target and the last is counted as AFL does.  traps that mean the
+// guest has gone wrong stop the run by setting 'halting'
+// (wd16-fuzz.c).  with no map, each is a test of a NULL pointer.
+//
+static inline void cpu_cover(wd16_cpu_state_t* wd16_cpu_state, uint16_t to) {
+  COVER *cover = &wd16_cpu_state->cover;
+  uint32_t cur;
+
+  if (cover->map) {
+    cur = ((uint32_t)to * 0x9E3779B1u) >> 16;
+    cover->map[(cur ^ cover->prev) & cover->mask]++;
+    cover->prev = cur >> 1;
+  }
+}
+
+static inline void cpu_cover_crash(wd16_cpu_state_t* wd16_cpu_state, int why) {
+  if (wd16_cpu_state->cover.map) {
+    wd16_cpu_state->cover.crash = why;
+    wd16_cpu_state->regs.halting = 1;
+  }
+}
 
 /*-------------------------------------------------------------------*/
 /* misc                                                              */